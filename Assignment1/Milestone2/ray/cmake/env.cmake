@@ -11,13 +11,16 @@ set(CMAKE_CXX_FLAGS "--std=c++14 -g")
 ENDIF ()
 
 # Packages
-FIND_PACKAGE(OpenGL REQUIRED)
-INCLUDE_DIRECTORIES(${OPENGL_INCLUDE_DIRS})
-LINK_DIRECTORIES(${OPENGL_LIBRARY_DIRS})
-ADD_DEFINITIONS(${OPENGL_DEFINITIONS})
+# OpenGL is only needed by the ray GUI target (see src/CMakeLists.txt)
+FIND_PACKAGE(OpenGL)
+IF (OPENGL_FOUND)
+	INCLUDE_DIRECTORIES(${OPENGL_INCLUDE_DIRS})
+	LINK_DIRECTORIES(${OPENGL_LIBRARY_DIRS})
+	ADD_DEFINITIONS(${OPENGL_DEFINITIONS})
 
-MESSAGE(STATUS "OpenGL: ${OPENGL_LIBRARIES}")
-LIST(APPEND stdgl_libraries ${OPENGL_gl_LIBRARY})
+	MESSAGE(STATUS "OpenGL: ${OPENGL_LIBRARIES}")
+	LIST(APPEND stdgl_libraries ${OPENGL_gl_LIBRARY})
+ENDIF (OPENGL_FOUND)
 
 if (APPLE)
 	FIND_LIBRARY(COCOA_LIBRARY Cocoa REQUIRED)
@@ -0,0 +1,44 @@
+# Generates a benchmark scene with hundreds of small point lights hovering
+# over a floor covered in spheres.  Every light falls off quickly, so with a
+# light cutoff (e.g. {"light_cutoff": 4} in the -j settings file) each
+# shading point only needs a handful of them.
+#
+# usage: python gen_many_lights.py [lights] [spheres_per_side] > many_lights.ray
+
+import random
+import sys
+
+lights = int(sys.argv[1]) if len(sys.argv) > 1 else 400
+side = int(sys.argv[2]) if len(sys.argv) > 2 else 12
+size = 100.0
+random.seed(384)
+
+print("SBT-raytracer 1.0\n")
+print("camera {\nposition = (0, 70, 70);\nviewdir = (0, -0.7, -0.7);\nupdir = (0, 0.7, -0.7);\nfov = 60;\n}\n")
+
+for _ in range(lights):
+	x = random.uniform(-size / 2, size / 2)
+	z = random.uniform(-size / 2, size / 2)
+	y = random.uniform(1.0, 3.0)
+	r, g, b = (random.uniform(0.4, 1.0) for _ in range(3))
+	print("point_light {")
+	print("position = (%.3f, %.3f, %.3f);" % (x, y, z))
+	print("colour = (%.3f, %.3f, %.3f);" % (r, g, b))
+	print("constant_attenuation_coeff = 1.0;")
+	print("linear_attenuation_coeff = 0.5;")
+	print("quadratic_attenuation_coeff = 1.0;")
+	print("}\n")
+
+# floor
+print("translate(0, 0, 0, rotate(1, 0, 0, -1.5708, scale(%g, square {" % size)
+print("material = {\ndiffuse = (0.8, 0.8, 0.8);\nspecular = (0.2, 0.2, 0.2);\nshininess = 32;\n}})))\n")
+
+step = size / side
+for i in range(side):
+	for j in range(side):
+		x = -size / 2 + (i + 0.5) * step
+		z = -size / 2 + (j + 0.5) * step
+		print("translate(%.3f, 2, %.3f, scale(2, sphere {" % (x, z))
+		print("material = {")
+		print("diffuse = (%.3f, %.3f, %.3f);" % (i / float(side), 0.5, j / float(side)))
+		print("specular = (0.5, 0.5, 0.5);\nshininess = 64;\n}}))\n")
@@ -0,0 +1,351 @@
+#include "Animation.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include "RayTracer.h"
+#include "fileio/images.h"
+#include "scene/scene.h"
+#include "SceneObjects/trimesh.h"
+#include "ui/TraceUI.h"
+#include "ui/json.hpp"
+
+using Json = nlohmann::json;
+
+extern TraceUI* traceUI;
+
+// rebuild the BVH once refitting has grown its summed node area this much
+#define REBUILD_FACTOR 1.5
+
+namespace {
+
+glm::dvec3 readVec3(const Json& j)
+{
+	if (!j.is_array() || j.size() != 3)
+		throw std::runtime_error("expected [x, y, z], got " + j.dump());
+	return glm::dvec3(j[0].get<double>(), j[1].get<double>(), j[2].get<double>());
+}
+
+glm::dvec4 readVec4(const Json& j)
+{
+	if (!j.is_array() || j.size() != 4)
+		throw std::runtime_error("expected [x, y, z, angle], got " + j.dump());
+	return glm::dvec4(j[0].get<double>(), j[1].get<double>(), j[2].get<double>(), j[3].get<double>());
+}
+
+} // anonymous namespace
+
+template <typename T>
+void Animation::Track<T>::add(double frame, const T& value)
+{
+	auto it = std::upper_bound(keys.begin(), keys.end(), frame,
+	                           [](double f, const std::pair<double, T>& k) { return f < k.first; });
+	keys.insert(it, std::make_pair(frame, value));
+}
+
+template <typename T>
+T Animation::Track<T>::at(double frame) const
+{
+	if (frame <= keys.front().first)
+		return keys.front().second;
+	if (frame >= keys.back().first)
+		return keys.back().second;
+
+	size_t k = 1;
+	while (keys[k].first < frame)
+		k++;
+	const auto& a = keys[k - 1];
+	const auto& b = keys[k];
+	double t = (frame - a.first) / (b.first - a.first);
+	return a.second + (b.second - a.second) * t;
+}
+
+Animation::Animation(RayTracer* rt)
+	: raytracer(rt), num_frames(0), builtCost(0.0), rebuilds(0)
+{
+}
+
+bool Animation::load(const char* file)
+{
+	std::ifstream fin(file);
+	if (!fin)
+	{
+		traceUI->alert(std::string("Error: couldn't read animation file ") + file);
+		return false;
+	}
+
+	Scene* scene = raytracer->getMutableScene();
+	int last_key = 0;
+	try
+	{
+		Json json;
+		fin >> json;
+
+		if (json.count("camera"))
+		{
+			for (const auto& key : json["camera"])
+			{
+				double f = key.at("frame").get<double>();
+				if (key.count("eye"))		eye.add(f, readVec3(key["eye"]));
+				if (key.count("look_at"))	lookAt.add(f, readVec3(key["look_at"]));
+				if (key.count("up"))		up.add(f, readVec3(key["up"]));
+				if (key.count("fov"))		fov.add(f, key["fov"].get<double>());
+				last_key = std::max(last_key, (int)f);
+			}
+		}
+
+		int num_objects = (int)(scene->endObjects() - scene->beginObjects());
+		if (json.count("objects"))
+		{
+			for (const auto& anim : json["objects"])
+			{
+				int index = anim.at("index").get<int>();
+				if (index < 0 || index >= num_objects)
+					throw std::runtime_error("object index " + std::to_string(index) + " is out of range");
+
+				ObjectTrack track;
+				track.obj = scene->beginObjects()[index].get();
+				track.node = nullptr;
+				track.mesh = dynamic_cast<Trimesh*>(track.obj);
+				for (const auto& key : anim.at("keys"))
+				{
+					double f = key.at("frame").get<double>();
+					if (key.count("translate"))	track.translate.add(f, readVec3(key["translate"]));
+					if (key.count("rotate"))	track.rotate.add(f, readVec4(key["rotate"]));
+					if (key.count("scale"))		track.scale.add(f, readVec3(key["scale"]));
+					last_key = std::max(last_key, (int)f);
+				}
+
+				// the BVH intersects mesh faces without their transform, so
+				// meshes are animated by moving the vertices themselves
+				if (track.mesh)
+				{
+					track.restVertices = track.mesh->getVertices();
+					track.restNormals = track.mesh->getNormals();
+				}
+				else
+				{
+					// give the object its own node so siblings sharing its
+					// transform stay put
+					track.node = track.obj->getTransform()->createChild(glm::dmat4x4(1.0));
+					track.obj->setTransform(track.node);
+				}
+				objects.push_back(std::move(track));
+			}
+		}
+
+		num_frames = json.value("frames", last_key + 1);
+	}
+	catch (std::exception& e)
+	{
+		traceUI->alert(std::string("Animation file ") + file + ": " + e.what());
+		return false;
+	}
+
+	builtCost = scene->refit_BVH();
+	return num_frames > 0;
+}
+
+void Animation::moveObject(ObjectTrack& track, const glm::dmat4x4& xform)
+{
+	if (!track.mesh)
+	{
+		track.node->setLocalTransform(xform);
+		track.obj->ComputeBoundingBox();
+		if (auto mso = dynamic_cast<MaterialSceneObject*>(track.obj))
+			mso->compute_centroid();
+		return;
+	}
+
+	glm::dmat3x3 normalXform = glm::transpose(glm::inverse(glm::dmat3x3(xform)));
+	std::vector<glm::dvec3> verts(track.restVertices.size());
+	std::vector<glm::dvec3> norms(track.restNormals.size());
+	for (size_t v = 0; v < verts.size(); v++)
+		verts[v] = glm::dvec3(xform * glm::dvec4(track.restVertices[v], 1.0));
+	for (size_t n = 0; n < norms.size(); n++)
+		norms[n] = normalXform * track.restNormals[n];
+	track.mesh->setVertices(verts, norms);
+
+	track.mesh->ComputeBoundingBox();
+	for (auto face : track.mesh->get_faces())
+	{
+		face->ComputeBoundingBox();
+		face->compute_centroid();
+	}
+}
+
+void Animation::setFrame(int frame)
+{
+	Scene* scene = raytracer->getMutableScene();
+	Camera& camera = scene->getCamera();
+
+	if (!eye.empty())
+		camera.setEye(eye.at(frame));
+	if (!lookAt.empty() || !up.empty())
+	{
+		glm::dvec3 dir = lookAt.empty() ? camera.getLook() : lookAt.at(frame) - camera.getEye();
+		glm::dvec3 upDir = up.empty() ? camera.getV() : up.at(frame);
+		camera.aim(dir, upDir);
+	}
+	if (!fov.empty())
+		camera.setFOV(fov.at(frame));
+
+	if (objects.empty())
+		return;
+
+	for (auto& track : objects)
+	{
+		glm::dmat4x4 xform(1.0);
+		if (!track.translate.empty())
+			xform = xform * glm::translate(track.translate.at(frame));
+		if (!track.rotate.empty())
+		{
+			glm::dvec4 r = track.rotate.at(frame);
+			glm::dvec3 axis(r.x, r.y, r.z);
+			if (glm::length(axis) > 0.0)
+				xform = xform * glm::rotate(r.w, glm::normalize(axis));
+		}
+		if (!track.scale.empty())
+			xform = xform * glm::scale(track.scale.at(frame));
+		moveObject(track, xform);
+	}
+
+	double cost = scene->refit_BVH();
+	if (cost > builtCost * REBUILD_FACTOR)
+	{
+		scene->rebuild_BVH();
+		builtCost = scene->refit_BVH();
+		rebuilds++;
+	}
+}
+
+// The output name becomes a printf format for the frame number.  A name
+// with '%' in it must already be one, with exactly one %d or %0Nd (and %%
+// for a literal '%'); anything else would hand snprintf arguments it
+// doesn't have.  Other names get _%04d before the extension.
+bool Animation::framePattern(const char* out, std::string& fmt) const
+{
+	std::string name(out);
+	if (name.find('%') == std::string::npos)
+	{
+		size_t dot = name.find_last_of('.');
+		size_t slash = name.find_last_of("\\/");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			dot = name.size();
+		fmt = name.substr(0, dot) + "_%04d" + name.substr(dot);
+		return true;
+	}
+
+	int conversions = 0;
+	for (size_t i = 0; i < name.size(); i++)
+	{
+		if (name[i] != '%')
+			continue;
+		size_t j = i + 1;
+		if (j < name.size() && name[j] == '%')
+		{
+			i = j;
+			continue;
+		}
+		if (j < name.size() && name[j] == '0')
+		{
+			j++;
+			while (j < name.size() && isdigit((unsigned char)name[j]))
+				j++;
+		}
+		if (j >= name.size() || name[j] != 'd')
+			return false;
+		conversions++;
+		i = j;
+	}
+	if (conversions != 1)
+		return false;
+	fmt = name;
+	return true;
+}
+
+std::string Animation::frameName(const std::string& fmt, int frame) const
+{
+	char buf[1024];
+	snprintf(buf, sizeof(buf), fmt.c_str(), frame);
+	return buf;
+}
+
+int Animation::render(int width, int height, const char* out)
+{
+	bool raw = std::string(out) == "-";
+	if (raw)
+	{
+#ifdef _MSC_VER
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	}
+
+	std::string fmt;
+	if (!raw && !framePattern(out, fmt))
+	{
+		traceUI->alert(std::string("Error: output name ") + out +
+		               " needs exactly one %d or %0Nd for the frame number (%% for a literal %)");
+		return 1;
+	}
+
+	// frames are compressed and written while the next one is traced
+	AsyncImageWriter writer;
+	auto start = std::chrono::steady_clock::now();
+	for (int f = 0; f < num_frames; f++)
+	{
+		auto frame_start = std::chrono::steady_clock::now();
+		setFrame(f);
+		auto posed = std::chrono::steady_clock::now();
+
+		raytracer->traceImage(width, height);
+		raytracer->waitRender();
+		if (traceUI->aaSwitch())
+		{
+			raytracer->aaImage();
+			raytracer->waitRender();
+		}
+
+		unsigned char* buf;
+		int w, h;
+		raytracer->getBuffer(buf, w, h);
+		if (raw)
+		{
+			// the buffer is stored bottom row first
+			for (int y = h - 1; y >= 0; y--)
+				fwrite(buf + y * w * 3, 1, w * 3, stdout);
+			fflush(stdout);
+		}
+		else
+		{
+			writer.write(frameName(fmt, f).c_str(), w, h, buf);
+		}
+
+		auto done = std::chrono::steady_clock::now();
+		std::cerr << "frame " << f + 1 << "/" << num_frames << ": "
+		          << std::chrono::duration<double>(done - frame_start).count() << "s ("
+		          << std::chrono::duration<double>(posed - frame_start).count() << "s posing)"
+		          << std::endl;
+	}
+
+	writer.finish();
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << num_frames << " frames in " << total << "s";
+	if (!objects.empty())
+		std::cerr << ", " << rebuilds << " BVH rebuilds";
+	std::cerr << std::endl;
+	return 0;
+}
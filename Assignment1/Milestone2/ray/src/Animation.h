@@ -0,0 +1,106 @@
+#ifndef __ANIMATION_H__
+#define __ANIMATION_H__
+
+// Batch rendering of a camera path (and optionally moving objects) from a
+// keyframe file, reusing the scene that is already loaded.
+//
+// The keyframe file is JSON:
+//
+//   {
+//     "frames": 48,
+//     "camera": [
+//       { "frame": 0,  "eye": [0, 2, 8], "look_at": [0, 0, 0], "up": [0, 1, 0], "fov": 30 },
+//       { "frame": 47, "eye": [8, 2, 0] }
+//     ],
+//     "objects": [
+//       { "index": 2, "keys": [
+//           { "frame": 0,  "translate": [0, 0, 0] },
+//           { "frame": 47, "translate": [0, 3, 0], "rotate": [0, 1, 0, 3.14], "scale": [1, 1, 1] } ] }
+//     ]
+//   }
+//
+// Every field is interpolated linearly between the keys that set it and
+// held before the first / after the last one.  Camera fields nobody sets
+// keep the value from the scene file.  "index" counts the objects in the
+// order they appear in the .ray file.  An object's keys build a
+// translate * rotate * scale matrix (rotate is axis x,y,z and an angle in
+// radians, as in the .ray format) that is applied in the object's own
+// space, under whatever transforms the scene file gave it.
+//
+// Frames where only the camera moves don't touch the BVH.  When objects
+// move their boxes are refit into the existing tree, and the tree is
+// rebuilt once refitting has made it noticeably worse.
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+class RayTracer;
+class Geometry;
+class TransformNode;
+class Trimesh;
+
+class Animation {
+public:
+	explicit Animation(RayTracer* rt);
+
+	// read the keyframes, the scene must already be loaded
+	bool load(const char* file);
+
+	int frameCount() const { return num_frames; }
+
+	// pose the camera and the objects for this frame and refresh the BVH
+	void setFrame(int frame);
+
+	// render every frame.  out is a file name that gets the frame number
+	// (a pattern like "frames/shot_%04d.png" with exactly one %d or %0Nd,
+	// otherwise "_0000" is inserted before the extension) or "-" to stream
+	// raw top-down RGB frames to stdout for an encoder.  Any other '%'
+	// pattern is rejected and nothing is rendered.
+	int render(int width, int height, const char* out);
+
+private:
+	// keys of a single animated value, sorted by frame
+	template <typename T>
+	struct Track {
+		std::vector<std::pair<double, T>> keys;
+
+		bool empty() const { return keys.empty(); }
+		void add(double frame, const T& value);
+		T at(double frame) const;
+	};
+
+	struct ObjectTrack {
+		Geometry* obj;
+		TransformNode* node;	// dedicated node under the object's old transform
+		Trimesh* mesh;			// meshes are moved vertex by vertex instead
+		std::vector<glm::dvec3> restVertices;
+		std::vector<glm::dvec3> restNormals;
+		Track<glm::dvec3> translate;
+		Track<glm::dvec4> rotate;
+		Track<glm::dvec3> scale;
+	};
+
+	void moveObject(ObjectTrack& track, const glm::dmat4x4& xform);
+	bool framePattern(const char* out, std::string& fmt) const;
+	std::string frameName(const std::string& fmt, int frame) const;
+
+	RayTracer* raytracer;
+	int num_frames;
+
+	Track<glm::dvec3> eye;
+	Track<glm::dvec3> lookAt;
+	Track<glm::dvec3> up;
+	Track<double> fov;
+	std::vector<ObjectTrack> objects;
+
+	double builtCost;	// BVH cost right after the last (re)build
+	int rebuilds;
+};
+
+#endif // __ANIMATION_H__
@@ -0,0 +1,487 @@
+#include "DistributedRender.h"
+#include "RayTracer.h"
+#include "scene/scene.h"
+#include "ui/TraceUI.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+extern TraceUI* traceUI;
+
+// Tiles are bigger than the in-process ones (see MIN_TILE_SIZE) so the
+// round trip to a worker is small next to the time spent tracing.
+#define DIST_TILE_SIZE 64
+
+DistributedRender::DistributedRender(RayTracer* rt, int w, int h)
+	: raytracer(rt), width(w), height(h), remaining(0)
+{
+	for (int y = 0; y < height; y += DIST_TILE_SIZE)
+	{
+		for (int x = 0; x < width; x += DIST_TILE_SIZE)
+		{
+			Tile t = { x, y, std::min(DIST_TILE_SIZE, width - x), std::min(DIST_TILE_SIZE, height - y) };
+			tiles.push_back(t);
+		}
+	}
+}
+
+std::vector<const SceneObject*> DistributedRender::sceneObjects(RayTracer* rt)
+{
+	std::vector<const SceneObject*> objs;
+	const Scene& scene = rt->getScene();
+	for (auto it = scene.beginObjects(); it != scene.endObjects(); ++it)
+		objs.push_back(dynamic_cast<const SceneObject*>(it->get()));
+	return objs;
+}
+
+void DistributedRender::renderLocally(int tile)
+{
+	const Tile& t = tiles[tile];
+	std::vector<unsigned char> pixels(t.w * t.h * 3);
+	std::vector<const SceneObject*> hits(t.w * t.h);
+	raytracer->traceRegion(width, height, t.x0, t.y0, t.w, t.h, pixels.data(), hits.data());
+	raytracer->storeRegion(t.x0, t.y0, t.w, t.h, pixels.data(), hits.data());
+	remaining--;
+}
+
+#ifndef _WIN32
+
+namespace {
+
+// header of every message in both directions, a tile with w == 0 tells
+// the worker to quit.  Replies are followed by the pixels, a uint32_t hit
+// id per pixel (see sceneObjects) and the worker's RayStats::Totals for
+// the tile.
+struct TileMsg {
+	int32_t img_w, img_h;
+	int32_t x0, y0, w, h;
+};
+
+bool readFully(int fd, void* data, size_t n)
+{
+	char* p = (char*)data;
+	while (n > 0)
+	{
+		ssize_t got = read(fd, p, n);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return false;
+		p += got;
+		n -= got;
+	}
+	return true;
+}
+
+bool writeFully(int fd, const void* data, size_t n)
+{
+	const char* p = (const char*)data;
+	while (n > 0)
+	{
+		ssize_t put = write(fd, p, n);
+		if (put < 0 && errno == EINTR)
+			continue;
+		if (put <= 0)
+			return false;
+		p += put;
+		n -= put;
+	}
+	return true;
+}
+
+// "host:port" -> tcp, anything else is a unix socket path
+bool isTcpAddress(const std::string& addr, std::string& host, std::string& port)
+{
+	size_t colon = addr.rfind(':');
+	if (colon == std::string::npos)
+	{
+		// a bare port number means all interfaces
+		if (!addr.empty() && addr.find_first_not_of("0123456789") == std::string::npos)
+		{
+			host.clear();
+			port = addr;
+			return true;
+		}
+		return false;
+	}
+	host = addr.substr(0, colon);
+	port = addr.substr(colon + 1);
+	return true;
+}
+
+int openListener(const char* addr)
+{
+	std::string host, port;
+	if (isTcpAddress(addr, host, port))
+	{
+		addrinfo hints, *res;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res) != 0)
+			return -1;
+		int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+		int one = 1;
+		if (fd >= 0)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) < 0 || listen(fd, 16) < 0)
+		{
+			if (fd >= 0)
+				close(fd);
+			freeaddrinfo(res);
+			return -1;
+		}
+		freeaddrinfo(res);
+		return fd;
+	}
+
+	sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, addr, sizeof(sa.sun_path) - 1);
+	unlink(addr);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (sockaddr*)&sa, sizeof(sa)) < 0 || listen(fd, 16) < 0)
+	{
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int openConnection(const char* addr)
+{
+	std::string host, port;
+	if (isTcpAddress(addr, host, port))
+	{
+		addrinfo hints, *res;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &res) != 0)
+			return -1;
+		int fd = -1;
+		for (addrinfo* ai = res; ai; ai = ai->ai_next)
+		{
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+				break;
+			if (fd >= 0)
+				close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+		return fd;
+	}
+
+	sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, addr, sizeof(sa.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (sockaddr*)&sa, sizeof(sa)) < 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+} // anonymous namespace
+
+bool DistributedRender::sendTile(Worker& worker, int tile)
+{
+	const Tile& t = tiles[tile];
+	TileMsg msg = { width, height, t.x0, t.y0, t.w, t.h };
+	if (!writeFully(worker.fd, &msg, sizeof(msg)))
+		return false;
+	worker.tile = tile;
+	return true;
+}
+
+bool DistributedRender::receiveTile(Worker& worker)
+{
+	const Tile& t = tiles[worker.tile];
+	TileMsg msg;
+	if (!readFully(worker.fd, &msg, sizeof(msg)))
+		return false;
+	if (msg.x0 != t.x0 || msg.y0 != t.y0 || msg.w != t.w || msg.h != t.h)
+		return false;
+
+	std::vector<unsigned char> pixels(t.w * t.h * 3);
+	std::vector<uint32_t> ids(t.w * t.h);
+	RayStats::Totals stats;
+	if (!readFully(worker.fd, pixels.data(), pixels.size()) ||
+	    !readFully(worker.fd, ids.data(), ids.size() * sizeof(uint32_t)) ||
+	    !readFully(worker.fd, &stats, sizeof(stats)))
+		return false;
+
+	std::vector<const SceneObject*> hits(ids.size());
+	for (size_t k = 0; k < ids.size(); k++)
+	{
+		if (ids[k] > objects.size())
+			return false;
+		hits[k] = ids[k] ? objects[ids[k] - 1] : nullptr;
+	}
+	raytracer->storeRegion(t.x0, t.y0, t.w, t.h, pixels.data(), hits.data());
+	worker_stats += stats;
+
+	worker.tile = -1;
+	remaining--;
+	return true;
+}
+
+// worker died or sent garbage, give its tile to someone else
+void DistributedRender::dropWorker(Worker& worker)
+{
+	if (worker.tile >= 0)
+	{
+		std::cerr << "worker " << (worker.pid ? worker.pid : worker.fd)
+		          << " lost, reassigning its tile" << std::endl;
+		pending.push_back(worker.tile);
+	}
+	close(worker.fd);
+	worker.fd = -1;
+	worker.tile = -1;
+}
+
+bool DistributedRender::coordinate(int local_workers, const char* listen_addr)
+{
+	// a worker hanging up must not kill us while we write to it
+	signal(SIGPIPE, SIG_IGN);
+
+	// fork before the ray tracer starts any threads, the children get the
+	// parsed scene and BVH copy-on-write
+	for (int k = 0; k < local_workers; k++)
+	{
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		{
+			traceUI->alert("socketpair failed");
+			return false;
+		}
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			traceUI->alert("fork failed");
+			close(sv[0]);
+			close(sv[1]);
+			return false;
+		}
+		if (pid == 0)
+		{
+			close(sv[0]);
+			for (const auto& w : workers)
+				close(w.fd);
+			// one process per worker already, no need for more threads
+			TraceUI::m_threads = 1;
+			_exit(serve(raytracer, sv[1]));
+		}
+		close(sv[1]);
+		Worker w = { sv[0], (int)pid, -1 };
+		workers.push_back(w);
+	}
+
+	int listen_fd = -1;
+	if (listen_addr)
+	{
+		listen_fd = openListener(listen_addr);
+		if (listen_fd < 0)
+		{
+			traceUI->alert(std::string("unable to listen on ") + listen_addr);
+			return false;
+		}
+	}
+
+	raytracer->traceSetup(width, height);
+	objects = sceneObjects(raytracer);
+
+	// hand tiles out from the top of the image down (the buffer is bottom-up)
+	remaining = (int)tiles.size();
+	pending.clear();
+	for (int t = 0; t < (int)tiles.size(); t++)
+		pending.push_back(t);
+
+	while (remaining > 0)
+	{
+		// give every idle worker a tile
+		int live = 0;
+		for (auto& w : workers)
+		{
+			if (w.fd >= 0 && w.tile < 0 && !pending.empty())
+			{
+				int t = pending.back();
+				pending.pop_back();
+				if (!sendTile(w, t))
+				{
+					pending.push_back(t);
+					dropWorker(w);
+				}
+			}
+			if (w.fd >= 0)
+				live++;
+		}
+
+		// nobody to give work to, do a tile ourselves (and keep an eye out
+		// for new workers)
+		bool self = (live == 0 && !pending.empty());
+		if (self)
+		{
+			int t = pending.back();
+			pending.pop_back();
+			renderLocally(t);
+		}
+
+		std::vector<pollfd> fds;
+		std::vector<Worker*> owners;
+		for (auto& w : workers)
+		{
+			if (w.fd >= 0 && w.tile >= 0)
+			{
+				pollfd p = { w.fd, POLLIN, 0 };
+				fds.push_back(p);
+				owners.push_back(&w);
+			}
+		}
+		if (listen_fd >= 0)
+		{
+			pollfd p = { listen_fd, POLLIN, 0 };
+			fds.push_back(p);
+		}
+		if (fds.empty())
+			continue;
+
+		if (poll(fds.data(), fds.size(), self ? 0 : -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			traceUI->alert("poll failed");
+			break;
+		}
+
+		for (size_t k = 0; k < owners.size(); k++)
+		{
+			if (fds[k].revents && !receiveTile(*owners[k]))
+				dropWorker(*owners[k]);
+		}
+		if (listen_fd >= 0 && fds.back().revents & POLLIN)
+		{
+			int fd = accept(listen_fd, nullptr, nullptr);
+			if (fd >= 0)
+			{
+				Worker w = { fd, 0, -1 };
+				workers.push_back(w);
+			}
+		}
+	}
+
+	// tell everyone to go home
+	TileMsg quit = { width, height, 0, 0, 0, 0 };
+	for (auto& w : workers)
+	{
+		if (w.fd >= 0)
+		{
+			writeFully(w.fd, &quit, sizeof(quit));
+			close(w.fd);
+		}
+		if (w.pid)
+			waitpid(w.pid, nullptr, 0);
+	}
+	if (listen_fd >= 0)
+	{
+		close(listen_fd);
+		std::string host, port;
+		if (!isTcpAddress(listen_addr, host, port))
+			unlink(listen_addr);
+	}
+
+	std::cerr << "rendered " << tiles.size() << " tiles with "
+	          << workers.size() << " workers" << std::endl;
+	return remaining == 0;
+}
+
+int DistributedRender::serve(RayTracer* rt, int fd)
+{
+	std::unordered_map<const SceneObject*, uint32_t> objectIds;
+	std::vector<const SceneObject*> objs = sceneObjects(rt);
+	for (size_t k = 0; k < objs.size(); k++)
+		objectIds.emplace(objs[k], (uint32_t)k + 1);
+
+	TileMsg msg;
+	std::vector<unsigned char> pixels;
+	std::vector<const SceneObject*> hits;
+	std::vector<uint32_t> ids;
+	// forked workers start with whatever the coordinator had counted
+	RayStats::reset();
+	while (readFully(fd, &msg, sizeof(msg)) && msg.w > 0)
+	{
+		pixels.resize(msg.w * msg.h * 3);
+		hits.assign(msg.w * msg.h, nullptr);
+		rt->traceRegion(msg.img_w, msg.img_h, msg.x0, msg.y0, msg.w, msg.h, pixels.data(), hits.data());
+		RayStats::Totals stats = RayStats::reset();
+		ids.resize(hits.size());
+		for (size_t k = 0; k < hits.size(); k++)
+		{
+			auto it = hits[k] ? objectIds.find(hits[k]) : objectIds.end();
+			ids[k] = it != objectIds.end() ? it->second : 0;
+		}
+		if (!writeFully(fd, &msg, sizeof(msg)) || !writeFully(fd, pixels.data(), pixels.size()) ||
+		    !writeFully(fd, ids.data(), ids.size() * sizeof(uint32_t)) ||
+		    !writeFully(fd, &stats, sizeof(stats)))
+			break;
+	}
+	close(fd);
+	return 0;
+}
+
+int DistributedRender::work(RayTracer* rt, const char* addr)
+{
+	int fd = openConnection(addr);
+	if (fd < 0)
+	{
+		traceUI->alert(std::string("unable to connect to ") + addr);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	return serve(rt, fd);
+}
+
+#else // _WIN32
+
+// no fork or posix sockets here, just render everything in this process
+bool DistributedRender::coordinate(int local_workers, const char* listen_addr)
+{
+	traceUI->alert("distributed rendering is not supported on windows, rendering locally");
+	raytracer->traceSetup(width, height);
+	remaining = (int)tiles.size();
+	for (int t = 0; t < (int)tiles.size(); t++)
+		renderLocally(t);
+	return true;
+}
+
+int DistributedRender::work(RayTracer* rt, const char* addr)
+{
+	traceUI->alert("distributed rendering is not supported on windows");
+	return 1;
+}
+
+#endif
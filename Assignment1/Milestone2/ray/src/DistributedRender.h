@@ -0,0 +1,82 @@
+#ifndef __DISTRIBUTEDRENDER_H__
+#define __DISTRIBUTEDRENDER_H__
+
+// Multi-process tile rendering.
+//
+// The coordinator (the process that was asked to write the image) loads the
+// scene, cuts the image into tiles and hands them to workers one at a time.
+// Workers send back the finished pixels, which get copied into the
+// RayTracer's frame buffer.  Workers are either
+//
+//   - local:  forked from the coordinator after the scene is loaded, so
+//             they share the parsed scene and BVH copy-on-write and talk
+//             to the coordinator over a unix socketpair (-W <n>), or
+//   - remote: separate `ray -C <host:port> [options] scene.ray` processes
+//             that load the scene themselves and connect to a coordinator
+//             listening with -L <port> (or -L <path> for a unix socket).
+//
+// If a worker goes away its tile is handed to someone else.  With no
+// workers left the coordinator renders the remaining tiles itself.
+//
+// Messages are raw structs in host byte order, so every machine taking
+// part needs the same endianness.  Workers send what every pixel of a
+// tile hit (as an index into the scene's objects, which every process
+// loaded from the same file) and their RayStats counters for it along
+// with its pixels, so the coordinator can anti-alias the finished image.
+
+#include <stdint.h>
+#include <vector>
+
+#include "scene/rayStats.h"
+
+class RayTracer;
+class SceneObject;
+
+class DistributedRender {
+public:
+	DistributedRender(RayTracer* rt, int w, int h);
+
+	// fork local workers and/or accept remote ones, then render the whole
+	// image into the ray tracer's buffer.  Returns false on setup errors.
+	bool coordinate(int local_workers, const char* listen_addr);
+
+	// run as a worker for the coordinator at addr ("host:port" or a unix
+	// socket path) until it says we are done
+	static int work(RayTracer* rt, const char* addr);
+
+	// what the workers counted for the tiles they sent back (tiles the
+	// coordinator traced itself are in its own RayStats)
+	const RayStats::Totals& workerStats() const { return worker_stats; }
+
+private:
+	struct Tile {
+		int x0, y0, w, h;
+	};
+
+	struct Worker {
+		int fd;
+		int pid;	// 0 for remote workers
+		int tile;	// tile being rendered, -1 if idle
+	};
+
+	static int serve(RayTracer* rt, int fd);
+	// the scene's objects in file order, hit ids are 1 + an index into this
+	// (0 for nothing)
+	static std::vector<const SceneObject*> sceneObjects(RayTracer* rt);
+
+	bool sendTile(Worker& worker, int tile);
+	bool receiveTile(Worker& worker);
+	void dropWorker(Worker& worker);
+	void renderLocally(int tile);
+
+	RayTracer* raytracer;
+	int width, height;
+	std::vector<Tile> tiles;
+	std::vector<const SceneObject*> objects;
+	std::vector<Worker> workers;
+	std::vector<int> pending;	// tiles nobody is working on (taken from the back)
+	int remaining;				// tiles not yet in the frame buffer
+	RayStats::Totals worker_stats;
+};
+
+#endif // __DISTRIBUTEDRENDER_H__
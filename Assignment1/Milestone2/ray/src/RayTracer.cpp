@@ -9,6 +9,9 @@
 
 #include "parser/Tokenizer.h"
 #include "parser/Parser.h"
+#include "fileio/mappedfile.h"
+#include "scene/sceneFile.h"
+#include "scene/rayStats.h"
 
 #include "ui/TraceUI.h"
 #include <cmath>
@@ -17,6 +20,7 @@
 #include <glm/gtx/io.hpp>
 #include <string.h> // for memset
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <thread>
@@ -35,7 +39,7 @@ bool debugMode = true;
 // enter the main ray-tracing method, getting things started by plugging
 // in an initial ray weight of (0.0,0.0,0.0) and an initial recursion depth of 0.
 
-glm::dvec3 RayTracer::trace(double x, double y)
+glm::dvec3 RayTracer::trace(double x, double y, const SceneObject** hitObj)
 {
 	// Clear out the ray cache in the scene for debugging purposes,
 	if (TraceUI::m_debug)
@@ -44,14 +48,30 @@ glm::dvec3 RayTracer::trace(double x, double y)
 	}
 
 	ray r(glm::dvec3(0,0,0), glm::dvec3(0,0,0), glm::dvec3(1,1,1), ray::VISIBILITY);
-	scene->getCamera().rayThrough(x,y,r);
+	// differentials are only worth tracking when something gets filtered
+	if (use_differentials)
+		scene->getCamera().rayThrough(x, y, 1.0 / buffer_width, 1.0 / buffer_height, r);
+	else
+		scene->getCamera().rayThrough(x,y,r);
 	double dummy;
-	glm::dvec3 ret = traceRay(r, glm::dvec3(1.0,1.0,1.0), 0, dummy, 1.0);
+	glm::dvec3 ret = traceRay(r, glm::dvec3(1.0,1.0,1.0), 0, dummy, 1.0, hitObj);
 	ret = glm::clamp(ret, 0.0, 1.0);
 	return ret;
 }
 
 glm::dvec3 RayTracer::tracePixel(int i, int j)
+{
+	glm::dvec3 col = computePixel(i, j);
+
+	unsigned char* pixel = buffer.data() + (i + j * buffer_width) * 3;
+	pixel[0] = (int)(255.0 * col[0]);
+	pixel[1] = (int)(255.0 * col[1]);
+	pixel[2] = (int)(255.0 * col[2]);
+	return col;
+}
+
+// compute the color of pixel (i,j) without writing it to the buffer
+glm::dvec3 RayTracer::computePixel(int i, int j)
 {
 	glm::dvec3 col(0,0,0);
 
@@ -60,38 +80,148 @@ glm::dvec3 RayTracer::tracePixel(int i, int j)
 
 	double x = double(i) / double(buffer_width);
 	double y = double(j) / double(buffer_height);
-	col = trace(x, y);
-
-	// AA stuff
-	if (computeAA)
-	{		
-		glm::dvec3 average(0.0, 0.0, 0.0);
-		int count = 0;
-		for (int u = 0; u < samples; u++)
+	const SceneObject* obj = nullptr;
+	col = trace(x, y, &obj);
+
+	// remember what the pixel hit so aaImage() can find object edges
+	if (!hit_objects.empty())
+		hit_objects[i + j * buffer_width] = obj;
+	return col;
+}
+
+// average samples x samples rays spread over pixel (i,j)
+glm::dvec3 RayTracer::supersamplePixel(int i, int j)
+{
+	glm::dvec3 average(0.0, 0.0, 0.0);
+	int count = 0;
+	for (int u = 0; u < samples; u++)
+	{
+		for (int v = 0; v < samples; v++)
 		{
-			for (int v = 0; v < samples; v++)
-			{
-				double x = double((i * samples) + u) / double(buffer_width * samples);
-				double y = double((j * samples) + v) / double(buffer_height * samples);
-				average += trace(x, y);
-				count++;
-			}
+			double x = double((i * samples) + u) / double(buffer_width * samples);
+			double y = double((j * samples) + v) / double(buffer_height * samples);
+			average += trace(x, y);
+			count++;
 		}
-		average = average * (1.0 / count);
-		col = (col * aaThresh) + (average * (1 - aaThresh));
 	}
-	unsigned char* pixel = buffer.data() + (i + j * buffer_width) * 3;
-	pixel[0] = (int)(255.0 * col[0]);
-	pixel[1] = (int)(255.0 * col[1]);
-	pixel[2] = (int)(255.0 * col[2]);
-	return col;
+	return average * (1.0 / count);
 }
 
 #define VERBOSE 0
 
+// does any object in the scene read a texture map?
+static bool sceneTextured(const Scene& scene)
+{
+	for (auto it = scene.beginObjects(); it != scene.endObjects(); ++it)
+	{
+		auto obj = dynamic_cast<const SceneObject*>(it->get());
+		if (obj && obj->getMaterial().Textured())
+			return true;
+	}
+	return false;
+}
+
+// does pixel (i,j) of a w wide, rows high block of first pass colors
+// differ from a neighbour enough to be supersampled?
+static bool isEdge(const unsigned char* colors, const SceneObject* const* hits, int w, int rows, int i, int j,
+                   double aaThresh)
+{
+	const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	int p = i + j * w;
+	const unsigned char* col = colors + p * 3;
+	for (const auto& o : offsets)
+	{
+		int ni = i + o[0];
+		int nj = j + o[1];
+		if (ni < 0 || nj < 0 || ni >= w || nj >= rows)
+			continue;
+		int n = ni + nj * w;
+		if (hits[n] != hits[p])
+			return true;
+		const unsigned char* ncol = colors + n * 3;
+		for (int c = 0; c < 3; c++)
+		{
+			if (std::abs(col[c] - ncol[c]) > aaThresh * 255.0)
+				return true;
+		}
+	}
+	return false;
+}
+
+// Follow one differential of r (origin dP, direction dD) to the surface
+// it hit: the offset ray is intersected with the same primitive (the face,
+// for meshes), which gives the surface point, normal and uv a pixel over.
+// If it misses (object edges, the next triangle of a mesh) or lands
+// somewhere unrelated, the tangent plane is used instead and the surface
+// is taken to be flat there.
+static void hitDifferential(const ray& r, const isect& i, const glm::dvec3& dP, const glm::dvec3& dD,
+                            glm::dvec3& dPhit, glm::dvec3& dN, glm::dvec2& dUV)
+{
+	glm::dvec3 P = r.at(i);
+	glm::dvec3 N = glm::normalize(i.getN());
+	glm::dvec3 D = r.getDirection();
+
+	double DN = glm::dot(D, N);
+	dPhit = dP + i.getT() * dD;
+	if (DN != 0.0)
+		dPhit -= (glm::dot(dPhit, N) / DN) * D;
+	dN = glm::dvec3(0.0);
+	dUV = glm::dvec2(0.0);
+
+	ray aux(r.getPosition() + dP, glm::normalize(D + dD), r.getAtten(), r.type());
+	isect ai;
+	if (i.getPrimitive()->intersect(aux, ai))
+	{
+		glm::dvec3 offset = aux.at(ai) - P;
+		if (glm::length(offset - dPhit) <= glm::length(dPhit))
+		{
+			dPhit = offset;
+			dN = glm::normalize(ai.getN()) - N;
+			dUV = ai.getUVCoordinates() - i.getUVCoordinates();
+		}
+	}
+}
+
+// differentials of the mirror direction of D about N (Igehy 1999)
+static ray::Differentials reflectDifferentials(const ray::Differentials& hit, const glm::dvec3& D, const glm::dvec3& N,
+                                               const glm::dvec3& dNdx, const glm::dvec3& dNdy)
+{
+	ray::Differentials out = hit;
+	double DN = glm::dot(D, N);
+	out.dDdx = hit.dDdx - 2.0 * (DN * dNdx + (glm::dot(hit.dDdx, N) + glm::dot(D, dNdx)) * N);
+	out.dDdy = hit.dDdy - 2.0 * (DN * dNdy + (glm::dot(hit.dDdy, N) + glm::dot(D, dNdy)) * N);
+	return out;
+}
+
+// differentials of T = eta * D - mu * N, the refraction of D
+static bool refractDifferentials(const ray::Differentials& hit, const glm::dvec3& D, const glm::dvec3& N,
+                                 const glm::dvec3& T, double eta, const glm::dvec3& dNdx, const glm::dvec3& dNdy,
+                                 ray::Differentials& out)
+{
+	double DN = glm::dot(D, N);
+	double TN = glm::dot(T, N);
+	if (!(TN < 0.0))	// total internal reflection or grazing
+		return false;
+	double mu = eta * DN - TN;
+	double dmu = eta - (eta * eta * DN) / TN;
+
+	out = hit;
+	out.dDdx = eta * hit.dDdx - (dmu * (glm::dot(hit.dDdx, N) + glm::dot(D, dNdx)) * N + mu * dNdx);
+	out.dDdy = eta * hit.dDdy - (dmu * (glm::dot(hit.dDdy, N) + glm::dot(D, dNdy)) * N + mu * dNdy);
+	return true;
+}
+
+// true if a ray carrying this weight can still change the pixel by more
+// than the cutoff (colors are clamped to [0,1] in the end)
+static bool contributes(const glm::dvec3& weight, double cutoff)
+{
+	return std::max(weight[0], std::max(weight[1], weight[2])) > cutoff;
+}
+
 // Do recursive ray tracing!  You'll want to insert a lot of code here
 // (or places called from here) to handle reflection, refraction, etc etc.
-glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, double& t, double prev_refrac_index)
+glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& weight, int depth, double& t, double prev_refrac_index,
+                                const SceneObject** hitObj)
 {
 	// return (0, 0, 0) if at max depth
 	if (depth > traceUI->getDepth())
@@ -108,6 +238,9 @@ glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, doub
 	//if (scene->intersect(r, i, false))
 	if (scene->intersect_BVH(r, i, 0))
 	{
+		if (hitObj)
+			*hitObj = i.getObject();
+
 		//std::cout << "bvh intersection!" << std::endl;
 		// 
 		// An intersection occurred!  We've got work to do.  For now,
@@ -146,8 +279,10 @@ glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, doub
 		// change normal direction if ray is refraction type and facing the same direction as in vector and material is transparent
 		double refra_index = prev_refrac_index / m.index(i);
 		double dist = 0.0;
+		bool inside = false;
 		if (glm::dot(in_vec, norm_vec) > 0 && r.type() == ray::REFRACTION && m.Trans())
 		{
+			inside = true;
 			norm_vec *= -1.0;
 			refra_index = m.index(i) / prev_refrac_index;
 			refra_index = glm::max(1.0, refra_index);
@@ -155,6 +290,27 @@ glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, doub
 		}
 		glm::dvec3 refl_vec = glm::reflect(in_vec, norm_vec); // in_vec - 2.0 * glm::dot(norm_vec, in_vec) * norm_vec;
 
+		// ray differentials at the hit point: they pick the mip level of
+		// textures here and are handed on to reflected / refracted rays
+		bool diffs = r.hasDifferentials() && (m.Textured() || m.Refl() || m.Trans());
+		ray::Differentials hit_diff;
+		glm::dvec3 dNdx(0.0), dNdy(0.0);
+		if (diffs)
+		{
+			const ray::Differentials& rd = r.getDifferentials();
+			glm::dvec2 dUVdx, dUVdy;
+			hitDifferential(r, i, rd.dPdx, rd.dDdx, hit_diff.dPdx, dNdx, dUVdx);
+			hitDifferential(r, i, rd.dPdy, rd.dDdy, hit_diff.dPdy, dNdy, dUVdy);
+			hit_diff.dDdx = rd.dDdx;
+			hit_diff.dDdy = rd.dDdy;
+			if (inside)
+			{
+				dNdx *= -1.0;
+				dNdy *= -1.0;
+			}
+			i.setUVDifferentials(dUVdx, dUVdy);
+		}
+
 		// calculate ambient term
 		glm::dvec3 I_ambient = m.ka(i) * scene->ambient();
 		// calculate emmision term
@@ -166,36 +322,40 @@ glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, doub
 
 		// get point slightly off the surface of intersection
 		glm::dvec3 shadow_p = inter_p + (out_vec * EPSILON);
+
+		// per-depth policy: deeper bounces may skip shadow rays and highlights
+		int shadow_depth = traceUI->getShadowDepth();
+		int specular_depth = traceUI->getSpecularDepth();
+		bool do_shadows = traceUI->shadowSw() && (shadow_depth < 0 || depth <= shadow_depth);
+		bool do_specular = specular_depth < 0 || depth <= specular_depth;
 		
-		// for each light l, shoot shadow ray from intersection point i to l
-		int total_lights = scene->getAllLights().size();
-		for (int l = 0; l < total_lights; l++)
+		// for each light l that can reach this point, shoot shadow ray from intersection point i to l
+		scene->forEachLight(inter_p, [&](const Light* light)
 		{
 			// get direction of light
-			glm::dvec3 light_vec = scene->getAllLights()[l].get()->getDirection(shadow_p);
-
-			// shoot shadow ray and check for intersection w/ objects
-			ray shadow_r(shadow_p, light_vec, glm::dvec3(1, 1, 1), ray::SHADOW);
-			isect shadow_i;
-			bool hit = scene->intersect(shadow_r, shadow_i);
-			// make sure intersection object is between light and this object
-			if (hit)
-			{
-				glm::dvec3 light_dir = scene->getAllLights()[l].get()->getDirection(shadow_r.at(shadow_i));
-				hit = glm::dot(light_dir, light_vec) > 0.0;
-			}
+			glm::dvec3 light_vec = light->getDirection(shadow_p);
 
 			// get light color
-			glm::dvec3 light_color = scene->getAllLights()[l].get()->getColor();
+			glm::dvec3 light_color = light->getColor();
 
 			// shadow attenuation var
 			glm::dvec3 shadow_atten = glm::dvec3(1.0);
 
-			// calculate shadow attenuation 
-			shadow_atten = scene->getAllLights()[l].get()->shadowAttenuation(shadow_r, shadow_p, 4);
+			if (do_shadows)
+			{
+				// the light does its own occlusion query (and caching)
+				ray shadow_r(shadow_p, light_vec, weight, ray::SHADOW);
+
+				// calculate shadow attenuation 
+				shadow_atten = light->shadowAttenuation(shadow_r, shadow_p, 4);
+			}
+			else if (traceUI->shadowSw())
+			{
+				RayStats::count(RayStats::PRUNED_RAYS);
+			}
 
 			// calculate light distance attenuation
-			double dist_atten = scene->getAllLights()[l].get()->distanceAttenuation(inter_p);
+			double dist_atten = light->distanceAttenuation(inter_p);
 
 			// calculate diffuse term 
 			// I_d = kd * abs(dot(l, n)) * I_in
@@ -204,11 +364,14 @@ glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, doub
 
 			// calculate specular term
 			// I_s = ks * max(dot(v, r), 0)^alpha * I_in
-			glm::dvec3 light_in_vect = light_vec * -1.0;
-			glm::dvec3 light_refl_vec = glm::reflect(light_in_vect, norm_vec);
-			double res_s = glm::pow(glm::max(glm::dot(out_vec, light_refl_vec), 0.0), m.shininess(i));
-			I_specular += m.ks(i) * res_s * light_color * dist_atten * shadow_atten;
-		}
+			if (do_specular)
+			{
+				glm::dvec3 light_in_vect = light_vec * -1.0;
+				glm::dvec3 light_refl_vec = glm::reflect(light_in_vect, norm_vec);
+				double res_s = glm::pow(glm::max(glm::dot(out_vec, light_refl_vec), 0.0), m.shininess(i));
+				I_specular += m.ks(i) * res_s * light_color * dist_atten * shadow_atten;
+			}
+		});
 
 		// calculate light contribution
 		// I_phong = I_emissive + I_ambient + [I_diffuse + I_specular] * I_in
@@ -218,24 +381,47 @@ glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, doub
 		glm::dvec3 I_refl(0.0, 0.0, 0.0);
 		if (m.Refl() && r.type() != ray::REFRACTION)
 		{
-			ray refl_r(inter_p, refl_vec, glm::dvec3(1, 1, 1), ray::REFLECTION);
-			glm::dvec3 refl_color = traceRay(refl_r, thresh, depth + 1, t, 1.0);
-			// clamp the final result between 0 and 1
-			I_refl = m.kr(i) * refl_color;
+			// skip the bounce if kr leaves too little of it to see
+			glm::dvec3 refl_weight = weight * m.kr(i);
+			if (contributes(refl_weight, ray_cutoff))
+			{
+				ray refl_r(inter_p, refl_vec, refl_weight, ray::REFLECTION);
+				if (diffs)
+					refl_r.setDifferentials(reflectDifferentials(hit_diff, in_vec, norm_vec, dNdx, dNdy));
+				glm::dvec3 refl_color = traceRay(refl_r, refl_weight, depth + 1, t, 1.0);
+				// clamp the final result between 0 and 1
+				I_refl = m.kr(i) * refl_color;
+			}
+			else
+			{
+				RayStats::count(RayStats::PRUNED_RAYS);
+			}
 		}
 
 		// shoot refractive ray
 		glm::dvec3 I_refra(0.0, 0.0, 0.0);
 		if (m.Trans())
 		{
-			// send ray and determine color
-			glm::dvec3 refra_vec = glm::refract(in_vec, norm_vec, refra_index);
-			refra_vec = glm::normalize(refra_vec);
-			glm::dvec3 refra_p = inter_p + (refra_vec * EPSILON);
-			ray refra_r(refra_p, refra_vec, glm::dvec3(1, 1, 1), ray::RayType::REFRACTION);
-			glm::dvec3 refra_color = traceRay(refra_r, thresh, depth + 1, t, 1.0);
-			// clamp the final result between 0 and 1
-			I_refra = glm::clamp(glm::pow(m.kt(i), glm::dvec3(dist)) * refra_color, 0.0, 1.0);
+			glm::dvec3 refra_atten = glm::pow(m.kt(i), glm::dvec3(dist));
+			glm::dvec3 refra_weight = weight * refra_atten;
+			if (contributes(refra_weight, ray_cutoff))
+			{
+				// send ray and determine color
+				glm::dvec3 refra_vec = glm::refract(in_vec, norm_vec, refra_index);
+				refra_vec = glm::normalize(refra_vec);
+				glm::dvec3 refra_p = inter_p + (refra_vec * EPSILON);
+				ray refra_r(refra_p, refra_vec, refra_weight, ray::RayType::REFRACTION);
+				ray::Differentials refra_diff;
+				if (diffs && refractDifferentials(hit_diff, in_vec, norm_vec, refra_vec, refra_index, dNdx, dNdy, refra_diff))
+					refra_r.setDifferentials(refra_diff);
+				glm::dvec3 refra_color = traceRay(refra_r, refra_weight, depth + 1, t, 1.0);
+				// clamp the final result between 0 and 1
+				I_refra = glm::clamp(refra_atten * refra_color, 0.0, 1.0);
+			}
+			else
+			{
+				RayStats::count(RayStats::PRUNED_RAYS);
+			}
 		}
 		
 		// add total light contributiuon and reflected light
@@ -243,10 +429,13 @@ glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, doub
 	} 
 	else 
 	{
+		if (hitObj)
+			*hitObj = nullptr;
+
 		// use cube map
 		if (traceUI->cubeMap())
 		{
-			colorC = traceUI->getCubeMap()->getColor(r);
+			colorC = traceUI->getCubeMap()->getColor(r.getDirection());
 		}
 		else
 		{
@@ -260,7 +449,10 @@ glm::dvec3 RayTracer::traceRay(ray& r, const glm::dvec3& thresh, int depth, doub
 }
 
 RayTracer::RayTracer()
-	: scene(nullptr), buffer(0), thresh(0), buffer_width(0), buffer_height(0), m_bBufferReady(false)
+	: stopTrace(false), buffer(0), buffer_width(0), buffer_height(0), thresh(0), ray_cutoff(0), use_differentials(false),
+	  scene(nullptr), m_bBufferReady(false),
+	  thread_func(4), tile_size(0), tiles_x(0), tiles_y(0), total_tiles(0), next_tile(0),
+	  progressive(false), num_stages(1), next_aa_pixel(0)
 {
 }
 
@@ -280,58 +472,132 @@ double RayTracer::aspectRatio()
 	return sceneLoaded() ? scene->getCamera().getAspectRatio() : 1;
 }
 
-bool RayTracer::loadScene(const char* fn)
+// parse a scene, or map a compiled one, and wait for the textures and
+// meshes it loads in the background; alerts and returns 0 on errors
+Scene* RayTracer::readScene(const char* fn)
 {
-	ifstream ifs(fn);
-	if( !ifs ) {
-		string msg( "Error: couldn't read scene file " );
-		msg.append( fn );
-		traceUI->alert( msg );
-		return false;
-	}
-
-	// Strip off filename, leaving only the path:
-	string path( fn );
-	if (path.find_last_of( "\\/" ) == string::npos)
-		path = ".";
-	else
-		path = path.substr(0, path.find_last_of( "\\/" ));
-
-	// Call this with 'true' for debug output from the tokenizer
-	Tokenizer tokenizer( ifs, false );
-	Parser parser( tokenizer, path );
+	auto start = std::chrono::steady_clock::now();
+	std::unique_ptr<Scene> loaded;
 	try {
-		scene.reset(parser.parseScene());
+		if (SceneFile::isCompiled(fn)) {
+			loaded.reset(SceneFile::load(fn));
+		} else {
+			// the tokenizer scans the mapped file in place
+			MappedFile file;
+			if( !file.open(fn) ) {
+				string msg( "Error: couldn't read scene file " );
+				msg.append( fn );
+				traceUI->alert( msg );
+				return 0;
+			}
+
+			// Strip off filename, leaving only the path:
+			string path( fn );
+			if (path.find_last_of( "\\/" ) == string::npos)
+				path = ".";
+			else
+				path = path.substr(0, path.find_last_of( "\\/" ));
+
+			// Call this with 'true' for debug output from the tokenizer
+			Tokenizer tokenizer( file.data(), file.data() + file.size(), false );
+			Parser parser( tokenizer, path );
+			loaded.reset(parser.parseScene());
+		}
+		double read_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		loaded->finishLoading();
+		const Scene::LoadStats& stats = loaded->loadStats();
+		std::cout << "read scene in " << read_ms << " ms, in the background: "
+		          << stats.textures << " textures in " << stats.texture_ms << " ms, "
+		          << stats.meshes << " meshes in " << stats.mesh_ms << " ms, waited "
+		          << stats.wait_ms << " ms for them" << std::endl;
+		const MaterialTable& mats = loaded->materials();
+		std::cout << "materials: " << mats.size() << " distinct of " << mats.interned()
+		          << " assigned";
+		if (mats.size())
+			std::cout << " (" << (double)mats.interned() / mats.size() << "x shared)";
+		std::cout << std::endl;
+		return loaded.release();
 	}
 	catch( SyntaxErrorException& pe ) {
 		traceUI->alert( pe.formattedMessage() );
-		return false;
 	} catch( ParserException& pe ) {
 		string msg( "Parser: fatal exception " );
 		msg.append( pe.message() );
 		traceUI->alert( msg );
-		return false;
 	} catch( TextureMapException e ) {
 		string msg( "Texture mapping exception: " );
 		msg.append( e.message() );
 		traceUI->alert( msg );
-		return false;
 	}
+	return 0;
+}
 
+bool RayTracer::loadScene(const char* fn)
+{
+	load_times = LoadTimes();
+	auto start = std::chrono::steady_clock::now();
+	scene.reset(readScene(fn));
 	if (!sceneLoaded())
 		return false;
+	load_times.read_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
 	// generate new BVH
+	start = std::chrono::steady_clock::now();
 	scene->generate_BVH();
+	load_times.bvh_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "built BVH in " << load_times.bvh_ms << " ms" << std::endl;
 
 	return true;
 }
 
+// read a scene and write it out as a compiled scene (see sceneFile.h)
+bool RayTracer::compileScene(const char* in, const char* out)
+{
+	std::unique_ptr<Scene> parsed(readScene(in));
+	if (!parsed)
+		return false;
+	try {
+		SceneFile::save(*parsed, out);
+	}
+	catch( ParserException& pe ) {
+		string msg( "Error: " );
+		msg.append( pe.message() );
+		traceUI->alert( msg );
+		return false;
+	}
+	return true;
+}
+
+std::unique_ptr<Scene> RayTracer::releaseScene()
+{
+	return std::move(scene);
+}
+
+void RayTracer::setScene(std::unique_ptr<Scene> s)
+{
+	scene = std::move(s);
+}
+
+void RayTracer::setupThreads()
+{
+	// the pool only gets rebuilt when the thread count changes
+	num_threads = std::max(traceUI->getThreads(), 1);
+	if (pool.size() != num_threads)
+		pool.resize(num_threads);
+	if (scene)
+		for (const auto& light : scene->getAllLights())
+			light->setThreads(num_threads);
+}
+
 void RayTracer::traceSetup(int w, int h)
 {
+	// a cancel only ever applies to the render it was made in
+	stopTrace = false;
+
 	// setup AA buffer
 	computeAA = traceUI->aaSwitch();
-	samples = traceUI->getSuperSamples();
+	samples = std::max(traceUI->getSuperSamples(), 1);
 	
 	size_t newBufferSize = w * h * 3;
 	if (newBufferSize != buffer.size()) {
@@ -341,18 +607,444 @@ void RayTracer::traceSetup(int w, int h)
 	buffer_width = w;
 	buffer_height = h;
 	std::fill(buffer.begin(), buffer.end(), 0);
+	hit_objects.assign(w * h, nullptr);
 	m_bBufferReady = true;
 
-	// set none of the render vectors to be done
-	thread_done.clear();
-	num_threads = traceUI->getThreads();
-	block_size = traceUI->getBlockSize();
+	setupThreads();
+	block_size = std::max(traceUI->getBlockSize(), 1);
 	thresh = traceUI->getThreshold();
+	ray_cutoff = traceUI->getRayCutoff();
 	aaThresh = traceUI->getAaThreshold();
+	thread_func = traceUI->getThreadFunc();
+	progressive = traceUI->progressiveSw();
+	use_differentials = scene && sceneTextured(*scene);
+	setupTiles();
+
+	// only rebuilt when the cutoff changes
+	if (scene)
+		scene->build_light_BVH(traceUI->getLightCutoff());
+}
+
+/*
+ * RayTracer::traceRegion
+ *
+ *	Trace the pixels [x0, x0+w) x [y0, y0+h) of an img_w x img_h image into
+ *	out (w*h*3 bytes, rows bottom-up like the frame buffer) and what each
+ *	pixel hit into hits (w*h, if given) on the pool, without touching the
+ *	frame buffer.  Used by distributed render workers, which only ever see
+ *	a tile at a time.
+ *
+ */
+void RayTracer::traceRegion(int img_w, int img_h, int x0, int y0, int w, int h, unsigned char* out,
+                            const SceneObject** hits)
+{
+	buffer_width = img_w;
+	buffer_height = img_h;
+	thresh = traceUI->getThreshold();
+	ray_cutoff = traceUI->getRayCutoff();
+	use_differentials = scene && sceneTextured(*scene);
+	stopTrace = false;
+
+	setupThreads();
+	// only rebuilt when the cutoff changes, so once per worker
+	if (scene)
+		scene->build_light_BVH(traceUI->getLightCutoff());
+	traceRows(x0, y0, w, h, out, hits);
+}
+
+void RayTracer::storeRegion(int x0, int y0, int w, int h, const unsigned char* pixels, const SceneObject* const* hits)
+{
+	for (int r = 0; r < h; r++)
+	{
+		memcpy(&buffer[(x0 + (y0 + r) * buffer_width) * 3], pixels + r * w * 3, w * 3);
+		if (hits && !hit_objects.empty())
+			std::copy(hits + r * w, hits + (r + 1) * w, &hit_objects[x0 + (y0 + r) * buffer_width]);
+	}
+}
+
+// trace pixels [x0, x0+w) x [y0, y0+h) of the current image size into out
+// (and what each one hit into hits, if given) on the pool
+void RayTracer::traceRows(int x0, int y0, int w, int h, unsigned char* out, const SceneObject** hits)
+{
+	// rows are handed out one at a time
+	std::atomic<int> next_row(0);
+	jobs.clear();
+	for (int t_id = 0; t_id < num_threads; t_id++)
+	{
+		jobs.push_back(pool.submit([this, t_id, &next_row, x0, y0, w, h, out, hits]
+		{
+			ray_thread_id = t_id;
+			for (int r = next_row.fetch_add(1); r < h && !stopTrace; r = next_row.fetch_add(1))
+			{
+				for (int x = 0; x < w; x++)
+				{
+					const SceneObject* obj = nullptr;
+					glm::dvec3 col(0.0, 0.0, 0.0);
+					if (sceneLoaded())
+						col = trace(double(x0 + x) / double(buffer_width), double(y0 + r) / double(buffer_height), &obj);
+					unsigned char* pixel = out + (x + r * w) * 3;
+					pixel[0] = (int)(255.0 * col[0]);
+					pixel[1] = (int)(255.0 * col[1]);
+					pixel[2] = (int)(255.0 * col[2]);
+					if (hits)
+						hits[x + r * w] = obj;
+				}
+			}
+		}));
+	}
+	waitRender();
+}
+
+int RayTracer::traceStrips(int w, int h, int band_rows,
+                           const std::function<void(const unsigned char* rows, int y0, int count)>& sink)
+{
+	// everything traceSetup does except allocating the frame buffer
+	computeAA = traceUI->aaSwitch();
+	samples = std::max(traceUI->getSuperSamples(), 1);
+	aaThresh = traceUI->getAaThreshold();
+	buffer.clear();
+	buffer.shrink_to_fit();
+	hit_objects.clear();
+	hit_objects.shrink_to_fit();
+	m_bBufferReady = false;
+	buffer_width = w;
+	buffer_height = h;
+	stopTrace = false;
+	thresh = traceUI->getThreshold();
+	ray_cutoff = traceUI->getRayCutoff();
+	use_differentials = scene && sceneTextured(*scene);
+	setupThreads();
+	if (scene)
+		scene->build_light_BVH(traceUI->getLightCutoff());
+
+	band_rows = std::max(band_rows, 1);
+	const int row_bytes = w * 3;
+
+	// First pass colors and hit objects of the band plus one row above and
+	// below it, which is all the AA pass looks at.  The two lowest rows are
+	// the top of the next band's window, so they are kept instead of traced
+	// again.
+	std::vector<unsigned char> window((band_rows + 2) * row_bytes);
+	std::vector<const SceneObject*> window_hits((band_rows + 2) * w);
+	std::vector<unsigned char> band(band_rows * row_bytes);
+	int kept_lo = -1, kept_rows = 0;	// rows carried over from the last band
+
+	int aa_count = 0;
+	for (int hi = h; hi > 0 && !stopTrace; hi -= band_rows)
+	{
+		int lo = std::max(hi - band_rows, 0);
+		int win_lo = std::max(lo - 1, 0);
+		int win_hi = std::min(hi + 1, h);
+
+		// move the carried rows to the top of the window, trace the rest
+		int fresh_hi = win_hi;
+		if (kept_rows > 0)
+		{
+			memmove(&window[(kept_lo - win_lo) * row_bytes], &window[0], kept_rows * row_bytes);
+			memmove(&window_hits[(kept_lo - win_lo) * w], &window_hits[0], kept_rows * w * sizeof(const SceneObject*));
+			fresh_hi = kept_lo;
+		}
+		traceRows(0, win_lo, w, fresh_hi - win_lo, &window[0], &window_hits[0]);
+
+		memcpy(&band[0], &window[(lo - win_lo) * row_bytes], (hi - lo) * row_bytes);
+		if (computeAA)
+		{
+			// pick edge pixels from first pass colors, exactly like aaImage
+			aa_pixels.clear();
+			for (int j = lo; j < hi; j++)
+			{
+				for (int i = 0; i < w; i++)
+				{
+					if (isEdge(&window[0], &window_hits[0], w, win_hi - win_lo, i, j - win_lo, aaThresh))
+						aa_pixels.push_back(i + (j - lo) * w);
+				}
+			}
+			aa_count += (int)aa_pixels.size();
+
+			std::atomic<int> next(0);
+			jobs.clear();
+			for (int t_id = 0; t_id < num_threads; t_id++)
+			{
+				jobs.push_back(pool.submit([this, t_id, &next, &band, lo, w]
+				{
+					ray_thread_id = t_id;
+					for (int k = next.fetch_add(1); k < (int)aa_pixels.size() && !stopTrace; k = next.fetch_add(1))
+					{
+						int p = aa_pixels[k];
+						glm::dvec3 col = supersamplePixel(p % w, lo + p / w);
+						unsigned char* pixel = &band[p * 3];
+						pixel[0] = (int)(255.0 * col[0]);
+						pixel[1] = (int)(255.0 * col[1]);
+						pixel[2] = (int)(255.0 * col[2]);
+					}
+				}));
+			}
+			waitRender();
+			aa_pixels.clear();
+		}
+		if (stopTrace)
+			break;
+		sink(&band[0], lo, hi - lo);
+
+		kept_lo = win_lo;
+		kept_rows = std::min(2, lo - win_lo + 1);
+		if (lo == 0)
+			kept_rows = 0;
+	}
+	return aa_count;
+}
+
+// Tiles are a whole number of blocks (see m_nBlockSize) and at least
+// MIN_TILE_SIZE pixels wide, so that a tile is enough work to hide the
+// cost of grabbing it and its rows are long enough to keep threads from
+// writing to the same cache lines of the frame buffer.
+#define MIN_TILE_SIZE 16
+
+void RayTracer::setupTiles()
+{
+	int size = std::max(block_size, 1);
+	while (size < MIN_TILE_SIZE)
+		size *= 2;
+
+	if (size != tile_size)
+	{
+		tile_size = size;
+
+		// visit the pixels of a tile in morton (z-curve) order so that
+		// consecutive primary rays stay close together in the scene
+		int side = 1;
+		while (side < tile_size)
+			side *= 2;
+		tile_order.clear();
+		for (int m = 0; m < side * side; m++)
+		{
+			int x = 0, y = 0;
+			for (int bit = 0; (1 << (2 * bit)) < side * side; bit++)
+			{
+				x |= ((m >> (2 * bit)) & 1) << bit;
+				y |= ((m >> (2 * bit + 1)) & 1) << bit;
+			}
+			if (x < tile_size && y < tile_size)
+				tile_order.emplace_back(x, y);
+		}
+	}
+
+	tiles_x = (buffer_width + tile_size - 1) / tile_size;
+	tiles_y = (buffer_height + tile_size - 1) / tile_size;
+	total_tiles = tiles_x * tiles_y;
+	next_tile = 0;
+}
+
+// Trace every pixel of a tile into the thread's own tile buffer, then copy
+// the finished rows into the frame buffer in one go.
+void RayTracer::traceTile(int tile, TileBuffer& tb)
+{
+	tb.x0 = (tile % tiles_x) * tile_size;
+	tb.y0 = (tile / tiles_x) * tile_size;
+	int tw = std::min(tile_size, buffer_width - tb.x0);
+	int th = std::min(tile_size, buffer_height - tb.y0);
+
+	if (thresh > 0.0)
+	{
+		// interpolate each block of the tile from its corners where possible
+		std::fill(tb.traced.begin(), tb.traced.end(), 0);
+		for (int by = 0; by < th; by += block_size)
+		{
+			for (int bx = 0; bx < tw; bx += block_size)
+			{
+				traceBlock(tb, bx, by, std::min(block_size, tw - bx), std::min(block_size, th - by));
+			}
+		}
+		for (int y = 0; y < th; y++)
+		{
+			for (int x = 0; x < tw; x++)
+			{
+				const glm::dvec3& col = tb.colors[x + y * tile_size];
+				unsigned char* pixel = tb.pixels.data() + (x + y * tile_size) * 3;
+				pixel[0] = (int)(255.0 * col[0]);
+				pixel[1] = (int)(255.0 * col[1]);
+				pixel[2] = (int)(255.0 * col[2]);
+			}
+		}
+	}
+	else
+	{
+		for (const auto& p : tile_order)
+		{
+			if (p.first >= tw || p.second >= th)
+				continue;
+			glm::dvec3 col = computePixel(tb.x0 + p.first, tb.y0 + p.second);
+			unsigned char* pixel = tb.pixels.data() + (p.first + p.second * tile_size) * 3;
+			pixel[0] = (int)(255.0 * col[0]);
+			pixel[1] = (int)(255.0 * col[1]);
+			pixel[2] = (int)(255.0 * col[2]);
+		}
+	}
+
+	for (int y = 0; y < th; y++)
+	{
+		memcpy(buffer.data() + (tb.x0 + (tb.y0 + y) * buffer_width) * 3,
+		       tb.pixels.data() + y * tile_size * 3, tw * 3);
+	}
+}
+
+// color of pixel (x,y) of the current tile, traced at most once
+glm::dvec3 RayTracer::sampleTile(TileBuffer& tb, int x, int y)
+{
+	int p = x + y * tile_size;
+	if (!tb.traced[p])
+	{
+		tb.colors[p] = computePixel(tb.x0 + x, tb.y0 + y);
+		tb.traced[p] = 1;
+	}
+	return tb.colors[p];
+}
+
+/*
+ * RayTracer::traceBlock
+ *
+ *	Trace the four corners of a block (tile coordinates).  If they hit the
+ *	same object and no color channel differs by more than the threshold,
+ *	fill the inside with a bilinear blend of the corners.  Otherwise split
+ *	the block into quarters and try again, down to single pixels.
+ *
+ */
+void RayTracer::traceBlock(TileBuffer& tb, int bx, int by, int bw, int bh)
+{
+	// small enough that every pixel is a corner
+	if (bw <= 2 && bh <= 2)
+	{
+		for (int y = by; y < by + bh; y++)
+			for (int x = bx; x < bx + bw; x++)
+				sampleTile(tb, x, y);
+		return;
+	}
+
+	int x1 = bx + bw - 1;
+	int y1 = by + bh - 1;
+	glm::dvec3 c00 = sampleTile(tb, bx, by);
+	glm::dvec3 c10 = sampleTile(tb, x1, by);
+	glm::dvec3 c01 = sampleTile(tb, bx, y1);
+	glm::dvec3 c11 = sampleTile(tb, x1, y1);
+
+	const SceneObject* obj = hit_objects[(tb.x0 + bx) + (tb.y0 + by) * buffer_width];
+	bool agree = obj == hit_objects[(tb.x0 + x1) + (tb.y0 + by) * buffer_width]
+	          && obj == hit_objects[(tb.x0 + bx) + (tb.y0 + y1) * buffer_width]
+	          && obj == hit_objects[(tb.x0 + x1) + (tb.y0 + y1) * buffer_width];
+	if (agree)
+	{
+		glm::dvec3 lo = glm::min(glm::min(c00, c10), glm::min(c01, c11));
+		glm::dvec3 hi = glm::max(glm::max(c00, c10), glm::max(c01, c11));
+		glm::dvec3 range = hi - lo;
+		agree = range[0] <= thresh && range[1] <= thresh && range[2] <= thresh;
+	}
+
+	if (agree)
+	{
+		for (int y = by; y <= y1; y++)
+		{
+			double v = (bh > 1) ? double(y - by) / double(bh - 1) : 0.0;
+			for (int x = bx; x <= x1; x++)
+			{
+				int p = x + y * tile_size;
+				if (tb.traced[p])
+					continue;
+				double u = (bw > 1) ? double(x - bx) / double(bw - 1) : 0.0;
+				tb.colors[p] = (c00 * (1.0 - u) + c10 * u) * (1.0 - v) + (c01 * (1.0 - u) + c11 * u) * v;
+				tb.traced[p] = 1;
+				// interpolated pixels count as seeing the same object (for aaImage)
+				hit_objects[(tb.x0 + x) + (tb.y0 + y) * buffer_width] = obj;
+			}
+		}
+		return;
+	}
+
+	// split in halves along each side longer than 2 pixels
+	int hw = (bw > 2) ? bw / 2 : bw;
+	int hh = (bh > 2) ? bh / 2 : bh;
+	traceBlock(tb, bx, by, hw, hh);
+	if (bw > hw)
+		traceBlock(tb, bx + hw, by, bw - hw, hh);
+	if (bh > hh)
+		traceBlock(tb, bx, by + hh, hw, bh - hh);
+	if (bw > hw && bh > hh)
+		traceBlock(tb, bx + hw, by + hh, bw - hw, bh - hh);
+}
+
+// Coarsest progressive pass traces one pixel in every PROGRESSIVE_STEP^2,
+// each following pass halves the step until every pixel is traced.
+#define PROGRESSIVE_STEP 4
+
+void RayTracer::resetStages(int units, int stages)
+{
+	num_stages = stages;
+	if ((int)stage_done.size() != units)
+		stage_done = std::vector<std::atomic<int>>(units);
+	for (auto& done : stage_done)
+		done.store(0);
+}
+
+// wait for whoever holds work unit `unit` to finish the passes before `stage`,
+// returns false if the render was stopped in the meantime
+bool RayTracer::waitForStage(int unit, int stage)
+{
+	while (stage_done[unit].load(std::memory_order_acquire) < stage)
+	{
+		if (stopTrace)
+			return false;
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+/*
+ * RayTracer::traceTileStage
+ *
+ *	One progressive pass over a tile.  Traces the pixels on the grid of
+ *	the given step (relative to the tile corner) that the coarser passes
+ *	skipped, and fills the step x step square below each one with its
+ *	color so the window always shows a full frame.  The traced pixel
+ *	itself gets its exact color, so the last pass (step 1) leaves the
+ *	same image as a normal render.
+ *
+ */
+void RayTracer::traceTileStage(int tile, int step)
+{
+	int x0 = (tile % tiles_x) * tile_size;
+	int y0 = (tile / tiles_x) * tile_size;
+	int tw = std::min(tile_size, buffer_width - x0);
+	int th = std::min(tile_size, buffer_height - y0);
+
+	for (int y = 0; y < th; y += step)
+	{
+		for (int x = 0; x < tw; x += step)
+		{
+			// already traced by a coarser pass
+			if (step < PROGRESSIVE_STEP && x % (2 * step) == 0 && y % (2 * step) == 0)
+				continue;
+
+			glm::dvec3 col = computePixel(x0 + x, y0 + y);
+			int fw = std::min(step, tw - x);
+			int fh = std::min(step, th - y);
+			for (int fy = 0; fy < fh; fy++)
+			{
+				for (int fx = 0; fx < fw; fx++)
+				{
+					unsigned char* pixel = buffer.data() + ((x0 + x + fx) + (y0 + y + fy) * buffer_width) * 3;
+					pixel[0] = (int)(255.0 * col[0]);
+					pixel[1] = (int)(255.0 * col[1]);
+					pixel[2] = (int)(255.0 * col[2]);
+				}
+			}
+		}
+	}
 }
 
 void RayTracer::thread_function_1(int thread_id, int row_len)
 {
+	// rays traced by this job are counted under its id
+	ray_thread_id = thread_id;
+
 	// new thread function
 	int pixel_val = 0;
 	int last_pixel = (buffer_width) * (buffer_height);
@@ -363,40 +1055,36 @@ void RayTracer::thread_function_1(int thread_id, int row_len)
 		int x = pixel_val % row_len;
 		int y = (int)(pixel_val / row_len);
 		// break if y is out of bounds
-		if (y >= buffer_height)
+		if (y >= buffer_height || stopTrace)
 			break;
 		//std::cout << "thread id: " << thread_id << ", pixel_value=" << pixel_val << ", x=" << x << " y=" << y << std::endl;
 		tracePixel(x, y);
 		i++;
 	}
-
-	// signal that this thread is done (must be in mutex)
-	mtx.lock();
-	thread_done.push_back(thread_id);
-	mtx.unlock();
 }
 
 void RayTracer::thread_function_2(int thread_id, int start_row, int end_row, int row_len)
 {
+	// rays traced by this job are counted under its id
+	ray_thread_id = thread_id;
+
 	// trace each pixel from start to end row
-	for (int y = start_row; y < end_row; y++)
+	for (int y = start_row; y < end_row && !stopTrace; y++)
 	{
 		for (int x = 0; x < row_len; x++)
 		{
 			tracePixel(x, y);
 		}
 	}
-
-	// signal that this thread is done (must be in mutex)
-	mtx.lock();
-	thread_done.push_back(thread_id);
-	mtx.unlock();
 }
 
 void RayTracer::thread_function_3(int thread_id, int row_len)
 {
+	// rays traced by this job are counted under its id
+	ray_thread_id = thread_id;
+
 	bool b = false;
-	while (!b)
+	while (!b && !stopTrace)
 	{
 		mtx.lock();
 		int pixel_val = get_next_pixel();
@@ -411,11 +1099,45 @@ void RayTracer::thread_function_3(int thread_id, int row_len)
 		//std::cout << "thread id: " << thread_id << ", pixel_value=" << pixel_val << ", x=" << x << " y=" << y << std::endl;
 		tracePixel(x, y);
 	}
+}
+
+void RayTracer::thread_function_4(int thread_id)
+{
+	// rays traced by this job are counted under its id
+	ray_thread_id = thread_id;
+
+	// grab the next tile until there are none left
+	TileBuffer tb;
+	tb.pixels.resize(tile_size * tile_size * 3);
+	if (thresh > 0.0)
+	{
+		tb.colors.resize(tile_size * tile_size);
+		tb.traced.resize(tile_size * tile_size);
+	}
+	for (;;)
+	{
+		int work = next_tile.fetch_add(1);
+		if (work >= total_tiles * num_stages || stopTrace)
+			break;
 
-	// signal that this thread is done (must be in mutex)
-	mtx.lock();
-	thread_done.push_back(thread_id);
-	mtx.unlock();
+		// all tiles of a stage are handed out before any of the next one
+		int stage = work / total_tiles;
+		int tile = work % total_tiles;
+		if (num_stages == 1)
+		{
+			traceTile(tile, tb);
+			continue;
+		}
+
+		if (!waitForStage(tile, stage))
+			break;
+		int step = PROGRESSIVE_STEP >> stage;
+		if (step == 1 && thresh > 0.0)
+			traceTile(tile, tb);
+		else
+			traceTileStage(tile, step);
+		stage_done[tile].store(stage + 1, std::memory_order_release);
+	}
 }
 
 int RayTracer::get_next_pixel()
@@ -439,19 +1161,20 @@ int RayTracer::get_next_pixel()
  */
 void RayTracer::traceImage(int w, int h)
 {
-	int thread_func = 3;
-
 	// Always call traceSetup before rendering anything.
 	traceSetup(w,h);
 
-	// start x threads to shoot raycast(s) at each pixel
+	// forget the jobs of the last render (they are all finished)
+	jobs.clear();
+
+	// hand one job per pool worker to shoot raycast(s) at each pixel
 	// thread function 1 -> pixels for each thread are calculated using div and mod
 	// each thread gets the same amount of pixels
 	if (thread_func == 1)
 	{
 		for (int t_id = 0; t_id < num_threads; t_id++)
 		{
-			threads.push_back(std::thread(&RayTracer::thread_function_1, this, t_id, w));
+			jobs.push_back(pool.submit(std::bind(&RayTracer::thread_function_1, this, t_id, w)));
 		}
 	}
 	// thread function 2 -> each thread gets a section of rows to render
@@ -472,7 +1195,7 @@ void RayTracer::traceImage(int w, int h)
 			{
 				end_row += row_rem;
 			}
-			threads.push_back(std::thread(&RayTracer::thread_function_2, this, t_id, start_row, end_row, w));
+			jobs.push_back(pool.submit(std::bind(&RayTracer::thread_function_2, this, t_id, start_row, end_row, w)));
 		}
 	}
 	// thread function 3 -> each thread get the next pixel using a mutex
@@ -484,49 +1207,162 @@ void RayTracer::traceImage(int w, int h)
 		all_pixels_done = false;
 		for (int t_id = 0; t_id < num_threads; t_id++)
 		{
-			threads.push_back(std::thread(&RayTracer::thread_function_3, this, t_id, w));
+			jobs.push_back(pool.submit(std::bind(&RayTracer::thread_function_3, this, t_id, w)));
+		}
+	}
+	// thread function 4 -> threads grab whole tiles off an atomic counter
+	// and render them into their own tile buffer (default)
+	else
+	{
+		// 1/16, 1/4 and then all of the pixels when rendering progressively
+		int stages = 1;
+		if (progressive)
+			for (int step = PROGRESSIVE_STEP; step > 1; step /= 2)
+				stages++;
+		resetStages(total_tiles, stages);
+
+		for (int t_id = 0; t_id < num_threads; t_id++)
+		{
+			jobs.push_back(pool.submit(std::bind(&RayTracer::thread_function_4, this, t_id)));
 		}
 	}
 }
 
 
+// A pixel needs anti-aliasing if it sees a different object than one of its
+// neighbors, or if its color differs from one of them by more than aaThresh.
+bool RayTracer::isEdgePixel(int i, int j)
+{
+	return isEdge(buffer.data(), hit_objects.data(), buffer_width, buffer_height, i, j, aaThresh);
+}
+
+// number of pixels a worker grabs at once during the AA pass
+#define AA_CHUNK 32
+
+void RayTracer::thread_function_aa(int thread_id)
+{
+	// rays traced by this job are counted under its id
+	ray_thread_id = thread_id;
+
+	int total = (int)aa_pixels.size();
+	int chunks = (total + AA_CHUNK - 1) / AA_CHUNK;
+	for (;;)
+	{
+		int work = next_aa_pixel.fetch_add(1);
+		if (work >= chunks * num_stages || stopTrace)
+			break;
+		int round = work / chunks;
+		int chunk = work % chunks;
+		int first = chunk * AA_CHUNK;
+		int last = std::min(first + AA_CHUNK, total);
+
+		if (num_stages > 1 && !waitForStage(chunk, round))
+			break;
+		for (int k = first; k < last; k++)
+		{
+			int i = aa_pixels[k] % buffer_width;
+			int j = aa_pixels[k] / buffer_width;
+			glm::dvec3 col;
+			if (num_stages == 1)
+			{
+				col = supersamplePixel(i, j);
+			}
+			else
+			{
+				// progressive: add one more sample per round and show the average so far
+				int u = round / samples;
+				int v = round % samples;
+				double x = double((i * samples) + u) / double(buffer_width * samples);
+				double y = double((j * samples) + v) / double(buffer_height * samples);
+				aa_accum[k] += trace(x, y);
+				col = aa_accum[k] * (1.0 / (round + 1));
+			}
+			unsigned char* pixel = buffer.data() + aa_pixels[k] * 3;
+			pixel[0] = (int)(255.0 * col[0]);
+			pixel[1] = (int)(255.0 * col[1]);
+			pixel[2] = (int)(255.0 * col[2]);
+		}
+		if (num_stages > 1)
+			stage_done[chunk].store(round + 1, std::memory_order_release);
+	}
+}
+
+/*
+ * RayTracer::aaImage
+ *
+ *	Second pass after traceImage: find the pixels on object edges or
+ *	with a large color jump to a neighbor and supersample only those
+ *	on the worker pool.  Returns how many pixels get refined.
+ *
+ */
 int RayTracer::aaImage()
 {
-	// Implement Anti-aliasing was implemented within tracePixel() method!!!
-	return 0;
+	jobs.clear();
+	aa_pixels.clear();
+	if (!computeAA || !sceneLoaded())
+		return 0;
+
+	// pick pixels using the first pass colors before any of them change
+	for (int j = 0; j < buffer_height; j++)
+	{
+		for (int i = 0; i < buffer_width; i++)
+		{
+			if (isEdgePixel(i, j))
+				aa_pixels.push_back(i + j * buffer_width);
+		}
+	}
+
+	// progressive AA makes one round per sample over all the picked pixels
+	next_aa_pixel = 0;
+	resetStages((int)(aa_pixels.size() + AA_CHUNK - 1) / AA_CHUNK, progressive ? samples * samples : 1);
+	if (progressive)
+		aa_accum.assign(aa_pixels.size(), glm::dvec3(0.0, 0.0, 0.0));
+	for (int t_id = 0; t_id < num_threads; t_id++)
+	{
+		jobs.push_back(pool.submit(std::bind(&RayTracer::thread_function_aa, this, t_id)));
+	}
+	return (int)aa_pixels.size();
 }
 
 bool RayTracer::checkRender()
 {
-	// return true if all threads are complete
-	if (thread_done.size() >= num_threads)
-		return true;
-	// else return false by default
-	return false;
+	// return true if every job handed to the pool is complete
+	for (auto& job : jobs)
+	{
+		if (job.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return false;
+	}
+	return true;
 }
 
 void RayTracer::waitRender()
 {
-	//  join all worker threads
-	for (int i = 0; i < num_threads; i++)
+	// wait on the jobs, the pool threads themselves stay parked for the next render
+	for (auto& job : jobs)
 	{
-		threads[i].join();
+		job.wait();
 	}
 }
 
-
-glm::dvec3 RayTracer::getPixel(int i, int j)
+void RayTracer::cancelRender()
 {
-	unsigned char *pixel = buffer.data() + ( i + j * buffer_width ) * 3;
-	return glm::dvec3((double)pixel[0]/255.0, (double)pixel[1]/255.0, (double)pixel[2]/255.0);
+	// running jobs stop at their next tile, jobs that have not started yet
+	// never will (their futures become ready)
+	stopTrace = true;
+	pool.cancel();
 }
 
-void RayTracer::setPixel(int i, int j, glm::dvec3 color)
+/*
+ * RayTracer::restartRender
+ *
+ *	Stop whatever render is in flight and start a new one with the
+ *	current settings on the same pool workers.  Same as traceImage when
+ *	nothing is running.
+ *
+ */
+void RayTracer::restartRender(int w, int h)
 {
-	unsigned char *pixel = buffer.data() + ( i + j * buffer_width ) * 3;
-
-	pixel[0] = (int)( 255.0 * color[0]);
-	pixel[1] = (int)( 255.0 * color[1]);
-	pixel[2] = (int)( 255.0 * color[2]);
+	cancelRender();
+	waitRender();
+	traceImage(w, h);
 }
-
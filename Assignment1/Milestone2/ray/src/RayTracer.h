@@ -1,8 +1,6 @@
 #ifndef __RAYTRACER_H__
 #define __RAYTRACER_H__
 
-#define MAX_THREADS 32
-
 // The main ray tracer.
 
 #include <time.h>
@@ -12,8 +10,13 @@
 #include "scene/cubeMap.h"
 #include "scene/ray.h"
 #include <mutex>
+#include <atomic>
+#include <future>
+#include <functional>
+#include "ThreadPool.h"
 
 class Scene;
+class SceneObject;
 class Pixel {
 public:
 	Pixel(int i, int j, unsigned char* ptr) : ix(i), jy(j), value(ptr) {}
@@ -30,11 +33,10 @@ public:
 	~RayTracer();
 
 	glm::dvec3 tracePixel(int i, int j);
-	glm::dvec3 traceRay(ray& r, const glm::dvec3& thresh, int depth,
-	                    double& length, double prev_refrac_index);
+	glm::dvec3 traceRay(ray& r, const glm::dvec3& weight, int depth,
+	                    double& length, double prev_refrac_index,
+	                    const SceneObject** hitObj = nullptr);
 
-	glm::dvec3 getPixel(int i, int j);
-	void setPixel(int i, int j, glm::dvec3 color);
 	void getBuffer(unsigned char*& buf, int& w, int& h);
 	double aspectRatio();
 
@@ -42,51 +44,132 @@ public:
 	int aaImage();
 	bool checkRender();
 	void waitRender();
+	void cancelRender();
+	void restartRender(int w, int h);
 
 	void traceSetup(int w, int h);
-
+	void traceRegion(int img_w, int img_h, int x0, int y0, int w, int h, unsigned char* out,
+	                 const SceneObject** hits = nullptr);
+	// copy a region traced by traceRegion into the frame buffer, and what
+	// its pixels hit into the hit objects aaImage looks for edges in
+	void storeRegion(int x0, int y0, int w, int h, const unsigned char* pixels, const SceneObject* const* hits);
+
+	// Render a w x h image band_rows rows at a time, top band first,
+	// without a frame buffer.  Every finished band (anti-aliased if AA is
+	// on) is handed to sink as rows y0..y0+count-1, bottom row first like
+	// the frame buffer, and then forgotten, so memory only grows with the
+	// band.  Returns the number of anti-aliased pixels.
+	int traceStrips(int w, int h, int band_rows,
+	                const std::function<void(const unsigned char* rows, int y0, int count)>& sink);
+
+	// .rayb files are read as compiled scenes, anything else is parsed
 	bool loadScene(const char* fn);
+	// parse in and write it to out as a compiled scene
+	bool compileScene(const char* in, const char* out);
 	bool sceneLoaded() { return scene != 0; }
 
+	// how long the last loadScene took, in ms: reading the scene
+	// (including the background loads it waited for), and the BVH
+	struct LoadTimes {
+		double read_ms = 0.0;
+		double bvh_ms = 0.0;
+	};
+	const LoadTimes& loadTimes() const { return load_times; }
+
 	void setReady(bool ready) { m_bBufferReady = ready; }
 	bool isReady() const { return m_bBufferReady; }
 
 	const Scene& getScene() { return *scene; }
+	// for moving things around between renders (see Animation.h)
+	Scene* getMutableScene() { return scene.get(); }
+	// hand the loaded scene out / swap one back in (see RenderServer.h)
+	std::unique_ptr<Scene> releaseScene();
+	void setScene(std::unique_ptr<Scene> s);
 
-	bool stopTrace;
+	// checked by the workers between tiles (or rows/pixels for the legacy
+	// thread functions), setting it makes the current render end early
+	std::atomic<bool> stopTrace;
 
 	// function that each worker thread executes
 	void thread_function_1(int thread_id, int row_len);
 	void thread_function_2(int thread_id, int start_row, int end_row, int row_len);
 	void thread_function_3(int thread_id, int row_len);
+	void thread_function_4(int thread_id);
+	void thread_function_aa(int thread_id);
 
 	int get_next_pixel();
 
 private:
-	glm::dvec3 trace(double x, double y);
+	Scene* readScene(const char* fn);
+	glm::dvec3 trace(double x, double y, const SceneObject** hitObj = nullptr);
+	glm::dvec3 computePixel(int i, int j);
+	glm::dvec3 supersamplePixel(int i, int j);
+	bool isEdgePixel(int i, int j);
+	void traceRows(int x0, int y0, int w, int h, unsigned char* out, const SceneObject** hits);
+	// num_threads and the pool from the UI, and the lights' per-thread caches
+	void setupThreads();
+
+	// per-thread scratch space for one tile
+	struct TileBuffer {
+		int x0, y0;
+		std::vector<unsigned char> pixels;
+		std::vector<glm::dvec3> colors;	// used by block interpolation
+		std::vector<char> traced;
+	};
+
+	// tile scheduler helpers
+	void setupTiles();
+	void traceTile(int tile, TileBuffer& tb);
+	void traceTileStage(int tile, int step);
+	void resetStages(int units, int stages);
+	bool waitForStage(int unit, int stage);
+
+	// block interpolation helpers (threshold > 0)
+	glm::dvec3 sampleTile(TileBuffer& tb, int x, int y);
+	void traceBlock(TileBuffer& tb, int bx, int by, int bw, int bh);
 
 	std::vector<unsigned char> buffer;
 	int buffer_width, buffer_height;
 	int bufferSize;
 	int block_size;
 	double thresh;
+	double ray_cutoff;			// secondary rays weighing no more than this are skipped
+	bool use_differentials;		// scene has textures, camera rays carry differentials
 	std::unique_ptr<Scene> scene;
+	LoadTimes load_times;
 
 	bool m_bBufferReady;
 
 	// variables used for multi-threading
-	unsigned int num_threads;
-	std::vector<std::thread> threads;
-	std::vector<int> thread_done;
+	int num_threads;
+	ThreadPool pool;						// persistent workers, resized when m_threads changes
+	std::vector<std::future<void>> jobs;	// one per worker for the current render
 	std::mutex mtx;
 	int current_pixel = 0;
 	int total_pixels;
 	bool all_pixels_done = false;
 
+	// variables used by the tile scheduler (thread_function_4)
+	int thread_func;
+	int tile_size;
+	int tiles_x, tiles_y, total_tiles;
+	std::atomic<int> next_tile;
+	std::vector<std::pair<int, int>> tile_order; // morton order of pixels within a tile
+
+	// progressive rendering: every tile (or AA chunk) goes through num_stages
+	// passes in order, stage_done[k] counts the passes unit k has finished
+	bool progressive;
+	int num_stages;
+	std::vector<std::atomic<int>> stage_done;
+
 	// variables for AA
 	bool computeAA;
 	double aaThresh;
 	int samples;
+	std::vector<const SceneObject*> hit_objects;	// object seen through each pixel (first pass)
+	std::vector<int> aa_pixels;						// pixels picked for supersampling
+	std::atomic<int> next_aa_pixel;
+	std::vector<glm::dvec3> aa_accum;				// running sample sums (progressive AA)
 };
 
 #endif // __RAYTRACER_H__
@@ -0,0 +1,357 @@
+#include "RenderServer.h"
+
+#include <chrono>
+#include <iostream>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "RayTracer.h"
+#include "fileio/images.h"
+#include "scene/rayStats.h"
+#include "scene/scene.h"
+#include "ui/CommandLineUI.h"
+#include "ui/json.hpp"
+
+using Json = nlohmann::json;
+
+// parsed scenes kept in memory at once
+#define SCENE_CACHE_SIZE 4
+
+namespace {
+
+double msSince(std::chrono::steady_clock::time_point t)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+}
+
+glm::dvec3 readVec3(const Json& j)
+{
+	if (!j.is_array() || j.size() != 3)
+		throw std::runtime_error("expected [x, y, z], got " + j.dump());
+	return glm::dvec3(j[0].get<double>(), j[1].get<double>(), j[2].get<double>());
+}
+
+} // anonymous namespace
+
+SceneCache::SceneCache(size_t capacity)
+	: capacity(capacity)
+{
+}
+
+SceneCache::~SceneCache()
+{
+}
+
+void SceneCache::deactivate(RayTracer* rt)
+{
+	if (active)
+	{
+		active->scene = rt->releaseScene();
+		active = nullptr;
+	}
+}
+
+bool SceneCache::activate(RayTracer* rt, const std::string& path, bool& cached)
+{
+	cached = false;
+
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return false;
+
+	auto it = entries.begin();
+	while (it != entries.end() && it->path != path)
+		++it;
+
+	// the file changed since it was parsed
+	if (it != entries.end() && it->mtime != st.st_mtime)
+	{
+		if (&*it == active)
+		{
+			rt->releaseScene();
+			active = nullptr;
+		}
+		entries.erase(it);
+		it = entries.end();
+	}
+
+	if (it != entries.end())
+	{
+		if (&*it != active)
+		{
+			deactivate(rt);
+			rt->setScene(std::move(it->scene));
+			active = &*it;
+		}
+		entries.splice(entries.begin(), entries, it);
+		cached = true;
+		return true;
+	}
+
+	deactivate(rt);
+	if (!rt->loadScene(path.c_str()))
+		return false;
+
+	entries.push_front(Entry{ path, st.st_mtime, nullptr });
+	active = &entries.front();
+	while (entries.size() > capacity && entries.size() > 1)
+		entries.pop_back();
+	return true;
+}
+
+RenderServer::RenderServer(CommandLineUI* ui, RayTracer* rt)
+	: ui(ui), raytracer(rt), cache(SCENE_CACHE_SIZE), jobs(0)
+{
+	base.size = ui->m_nSize;
+	base.depth = ui->m_nDepth;
+	base.superSamples = ui->m_nSuperSamples;
+	base.aaThreshold = ui->m_nAaThreshold;
+	base.antiAlias = ui->m_antiAlias;
+}
+
+RenderServer::~RenderServer()
+{
+}
+
+std::string RenderServer::handle(const std::string& line, bool& quit)
+{
+	auto start = std::chrono::steady_clock::now();
+	Json reply;
+
+	Json job;
+	try
+	{
+		job = Json::parse(line);
+		if (!job.is_object())
+			throw std::runtime_error("a job must be a json object");
+	}
+	catch (std::exception& e)
+	{
+		reply["status"] = "error";
+		reply["error"] = std::string("bad job: ") + e.what();
+		return reply.dump();
+	}
+
+	if (job.count("id"))
+		reply["id"] = job["id"];
+	if (job.value("quit", false))
+	{
+		quit = true;
+		reply["status"] = "bye";
+		reply["jobs"] = jobs;
+		return reply.dump();
+	}
+
+	try
+	{
+		if (!job.count("scene") || !job.count("output"))
+			throw std::runtime_error("a job needs \"scene\" and \"output\"");
+		std::string scene_file = job["scene"].get<std::string>();
+		std::string output = job["output"].get<std::string>();
+
+		// every job starts from the server's own settings
+		ui->m_nSize = job.value("size", base.size);
+		ui->m_nDepth = job.value("recursion_depth", base.depth);
+		ui->m_nSuperSamples = job.value("supersamples", base.superSamples);
+		ui->m_nAaThreshold = job.value("aa_threshold", base.aaThreshold);
+		ui->m_antiAlias = job.value("anti_alias", base.antiAlias);
+
+		bool cached;
+		ui->lastAlert.clear();
+		if (!cache.activate(raytracer, scene_file, cached))
+		{
+			std::string msg = "couldn't load scene " + scene_file;
+			if (!ui->lastAlert.empty())
+				msg += ": " + ui->lastAlert;
+			throw std::runtime_error(msg);
+		}
+		double load_ms = msSince(start);
+
+		// camera overrides are undone after the job
+		Camera& camera = raytracer->getMutableScene()->getCamera();
+		Camera saved = camera;
+		if (job.count("camera"))
+		{
+			const Json& cam = job["camera"];
+			if (cam.count("eye"))
+				camera.setEye(readVec3(cam["eye"]));
+			if (cam.count("look_at") || cam.count("up"))
+			{
+				glm::dvec3 dir = cam.count("look_at") ? readVec3(cam["look_at"]) - camera.getEye() : camera.getLook();
+				glm::dvec3 up = cam.count("up") ? readVec3(cam["up"]) : camera.getV();
+				camera.aim(dir, up);
+			}
+			if (cam.count("fov"))
+				camera.setFOV(cam["fov"].get<double>());
+		}
+
+		int width = ui->m_nSize;
+		int height = job.value("height", (int)(width / raytracer->aspectRatio() + 0.5));
+		if (width <= 0 || height <= 0)
+		{
+			camera = saved;
+			throw std::runtime_error("bad image size");
+		}
+
+		auto render_start = std::chrono::steady_clock::now();
+		RayStats::reset();
+		raytracer->traceImage(width, height);
+		raytracer->waitRender();
+		if (ui->aaSwitch())
+		{
+			reply["aa_pixels"] = raytracer->aaImage();
+			raytracer->waitRender();
+		}
+		double render_ms = msSince(render_start);
+		camera = saved;
+
+		RayStats::Totals stats = RayStats::reset();
+		reply["rays"] = stats.rays();
+		if (stats[RayStats::PRUNED_RAYS] > 0)
+			reply["pruned"] = stats[RayStats::PRUNED_RAYS];
+		uint64_t cacheTests = stats[RayStats::SHADOW_CACHE_TESTS];
+		if (cacheTests > 0)
+			reply["shadow_cache_hit_rate"] = (double)stats[RayStats::SHADOW_CACHE_HITS] / cacheTests;
+
+		auto write_start = std::chrono::steady_clock::now();
+		unsigned char* buf;
+		raytracer->getBuffer(buf, width, height);
+		try
+		{
+			writeImage(output.c_str(), width, height, buf);
+		}
+		catch (std::string& msg)
+		{
+			throw std::runtime_error(msg);
+		}
+
+		reply["status"] = "ok";
+		reply["cached"] = cached;
+		reply["width"] = width;
+		reply["height"] = height;
+		reply["load_ms"] = load_ms;
+		reply["render_ms"] = render_ms;
+		reply["write_ms"] = msSince(write_start);
+	}
+	catch (std::exception& e)
+	{
+		reply["status"] = "error";
+		reply["error"] = e.what();
+	}
+
+	jobs++;
+	reply["total_ms"] = msSince(start);
+	return reply.dump();
+}
+
+int RenderServer::serveStream()
+{
+	// replies own stdout, everything else that prints goes to stderr
+	std::streambuf* stdout_buf = std::cout.rdbuf(std::cerr.rdbuf());
+	std::ostream out(stdout_buf);
+
+	std::string line;
+	bool quit = false;
+	while (!quit && std::getline(std::cin, line))
+	{
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+		out << handle(line, quit) << std::endl;
+	}
+	std::cout.rdbuf(stdout_buf);
+	return 0;
+}
+
+#ifndef _WIN32
+
+int RenderServer::serveSocket(const char* path)
+{
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		ui->alert(std::string("socket path too long: ") + path);
+		return 1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path);
+	if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0)
+	{
+		ui->alert(std::string("couldn't listen on ") + path + ": " + strerror(errno));
+		if (listen_fd >= 0)
+			close(listen_fd);
+		return 1;
+	}
+	// a client hanging up mid-reply shouldn't take the server down
+	signal(SIGPIPE, SIG_IGN);
+	std::cerr << "serving on " << path << std::endl;
+
+	// clients are served one at a time, each can send any number of jobs
+	bool quit = false;
+	while (!quit)
+	{
+		int fd = accept(listen_fd, nullptr, nullptr);
+		if (fd < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		std::string pending;
+		char chunk[4096];
+		while (!quit)
+		{
+			ssize_t got = read(fd, chunk, sizeof(chunk));
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got <= 0)
+				break;
+			pending.append(chunk, got);
+
+			size_t eol;
+			while (!quit && (eol = pending.find('\n')) != std::string::npos)
+			{
+				std::string line = pending.substr(0, eol);
+				pending.erase(0, eol + 1);
+				if (line.find_first_not_of(" \t\r") == std::string::npos)
+					continue;
+				std::string answer = handle(line, quit) + "\n";
+				if (write(fd, answer.data(), answer.size()) < 0)
+					break;
+			}
+		}
+		close(fd);
+	}
+
+	close(listen_fd);
+	unlink(path);
+	return 0;
+}
+
+#else // _WIN32
+
+int RenderServer::serveSocket(const char* path)
+{
+	ui->alert("unix sockets are not supported on windows, use --serve without a path");
+	return 1;
+}
+
+#endif
+
+int RenderServer::run(const char* addr)
+{
+	return addr ? serveSocket(addr) : serveStream();
+}
@@ -0,0 +1,94 @@
+#ifndef __RENDERSERVER_H__
+#define __RENDERSERVER_H__
+
+// Long running headless render server (ray --serve[=socket_path]).
+//
+// Jobs arrive one JSON object per line, on stdin or on a unix socket, and
+// every job gets exactly one JSON line back:
+//
+//   {"id": 7, "scene": "scenes/hitchcock.ray", "output": "out/7.png",
+//    "size": 400, "recursion_depth": 3, "anti_alias": true, "supersamples": 3,
+//    "aa_threshold": 100,
+//    "camera": {"eye": [0, 0, 5], "look_at": [0, 0, 0], "up": [0, 1, 0], "fov": 40}}
+//
+//   {"id": 7, "status": "ok", "cached": true, "width": 400, "height": 400,
+//    "load_ms": 0.01, "render_ms": 812.4, "write_ms": 9.7, "total_ms": 822.1}
+//
+// or {"id": 7, "status": "error", "error": "..."}.  Only "scene" and
+// "output" are required.  The other settings use the names from the -j
+// settings file and fall back to what the server was started with.
+// "height" can be given to ignore the camera's aspect ratio.  Camera
+// overrides only last for that job.  {"quit": true} stops the server.
+//
+// Parsed scenes (with their BVH) stay resident in a small LRU cache keyed
+// by path and modification time, so jobs for a scene that was used
+// recently and hasn't changed on disk skip loading entirely.
+
+#include <list>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+class CommandLineUI;
+class RayTracer;
+class Scene;
+
+// parsed scenes, most recently used first.  The scene of the last job is
+// kept inside the RayTracer; its entry has a null scene until another
+// scene takes its place.
+class SceneCache {
+public:
+	explicit SceneCache(size_t capacity);
+	~SceneCache();
+
+	// make path the ray tracer's current scene, loading it only if it is
+	// not cached or the file changed.  cached says whether loading was
+	// skipped.  Returns false if the scene can't be loaded.
+	bool activate(RayTracer* rt, const std::string& path, bool& cached);
+
+	size_t size() const { return entries.size(); }
+
+private:
+	struct Entry {
+		std::string path;
+		time_t mtime;
+		std::unique_ptr<Scene> scene;	// null while lent to the ray tracer
+	};
+
+	void deactivate(RayTracer* rt);
+
+	size_t capacity;
+	std::list<Entry> entries;
+	Entry* active = nullptr;
+};
+
+class RenderServer {
+public:
+	RenderServer(CommandLineUI* ui, RayTracer* rt);
+	~RenderServer();
+
+	// serve jobs from stdin (addr == nullptr) or a unix socket until told
+	// to quit or the input ends
+	int run(const char* addr);
+
+private:
+	// run one job line and return the reply line (without newline)
+	std::string handle(const std::string& line, bool& quit);
+
+	int serveStream();
+	int serveSocket(const char* path);
+
+	// settings the server was started with, jobs override them
+	struct Settings {
+		int size, depth, superSamples, aaThreshold;
+		bool antiAlias;
+	};
+
+	CommandLineUI* ui;
+	RayTracer* raytracer;
+	SceneCache cache;
+	Settings base;
+	int jobs;	// jobs handled so far
+};
+
+#endif // __RENDERSERVER_H__
@@ -3,6 +3,7 @@
 #include <algorithm>
 
 #include "Box.h"
+#include "../scene/rayStats.h"
 
 using namespace std;
 
@@ -10,6 +11,7 @@ const double HUGE_DOUBLE = 1e100;
 
 bool Box::intersectLocal(ray& r, isect& i) const
 {
+        RayStats::count(RayStats::BOX_TESTS);
         glm::dvec3 p = r.getPosition();
         glm::dvec3 d = r.getDirection();
 //        d.normalize();
@@ -1,11 +1,13 @@
 #include <cmath>
 
 #include "Cone.h"
+#include "../scene/rayStats.h"
 
 using namespace std;
 
 bool Cone::intersectLocal(ray& r, isect& i) const
 {
+	RayStats::count(RayStats::CONE_TESTS);
 	bool ret = false;
 	const int x = 0, y = 1, z = 2;	// For the dumb array indexes for the vectors
 
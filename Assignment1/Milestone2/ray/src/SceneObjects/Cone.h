@@ -6,6 +6,7 @@
 class Cone
 	: public MaterialSceneObject
 {
+	friend class SceneFile;
 public:
 	Cone( Scene *scene, Material *mat, 
 			double h = 1.0, double br = 1.0, double tr = 0.0, 
@@ -1,12 +1,14 @@
 #include <cmath>
 
 #include "Cylinder.h"
+#include "../scene/rayStats.h"
 
 using namespace std;
 
 
 bool Cylinder::intersectLocal(ray& r, isect& i) const
 {
+	RayStats::count(RayStats::CYLINDER_TESTS);
 	// FIXME: check these suspicious initialization.
 	i.setObject(this);
 	i.setMaterial(this->getMaterial());
@@ -6,6 +6,7 @@
 class Cylinder
 	: public MaterialSceneObject
 {
+	friend class SceneFile;
 public:
 	Cylinder( Scene *scene, Material *mat )
 		: MaterialSceneObject( scene, mat ), capped( true )
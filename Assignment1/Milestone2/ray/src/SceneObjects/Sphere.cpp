@@ -1,6 +1,7 @@
 #include <cmath>
 
 #include "Sphere.h"
+#include "../scene/rayStats.h"
 #include <iostream>
 #include <glm/gtx/io.hpp>
 
@@ -8,6 +9,7 @@ using namespace std;
 
 bool Sphere::intersectLocal(ray& r, isect& i) const
 {
+	RayStats::count(RayStats::SPHERE_TESTS);
 	r.setDirection(glm::normalize(r.getDirection()));
 	glm::dvec3 v = -r.getPosition();
 	double b = glm::dot(v, r.getDirection());
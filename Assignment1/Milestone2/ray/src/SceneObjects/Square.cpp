@@ -1,6 +1,7 @@
 #include <cmath>
 
 #include "Square.h"
+#include "../scene/rayStats.h"
 
 using namespace std;
 
@@ -8,6 +9,7 @@ using namespace std;
 //Test
 bool Square::intersectLocal(ray& r, isect& i) const
 {
+	RayStats::count(RayStats::SQUARE_TESTS);
 	glm::dvec3 p = r.getPosition();
 	glm::dvec3 d = r.getDirection();
 
@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <cmath>
 #include "../ui/TraceUI.h"
+#include "../scene/rayStats.h"
 #include <iostream>
 extern TraceUI* traceUI;
 
@@ -12,8 +13,6 @@ using namespace std;
 
 Trimesh::~Trimesh()
 {
-	for (auto m : materials)
-		delete m;
 	for (auto f : faces)
 		delete f;
 }
@@ -21,17 +20,56 @@ Trimesh::~Trimesh()
 // must add vertices, normals, and materials IN ORDER
 void Trimesh::addVertex(const glm::dvec3& v)
 {
-	vertices.emplace_back(v);
+	vertexStore.emplace_back(v);
+	vertices = MeshArray<glm::dvec3>(vertexStore);
 }
 
 void Trimesh::addMaterial(Material* m)
 {
-	materials.emplace_back(m);
+	std::unique_ptr<Material> owned(m);
+	materials.emplace_back(scene->materials().intern(*m));
+}
+
+void Trimesh::addMaterialId(uint32_t id)
+{
+	materials.emplace_back(id);
 }
 
 void Trimesh::addNormal(const glm::dvec3& n)
 {
-	normals.emplace_back(n);
+	normalStore.emplace_back(n);
+	normals = MeshArray<glm::dvec3>(normalStore);
+}
+
+// Replaces the vertex positions and normals in place.  Faces index into
+// these arrays, so they follow along; the caller refreshes the bounds.
+void Trimesh::setVertices(const Vertices& verts, const Normals& norms)
+{
+	assert(verts.size() == vertices.size() && norms.size() == normals.size());
+	vertexStore = verts;
+	normalStore = norms;
+	vertices = MeshArray<glm::dvec3>(vertexStore);
+	normals = MeshArray<glm::dvec3>(normalStore);
+	mapping.reset();
+}
+
+void Trimesh::setVertexData(Vertices&& verts, Normals&& norms)
+{
+	vertexStore = std::move(verts);
+	normalStore = std::move(norms);
+	vertices = MeshArray<glm::dvec3>(vertexStore);
+	normals = MeshArray<glm::dvec3>(normalStore);
+	mapping.reset();
+}
+
+void Trimesh::setVertexArrays(MeshArray<glm::dvec3> verts, MeshArray<glm::dvec3> norms,
+                              std::shared_ptr<const void> owner)
+{
+	vertexStore.clear();
+	normalStore.clear();
+	vertices = verts;
+	normals = norms;
+	mapping = owner;
 }
 
 // Returns false if the vertices a,b,c don't all exist
@@ -43,7 +81,7 @@ bool Trimesh::addFace(int a, int b, int c)
 		return false;
 
 	TrimeshFace* newFace = new TrimeshFace(
-	        scene, new Material(*this->material), this, a, b, c);
+	        scene, material_id, this, a, b, c);
 	newFace->setTransform(this->transform);
 	if (!newFace->degen)
 		faces.push_back(newFace);
@@ -94,6 +132,7 @@ bool TrimeshFace::intersect(ray& r, isect& i) const
 // intersection in u (alpha) and v (beta).
 bool TrimeshFace::intersectLocal(ray& r, isect& i) const
 {
+	RayStats::count(RayStats::TRIANGLE_TESTS);
 	// get imporntant points and vectors for calculations
 	glm::dvec3 a_coords = parent->vertices[ids[0]];
 	glm::dvec3 b_coords = parent->vertices[ids[1]];
@@ -144,6 +183,8 @@ bool TrimeshFace::intersectLocal(ray& r, isect& i) const
 		i.setUVCoordinates(bary);
 		i.setMaterial(this->getMaterial());
 		i.setMaterial(parent->getMaterial());
+		i.setObject(parent);
+		i.setPrimitive(this);
 		i.setN(n);
 		// using barycentric coordinates, 
 		// determine phong interpolation of normal of intersection (only for meshes w/ per-vertex normals)
@@ -162,9 +203,9 @@ bool TrimeshFace::intersectLocal(ray& r, isect& i) const
 		if (parent->materials.size() > 2)
 		{
 			// get per-vertex material
-			Material* a_mat = parent->materials[ids[1]];
-			Material* b_mat = parent->materials[ids[2]];
-			Material* c_mat = parent->materials[ids[0]];
+			const Material* a_mat = &parent->getVertexMaterial(ids[1]);
+			const Material* b_mat = &parent->getVertexMaterial(ids[2]);
+			const Material* c_mat = &parent->getVertexMaterial(ids[0]);
 			// compute interpolated material
 			Material inter_mat;
 			inter_mat.setEmissive((a_mat->ke(i) * bary_coord_a) + (b_mat->ke(i) * bary_coord_b) + (c_mat->ke(i) * bary_coord_c));
@@ -187,22 +228,23 @@ bool TrimeshFace::intersectLocal(ray& r, isect& i) const
 void Trimesh::generateNormals()
 {
 	int cnt = vertices.size();
-	normals.resize(cnt);
+	normalStore.resize(cnt);
 	std::vector<int> numFaces(cnt, 0);
 
 	for (auto face : faces) {
 		glm::dvec3 faceNormal = face->getNormal();
 
 		for (int i = 0; i < 3; ++i) {
-			normals[(*face)[i]] += faceNormal;
+			normalStore[(*face)[i]] += faceNormal;
 			++numFaces[(*face)[i]];
 		}
 	}
 
 	for (int i = 0; i < cnt; ++i) {
 		if (numFaces[i])
-			normals[i] /= numFaces[i];
+			normalStore[i] /= numFaces[i];
 	}
+	normals = MeshArray<glm::dvec3>(normalStore);
 
 	vertNorms = true;
 }
@@ -16,19 +16,46 @@
 
 class TrimeshFace;
 
+// A read-only array of vertex data.  It points either at a mesh's own
+// vector or straight into a mapped compiled scene (see sceneFile.h).
+template <typename T>
+class MeshArray {
+public:
+	MeshArray() : ptr(nullptr), count(0) {}
+	MeshArray(const T* p, size_t n) : ptr(p), count(n) {}
+	explicit MeshArray(const std::vector<T>& v) : ptr(v.data()), count(v.size()) {}
+
+	const T& operator[](size_t i) const { return ptr[i]; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T* begin() const { return ptr; }
+	const T* end() const { return ptr + count; }
+	const T* data() const { return ptr; }
+
+private:
+	const T* ptr;
+	size_t count;
+};
+
 class Trimesh : public MaterialSceneObject {
 	friend class TrimeshFace;
+	friend class SceneFile;
 	typedef std::vector<glm::dvec3> Normals;
 	typedef std::vector<glm::dvec3> Vertices;
 	typedef std::vector<TrimeshFace *> Faces;
-	typedef std::vector<Material *> Materials;
+	typedef std::vector<uint32_t> Materials;	// material table ids
 
-	Vertices vertices;
+	MeshArray<glm::dvec3> vertices;
 	Faces faces;
-	Normals normals;
+	MeshArray<glm::dvec3> normals;
 	Materials materials;
 	BoundingBox localBounds;
 
+	// storage behind vertices and normals, unless they are mapped
+	Vertices vertexStore;
+	Normals normalStore;
+	std::shared_ptr<const void> mapping;	// keeps the mapped file alive
+
 public:
 	Trimesh(Scene *scene, Material *mat, TransformNode *transform)
 	        : MaterialSceneObject(scene, mat),
@@ -47,7 +74,8 @@ public:
 
 	// must add vertices, normals, and materials IN ORDER
 	void addVertex(const glm::dvec3 &);
-	void addMaterial(Material *m);
+	void addMaterial(Material *m);	// interned like setMaterial
+	void addMaterialId(uint32_t id);
 	void addNormal(const glm::dvec3 &);
 	bool addFace(int a, int b, int c);
 
@@ -65,7 +93,7 @@ public:
 			return localbounds;
 		localbounds.setMax(vertices[0]);
 		localbounds.setMin(vertices[0]);
-		Vertices::const_iterator viter;
+		const glm::dvec3* viter;
 		for (viter = vertices.begin(); viter != vertices.end();
 		     ++viter) {
 			localbounds.setMax(
@@ -81,6 +109,20 @@ public:
 	// get faces
 	Faces get_faces() { return faces; }
 
+	// vertex data, used to move a mesh around without re-parsing it
+	Vertices getVertices() const { return Vertices(vertices.begin(), vertices.end()); }
+	Normals getNormals() const { return Normals(normals.begin(), normals.end()); }
+	void setVertices(const Vertices& verts, const Normals& norms);
+	// take over whole arrays, for meshes read from a file (see meshfile.h)
+	void setVertexData(Vertices&& verts, Normals&& norms);
+
+	// use vertex data that lives somewhere else (a mapped compiled scene)
+	// in place; owner is kept alive as long as the mesh
+	void setVertexArrays(MeshArray<glm::dvec3> verts, MeshArray<glm::dvec3> norms,
+	                     std::shared_ptr<const void> owner);
+	const Materials& getMaterials() const { return materials; }
+	const Material& getVertexMaterial(size_t v) const { return scene->materials()[materials[v]]; }
+
 protected:
 	void glDrawLocal(int quality, bool actualMaterials,
 	                 bool actualTextures) const;
@@ -102,9 +144,9 @@ class TrimeshFace : public MaterialSceneObject {
 	double dist;
 
 public:
-	TrimeshFace(Scene *scene, Material *mat, Trimesh *parent, int a, int b,
-	            int c)
-	        : MaterialSceneObject(scene, mat)
+	TrimeshFace(Scene *scene, uint32_t material, Trimesh *parent, int a,
+	            int b, int c)
+	        : MaterialSceneObject(scene, material)
 	{
 		this->parent = parent;
 		ids[0]       = a;
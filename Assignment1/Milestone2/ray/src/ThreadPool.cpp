@@ -0,0 +1,107 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int n)
+	: active(0), generation(0)
+{
+	resize(n);
+}
+
+ThreadPool::~ThreadPool()
+{
+	cancel();
+	stop_workers();
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> job)
+{
+	std::packaged_task<void()> task(std::move(job));
+	std::future<void> result = task.get_future();
+
+	// no workers -> just run it on the calling thread
+	if (workers.empty())
+	{
+		task();
+		return result;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		jobs.push_back(std::move(task));
+	}
+	job_cv.notify_one();
+	return result;
+}
+
+int ThreadPool::cancel()
+{
+	std::deque<std::packaged_task<void()>> dropped;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		dropped.swap(jobs);
+	}
+	idle_cv.notify_all();
+	// destroying the tasks outside the lock breaks their promises
+	return (int)dropped.size();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	idle_cv.wait(lock, [this] { return jobs.empty() && active == 0; });
+}
+
+void ThreadPool::resize(int n)
+{
+	if (n < 0)
+		n = 0;
+	if (n == size())
+		return;
+
+	stop_workers();
+
+	int gen;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		gen = generation;
+	}
+	for (int i = 0; i < n; i++)
+		workers.emplace_back(&ThreadPool::worker_loop, this, gen);
+}
+
+void ThreadPool::stop_workers()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		generation++;
+	}
+	job_cv.notify_all();
+
+	// workers finish the job they are on before they notice
+	for (auto& t : workers)
+		t.join();
+	workers.clear();
+}
+
+void ThreadPool::worker_loop(int gen)
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	for (;;)
+	{
+		// park until there is work or this set of workers is retired
+		job_cv.wait(lock, [this, gen] { return !jobs.empty() || generation != gen; });
+		if (generation != gen)
+			break;
+
+		std::packaged_task<void()> task = std::move(jobs.front());
+		jobs.pop_front();
+		active++;
+
+		lock.unlock();
+		task();
+		lock.lock();
+
+		active--;
+		if (active == 0 && jobs.empty())
+			idle_cv.notify_all();
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+// A fixed set of worker threads that sleep on a condition variable until
+// jobs are submitted.  The RayTracer owns one of these for its whole
+// lifetime so that a render never has to start (or join) OS threads.
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+	explicit ThreadPool(int n = 0);
+	~ThreadPool();
+
+	// queue a job, the future becomes ready once the job has run
+	// (or holds a broken_promise if the job is cancelled first)
+	std::future<void> submit(std::function<void()> job);
+
+	// drop every job that has not started yet, returns how many were dropped
+	int cancel();
+
+	// block until the queue is empty and no worker is busy
+	void wait();
+
+	// change the number of workers, queued jobs are kept
+	void resize(int n);
+	int size() const { return (int)workers.size(); }
+
+private:
+	void worker_loop(int generation);
+	void stop_workers();
+
+	std::vector<std::thread> workers;
+	std::deque<std::packaged_task<void()>> jobs;
+	std::mutex mtx;
+	std::condition_variable job_cv;		// signalled when a job is queued
+	std::condition_variable idle_cv;	// signalled when a worker goes idle
+	int active;
+	int generation;						// bumped to retire the current workers
+};
+
+#endif // __THREADPOOL_H__
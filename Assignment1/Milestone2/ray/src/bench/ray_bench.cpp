@@ -0,0 +1,481 @@
+//
+// ray_bench.cpp
+//
+// Runs the ray tracer over a manifest of scenes and reports how fast it
+// was, for comparing builds.
+//
+// Every scene is rendered warmup + repeat times by the ray executable in a
+// child process (so each run has its own peak memory and cold start), with
+// --stats writing the load, BVH and render times and the ray counts (see
+// rayStats.h).  The results are written as json; given the results of an
+// earlier run as a baseline, scenes whose render time got worse than the
+// tolerance, or whose image changed, are reported and make the exit status
+// 1.  The image check is what keeps a "speedup" from quietly changing the
+// picture.
+//
+// The manifest is json:
+//
+//	{
+//	  "repeat": 3, "warmup": 1,
+//	  "settings": { "size": 256, "recursion_depth": 3 },
+//	  "scenes": [
+//	    { "name": "dragon", "file": "path/to/dragon.ray",
+//	      "settings": { "size": 512 } },
+//	    ...
+//	  ]
+//	}
+//
+// Scene files are relative to the manifest.  settings are the ray -j
+// options (size, recursion_depth, threads, anti_alias, ...); a scene's own
+// settings override the manifest's.  See bench/scenes.json.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../fileio/images.h"
+#include "../ui/json.hpp"
+
+using Json = nlohmann::json;
+using std::string;
+
+namespace {
+
+struct Options {
+	string manifest;
+	string output = "bench_results.json";
+	string images;				// default: next to output
+	string baseline;
+	string ray;					// the ray executable
+	double tolerance = 0.05;	// allowed render time growth over the baseline
+	int pixelTolerance = 0;		// allowed per channel difference from the baseline image
+	int repeat = -1, warmup = -1;	// < 0: from the manifest
+};
+
+// one run of ray
+struct Run {
+	double wall_ms = 0.0;
+	long peak_rss_kb = 0;
+	Json stats;
+};
+
+void usage(const char* prog)
+{
+	std::cerr << "usage: " << prog << " [options] manifest.json" << std::endl
+	          << "  -o <FILE>   write the results here (default bench_results.json)" << std::endl
+	          << "  -i <DIR>    put the images, settings and logs here (default: the results" << std::endl
+	          << "              file name without .json, plus _images)" << std::endl
+	          << "  -b <FILE>   compare with the results of an earlier run (whose images must" << std::endl
+	          << "              not be in this run's image directory)" << std::endl
+	          << "  -t <FRAC>   allowed render time growth over the baseline (default 0.05)" << std::endl
+	          << "  -d <#>      allowed per channel difference from the baseline images (default 0)" << std::endl
+	          << "  -n <#>      timed runs per scene (default from the manifest, or 3)" << std::endl
+	          << "  -k <#>      warm-up runs per scene (default from the manifest, or 1)" << std::endl
+	          << "  -x <FILE>   the ray executable (default: ray next to " << prog << ")" << std::endl;
+}
+
+string directoryOf(const string& path)
+{
+	size_t slash = path.find_last_of("/");
+	return slash == string::npos ? "." : path.substr(0, slash);
+}
+
+// relative paths are taken relative to dir
+string resolve(const string& dir, const string& path)
+{
+	if (path.empty() || path[0] == '/')
+		return path;
+	return dir + "/" + path;
+}
+
+Json readJson(const string& file)
+{
+	std::ifstream in(file);
+	if (!in)
+		throw std::runtime_error("can't read " + file);
+	try
+	{
+		Json json;
+		in >> json;
+		return json;
+	}
+	catch (std::exception& e)
+	{
+		throw std::runtime_error(file + ": " + e.what());
+	}
+}
+
+void writeJson(const string& file, const Json& json)
+{
+	std::ofstream out(file);
+	out << json.dump(2) << std::endl;
+	if (!out)
+		throw std::runtime_error("can't write " + file);
+}
+
+// run ray with args, its output going to log; throws if it doesn't exit 0
+Run runRay(const Options& opt, const std::vector<string>& args, const string& log, const string& statsFile)
+{
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(opt.ray.c_str()));
+	for (const string& a : args)
+		argv.push_back(const_cast<char*>(a.c_str()));
+	argv.push_back(nullptr);
+
+	unlink(statsFile.c_str());
+	auto start = std::chrono::steady_clock::now();
+	pid_t pid = fork();
+	if (pid < 0)
+		throw std::runtime_error(string("fork: ") + strerror(errno));
+	if (pid == 0)
+	{
+		int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd >= 0)
+		{
+			dup2(fd, 1);
+			dup2(fd, 2);
+			close(fd);
+		}
+		execv(argv[0], argv.data());
+		_exit(127);
+	}
+
+	int status = 0;
+	struct rusage usage;
+	while (wait4(pid, &status, 0, &usage) < 0)
+	{
+		if (errno != EINTR)
+			throw std::runtime_error(string("wait4: ") + strerror(errno));
+	}
+
+	Run run;
+	run.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		throw std::runtime_error(WIFEXITED(status) && WEXITSTATUS(status) == 127
+		                         ? "couldn't run " + opt.ray
+		                         : "ray failed, see " + log);
+#ifdef __APPLE__
+	run.peak_rss_kb = usage.ru_maxrss / 1024;	// bytes
+#else
+	run.peak_rss_kb = usage.ru_maxrss;			// kilobytes
+#endif
+	run.stats = readJson(statsFile);
+	return run;
+}
+
+double median(std::vector<double> v)
+{
+	if (v.empty())
+		return 0.0;
+	std::sort(v.begin(), v.end());
+	size_t n = v.size();
+	return n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+// median, min and max of field over the runs
+Json summary(const std::vector<Run>& runs, const char* field)
+{
+	std::vector<double> v;
+	for (const Run& r : runs)
+		v.push_back(field ? r.stats.value(field, 0.0) : r.wall_ms);
+	Json s;
+	s["median"] = median(v);
+	s["min"] = *std::min_element(v.begin(), v.end());
+	s["max"] = *std::max_element(v.begin(), v.end());
+	return s;
+}
+
+Json benchScene(const Options& opt, const Json& manifest, const string& manifestDir,
+                const Json& scene, int repeat, int warmup)
+{
+	string name = scene.at("name").get<string>();
+	string file = resolve(manifestDir, scene.at("file").get<string>());
+
+	// the manifest's settings, then the scene's
+	Json settings = manifest.value("settings", Json::object());
+	Json own = scene.value("settings", Json::object());
+	for (auto it = own.begin(); it != own.end(); ++it)
+		settings[it.key()] = it.value();
+
+	string base = opt.images + "/" + name;
+	string config = base + ".settings.json";
+	string statsFile = base + ".stats.json";
+	string image = base + ".bmp";
+	writeJson(config, settings);
+	std::vector<string> args = { "-j", config, "--stats=" + statsFile, file, image };
+
+	std::cout << name << ": " << std::flush;
+	for (int k = 0; k < warmup; k++)
+	{
+		runRay(opt, args, base + ".log", statsFile);
+		std::cout << "w" << std::flush;
+	}
+	std::vector<Run> runs;
+	for (int k = 0; k < repeat; k++)
+	{
+		runs.push_back(runRay(opt, args, base + ".log", statsFile));
+		std::cout << "." << std::flush;
+	}
+
+	// the ray counts are the same every run
+	const Json& last = runs.back().stats;
+	Json result;
+	result["name"] = name;
+	result["file"] = file;
+	result["settings"] = settings;
+	result["runs"] = repeat;
+	result["width"] = last.value("width", 0);
+	result["height"] = last.value("height", 0);
+	result["threads"] = last.value("threads", 0);
+	result["wall_ms"] = summary(runs, nullptr);
+	result["read_ms"] = summary(runs, "read_ms");
+	result["bvh_ms"] = summary(runs, "bvh_ms");
+	result["render_ms"] = summary(runs, "render_ms");
+	result["rays"] = last.value("rays", (uint64_t)0);
+	double render_ms = result["render_ms"]["median"];
+	result["mrays_per_s"] = render_ms > 0.0 ? result["rays"].get<double>() / render_ms * 1e-3 : 0.0;
+	long peak = 0;
+	for (const Run& r : runs)
+		peak = std::max(peak, r.peak_rss_kb);
+	result["peak_rss_kb"] = peak;
+	result["counters"] = last.value("counters", Json::object());
+	// absolute, so a later run can find it from anywhere
+	char* full = realpath(image.c_str(), nullptr);
+	result["image"] = full ? string(full) : image;
+	free(full);
+
+	std::cout << " render " << render_ms << " ms, " << result["mrays_per_s"].get<double>()
+	          << " Mrays/s, read " << result["read_ms"]["median"].get<double>()
+	          << " ms, BVH " << result["bvh_ms"]["median"].get<double>()
+	          << " ms, peak " << peak / 1024 << " MB" << std::endl;
+	return result;
+}
+
+// how many pixels of b differ from a by more than tolerance in some channel;
+// -1 if the images can't be compared
+long imageDiff(const string& a, const string& b, int tolerance, int& maxDiff)
+{
+	int wa, ha, wb, hb;
+	std::vector<uint8_t> pa = readImage(a.c_str(), wa, ha);
+	std::vector<uint8_t> pb = readImage(b.c_str(), wb, hb);
+	maxDiff = 0;
+	if (pa.empty() || pb.empty() || wa != wb || ha != hb)
+		return -1;
+	long differ = 0;
+	for (size_t p = 0; p < pa.size(); p += 3)
+	{
+		int d = 0;
+		for (int c = 0; c < 3; c++)
+			d = std::max(d, abs((int)pa[p + c] - (int)pb[p + c]));
+		maxDiff = std::max(maxDiff, d);
+		if (d > tolerance)
+			differ++;
+	}
+	return differ;
+}
+
+// the first image of the baseline that this run would render over, or ""
+// if there is none.  Comparing against it afterwards would compare every
+// scene with itself.
+string baselineImageIn(const Json& baseline, const string& baselineDir, const string& images)
+{
+	char* dir = realpath(images.c_str(), nullptr);
+	if (!dir)
+		return "";
+	string prefix = string(dir) + "/";
+	free(dir);
+	if (baseline.count("scenes"))
+		for (const Json& s : baseline["scenes"])
+		{
+			string image = resolve(baselineDir, s.value("image", ""));
+			char* full = realpath(directoryOf(image).c_str(), nullptr);
+			bool inside = full && (string(full) + "/").compare(0, prefix.size(), prefix) == 0;
+			free(full);
+			if (inside)
+				return image;
+		}
+	return "";
+}
+
+// fills in result["baseline"]; returns false for a regression
+bool compare(const Options& opt, const Json& baseline, const string& baselineDir, Json& result)
+{
+	const string& name = result["name"].get_ref<const string&>();
+	const Json* old = nullptr;
+	if (baseline.count("scenes"))
+		for (const Json& s : baseline["scenes"])
+			if (s.value("name", "") == name)
+				old = &s;
+	if (!old)
+	{
+		std::cout << "  " << name << ": not in the baseline" << std::endl;
+		return true;
+	}
+
+	bool ok = true;
+	Json cmp;
+	double now = result["render_ms"]["median"];
+	double then = (*old)["render_ms"].value("median", 0.0);
+	double ratio = then > 0.0 ? now / then : 1.0;
+	cmp["render_ms"] = then;
+	cmp["render_ratio"] = ratio;
+	string verdict = "same speed";
+	if (ratio > 1.0 + opt.tolerance)
+	{
+		verdict = "SLOWER";
+		ok = false;
+	}
+	else if (ratio < 1.0 - opt.tolerance)
+		verdict = "faster";
+
+	std::cout << "  " << name << ": " << then << " -> " << now << " ms (" << ratio << "x), " << verdict;
+	if (old->value("rays", (uint64_t)0) != result["rays"].get<uint64_t>())
+		std::cout << ", rays " << old->value("rays", (uint64_t)0) << " -> " << result["rays"].get<uint64_t>();
+
+	string oldImage = resolve(baselineDir, old->value("image", ""));
+	int maxDiff = 0;
+	long differ = -1;
+	try
+	{
+		differ = imageDiff(oldImage, result["image"], opt.pixelTolerance, maxDiff);
+	}
+	catch (...)
+	{
+	}
+	if (differ < 0)
+	{
+		std::cout << ", IMAGE can't be compared with " << oldImage;
+		ok = false;
+	}
+	else if (differ > 0)
+	{
+		std::cout << ", IMAGE CHANGED (" << differ << " pixels, by up to " << maxDiff << ")";
+		ok = false;
+	}
+	cmp["image_pixels_differ"] = differ;
+	cmp["image_max_diff"] = maxDiff;
+	cmp["ok"] = ok;
+	std::cout << std::endl;
+	result["baseline"] = cmp;
+	return ok;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+	Options opt;
+	int c;
+	while ((c = getopt(argc, argv, "o:i:b:t:d:n:k:x:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'o': opt.output = optarg; break;
+		case 'i': opt.images = optarg; break;
+		case 'b': opt.baseline = optarg; break;
+		case 't': opt.tolerance = atof(optarg); break;
+		case 'd': opt.pixelTolerance = atoi(optarg); break;
+		case 'n': opt.repeat = atoi(optarg); break;
+		case 'k': opt.warmup = atoi(optarg); break;
+		case 'x': opt.ray = optarg; break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+	opt.manifest = argv[optind];
+	if (opt.ray.empty())
+		opt.ray = directoryOf(argv[0]) + "/ray";
+	if (opt.images.empty())
+	{
+		string stem = opt.output;
+		if (stem.size() > 5 && stem.compare(stem.size() - 5, 5, ".json") == 0)
+			stem.resize(stem.size() - 5);
+		opt.images = stem + "_images";
+	}
+	if (!opt.baseline.empty() && opt.baseline == opt.output)
+	{
+		std::cerr << "ray_bench: the results would overwrite the baseline" << std::endl;
+		return 2;
+	}
+
+	try
+	{
+		Json manifest = readJson(opt.manifest);
+		string manifestDir = directoryOf(opt.manifest);
+		int repeat = opt.repeat >= 0 ? opt.repeat : manifest.value("repeat", 3);
+		int warmup = opt.warmup >= 0 ? opt.warmup : manifest.value("warmup", 1);
+		repeat = std::max(repeat, 1);
+		warmup = std::max(warmup, 0);
+		if (mkdir(opt.images.c_str(), 0755) < 0 && errno != EEXIST)
+			throw std::runtime_error("can't make " + opt.images);
+
+		Json baseline;
+		if (!opt.baseline.empty())
+		{
+			baseline = readJson(opt.baseline);
+			string clash = baselineImageIn(baseline, directoryOf(opt.baseline), opt.images);
+			if (!clash.empty())
+				throw std::runtime_error("the baseline's image " + clash + " is in " + opt.images +
+				                         ", which this run writes to; pick another -o or -i");
+		}
+
+		Json results;
+		results["manifest"] = opt.manifest;
+		results["ray"] = opt.ray;
+		results["repeat"] = repeat;
+		results["warmup"] = warmup;
+		results["scenes"] = Json::array();
+
+		std::set<string> names;
+		for (const Json& scene : manifest.at("scenes"))
+		{
+			if (!names.insert(scene.at("name").get<string>()).second)
+				throw std::runtime_error("two scenes are called " + scene["name"].get<string>());
+			results["scenes"].push_back(benchScene(opt, manifest, manifestDir, scene, repeat, warmup));
+		}
+
+		bool ok = true;
+		if (!opt.baseline.empty())
+		{
+			std::cout << "compared with " << opt.baseline << " (tolerance " << opt.tolerance * 100.0
+			          << "%, pixel tolerance " << opt.pixelTolerance << "):" << std::endl;
+			for (Json& result : results["scenes"])
+				ok = compare(opt, baseline, directoryOf(opt.baseline), result) && ok;
+			results["baseline"] = opt.baseline;
+			results["ok"] = ok;
+		}
+
+		writeJson(opt.output, results);
+		std::cout << "wrote " << opt.output << std::endl;
+		return ok ? 0 : 1;
+	}
+	catch (std::exception& e)
+	{
+		std::cout << std::endl;
+		std::cerr << "ray_bench: " << e.what() << std::endl;
+		return 2;
+	}
+}
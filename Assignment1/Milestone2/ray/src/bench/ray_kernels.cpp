@@ -0,0 +1,615 @@
+//
+// ray_kernels.cpp
+//
+// Microbenchmarks for the ray tracer's inner loops: the bounding box test,
+// the primitives' intersectLocal, BVH traversal, texture and cube map
+// lookups and the light loop in traceRay.  ray_bench times whole renders;
+// this is for seeing which kernel a change actually moved.
+//
+// Each kernel runs over a fixed set of inputs made from a seeded generator,
+// in two distributions: coherent (a camera grid in scan order, neighbours
+// hit neighbours) and incoherent (random origins and directions, or random
+// texture coordinates).  The same seed gives the same inputs on every host.
+// A kernel is timed in batches long enough to measure, over several
+// trials, and reported as the median ns per operation.
+//
+// The BVH and light loop scenes are generated as .ray text and go through
+// the parser like any other scene; textures are written as bitmaps to a
+// temporary directory.  Built with RAY_NO_GL (see ui/glObjects.cpp), so it
+// needs neither FLTK nor OpenGL.
+//
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../RayTracer.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/trimesh.h"
+#include "../fileio/bitmap.h"
+#include "../parser/Parser.h"
+#include "../parser/ParserException.h"
+#include "../parser/Tokenizer.h"
+#include "../scene/cubeMap.h"
+#include "../scene/material.h"
+#include "../scene/ray.h"
+#include "../scene/scene.h"
+#include "../ui/TraceUI.h"
+#include "../ui/json.hpp"
+
+using Json = nlohmann::json;
+using std::string;
+
+// what the ray tracer expects from main.cpp
+TraceUI* traceUI = nullptr;
+int TraceUI::m_threads = 1;
+bool TraceUI::m_debug = false;
+
+namespace {
+
+// settings for the kernels that read them through traceUI
+class BenchUI : public TraceUI {
+public:
+	BenchUI()
+	{
+		m_textureCache = "off";		// textures are made fresh each run
+		m_nDepth = 0;				// light loop only, no bounces
+	}
+
+	int run() { return 0; }
+	void alert(const string& msg) { std::cerr << msg << std::endl; }
+
+	void setShadows(bool b) { m_shadows = b; }
+	void setFilterWidth(int w) { m_nFilterWidth = w; }
+};
+
+struct Options {
+	string filter;				// run kernels whose name contains this
+	string output;				// json results, if set
+	int trials = 5;
+	double trial_ms = 100.0;	// minimum length of one trial
+	uint64_t seed = 1;
+	bool list = false;
+};
+
+struct Kernel {
+	string name;
+	std::function<double(size_t)> run;	// n operations, returns a sink value
+};
+
+struct Result {
+	string name;
+	size_t ops = 0;				// per trial
+	double ns_median = 0.0, ns_min = 0.0, ns_max = 0.0;
+};
+
+const size_t NUM_RAYS = 4096;
+const size_t NUM_COORDS = 4096;
+
+// the kernels' results end up here, so they can't be optimized away
+volatile double kernelSink;
+
+void usage(const char* prog)
+{
+	std::cerr << "usage: " << prog << " [options]" << std::endl
+	          << "  -f <TEXT>   only run kernels whose name contains TEXT" << std::endl
+	          << "  -o <FILE>   also write the results as json" << std::endl
+	          << "  -n <N>      trials per kernel (default 5)" << std::endl
+	          << "  -m <MS>     minimum length of a trial in ms (default 100)" << std::endl
+	          << "  -s <SEED>   seed for the inputs (default 1)" << std::endl
+	          << "  -l          list the kernels and exit" << std::endl;
+}
+
+// inputs
+
+/*
+ * Rays at the box [lo, hi].  Coherent rays come from a pinhole in front of
+ * the box (-z side) through a square grid covering it, in scan order;
+ * incoherent rays start at random points on a sphere around the box and
+ * aim at random points inside it.
+ */
+std::vector<ray> makeRays(const glm::dvec3& lo, const glm::dvec3& hi, bool coherent, uint64_t seed)
+{
+	glm::dvec3 center = (lo + hi) * 0.5;
+	double radius = glm::length(hi - lo) * 0.5;
+	std::vector<ray> rays;
+	rays.reserve(NUM_RAYS);
+	if (coherent)
+	{
+		int side = (int)std::sqrt((double)NUM_RAYS);
+		glm::dvec3 eye = center - glm::dvec3(0.0, 0.0, 2.0 * radius);
+		double half = std::max(hi.x - lo.x, hi.y - lo.y) * 0.5;
+		for (int y = 0; y < side; y++)
+			for (int x = 0; x < side; x++)
+			{
+				glm::dvec3 target = center + glm::dvec3(
+				        half * (2.0 * (x + 0.5) / side - 1.0),
+				        half * (2.0 * (y + 0.5) / side - 1.0), 0.0);
+				rays.emplace_back(eye, glm::normalize(target - eye), glm::dvec3(1.0));
+			}
+		return rays;
+	}
+
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	std::normal_distribution<double> normal(0.0, 1.0);
+	while (rays.size() < NUM_RAYS)
+	{
+		glm::dvec3 g(normal(rng), normal(rng), normal(rng));
+		double len = glm::length(g);
+		if (len < 1e-9)
+			continue;
+		glm::dvec3 origin = center + g * (2.0 * radius / len);
+		glm::dvec3 target = lo + (hi - lo) * glm::dvec3(unit(rng), unit(rng), unit(rng));
+		rays.emplace_back(origin, glm::normalize(target - origin), glm::dvec3(1.0));
+	}
+	return rays;
+}
+
+// texture coordinates: a grid in scan order, or uniformly random
+std::vector<glm::dvec2> makeCoords(bool coherent, uint64_t seed)
+{
+	std::vector<glm::dvec2> coords;
+	coords.reserve(NUM_COORDS);
+	if (coherent)
+	{
+		int side = (int)std::sqrt((double)NUM_COORDS);
+		for (int y = 0; y < side; y++)
+			for (int x = 0; x < side; x++)
+				coords.emplace_back((x + 0.5) / side, (y + 0.5) / side);
+		return coords;
+	}
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	for (size_t k = 0; k < NUM_COORDS; k++)
+		coords.emplace_back(unit(rng), unit(rng));
+	return coords;
+}
+
+// a bitmap with detail at every scale, so mip levels differ
+void writeTexture(const string& file, int size, int variant)
+{
+	std::vector<unsigned char> data(size * size * 3);
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++)
+		{
+			unsigned char* p = &data[(y * size + x) * 3];
+			bool check = ((x >> 3) ^ (y >> 3)) & 1;
+			p[0] = (unsigned char)(check ? 255 : (x * 255) / size);
+			p[1] = (unsigned char)((y * 255) / size);
+			p[2] = (unsigned char)((variant * 40 + x * y) & 0xff);
+		}
+	writeBMP(file.c_str(), size, size, data.data());
+}
+
+// scenes
+
+const char* SCENE_HEADER =
+	"SBT-raytracer 1.0\n"
+	"camera { position = (0,0,-10); viewdir = (0,0,1); updir = (0,1,0); aspectratio = 1; }\n"
+	"ambient_light { color = (0.2,0.2,0.2); }\n";
+
+const char* SCENE_MATERIAL =
+	"material = { diffuse = (0.6,0.5,0.4); specular = (0.5,0.5,0.5); shininess = 32; }";
+
+// n x n x n spheres of radius 0.4, a unit apart, around the origin
+string sphereGrid(int n)
+{
+	std::ostringstream s;
+	s << SCENE_HEADER;
+	double off = -0.5 * (n - 1);
+	for (int z = 0; z < n; z++)
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++)
+				s << "translate(" << off + x << "," << off + y << "," << off + z
+				  << ", scale(0.4, sphere { " << SCENE_MATERIAL << " }))\n";
+	return s.str();
+}
+
+// a rippled height field of 2 * n * n triangles over [-4, 4]^2, facing -z
+string meshGrid(int n)
+{
+	std::ostringstream s;
+	s << SCENE_HEADER << "polymesh {\npoints = (";
+	for (int y = 0; y <= n; y++)
+		for (int x = 0; x <= n; x++)
+		{
+			double u = 8.0 * x / n - 4.0, v = 8.0 * y / n - 4.0;
+			s << (x || y ? "," : "") << "(" << u << "," << v << ","
+			  << 0.5 * std::sin(2.0 * u) * std::cos(2.0 * v) << ")";
+		}
+	s << ");\nfaces = (";
+	for (int y = 0; y < n; y++)
+		for (int x = 0; x < n; x++)
+		{
+			int a = y * (n + 1) + x, b = a + 1, c = a + n + 1, d = c + 1;
+			s << (x || y ? "," : "") << "(" << a << "," << c << "," << b << "),("
+			  << b << "," << c << "," << d << ")";
+		}
+	s << ");\n" << SCENE_MATERIAL << "\n}\n";
+	return s.str();
+}
+
+// a floor with nine spheres on it, under the given number of point lights
+string lightScene(int lights)
+{
+	std::ostringstream s;
+	s << SCENE_HEADER;
+	std::mt19937_64 rng(lights);
+	std::uniform_real_distribution<double> pos(-4.0, 4.0);
+	for (int k = 0; k < lights; k++)
+		s << "point_light { position = (" << pos(rng) << "," << pos(rng) << ",-6);"
+		  << " color = (0.3,0.3,0.3); constant_attenuation_coeff = 1; }\n";
+	s << "translate(0,0,1, scale(10, square { " << SCENE_MATERIAL << " }))\n";
+	for (int y = 0; y < 3; y++)
+		for (int x = 0; x < 3; x++)
+			s << "translate(" << 2.5 * (x - 1) << "," << 2.5 * (y - 1)
+			  << ",0, sphere { " << SCENE_MATERIAL << " })\n";
+	return s.str();
+}
+
+std::unique_ptr<Scene> parseScene(const string& text)
+{
+	Tokenizer tokenizer(text.data(), text.data() + text.size(), false);
+	Parser parser(tokenizer, ".");
+	std::unique_ptr<Scene> scene(parser.parseScene());
+	scene->finishLoading();
+	scene->generate_BVH();
+	return scene;
+}
+
+// kernels
+
+// the two ray distributions, both for one kernel body
+template <typename F>
+void addRayKernels(std::vector<Kernel>& kernels, const string& name,
+                   const glm::dvec3& lo, const glm::dvec3& hi, uint64_t seed, F body)
+{
+	for (bool coherent : { true, false })
+	{
+		auto rays = std::make_shared<std::vector<ray>>(makeRays(lo, hi, coherent, seed));
+		kernels.push_back({ name + (coherent ? "/coherent" : "/incoherent"),
+		                    [rays, body](size_t n)
+		{
+			double sink = 0.0;
+			for (size_t k = 0, j = 0; k < n; k++)
+			{
+				sink += body((*rays)[j]);
+				if (++j == rays->size())
+					j = 0;
+			}
+			return sink;
+		} });
+	}
+}
+
+template <typename F>
+void addCoordKernels(std::vector<Kernel>& kernels, const string& name, uint64_t seed, F body)
+{
+	for (bool coherent : { true, false })
+	{
+		auto coords = std::make_shared<std::vector<glm::dvec2>>(makeCoords(coherent, seed));
+		kernels.push_back({ name + (coherent ? "/coherent" : "/incoherent"),
+		                    [coords, body](size_t n)
+		{
+			double sink = 0.0;
+			for (size_t k = 0, j = 0; k < n; k++)
+			{
+				sink += body((*coords)[j]);
+				if (++j == coords->size())
+					j = 0;
+			}
+			return sink;
+		} });
+	}
+}
+
+// everything the kernels use, kept alive until they have run
+struct Fixtures {
+	Scene prims;				// owns the primitives' materials
+	std::vector<std::shared_ptr<MaterialSceneObject>> objects;
+	std::shared_ptr<Trimesh> mesh;
+	std::vector<std::unique_ptr<Scene>> scenes;
+	std::vector<std::unique_ptr<RayTracer>> tracers;
+	std::unique_ptr<TextureMap> texture;
+	std::unique_ptr<CubeMap> cubemap;
+	string tmpdir;
+
+	~Fixtures()
+	{
+		if (!tmpdir.empty())
+		{
+			for (int k = 0; k < 7; k++)
+				unlink((tmpdir + "/" + std::to_string(k) + ".bmp").c_str());
+			rmdir(tmpdir.c_str());
+		}
+	}
+};
+
+double hitT(bool hit, const isect& i)
+{
+	return hit ? i.getT() : 0.0;
+}
+
+std::vector<Kernel> makeKernels(Fixtures& fx, BenchUI& ui, uint64_t seed)
+{
+	std::vector<Kernel> kernels;
+	glm::dvec3 unitLo(-1.0), unitHi(1.0);
+
+	// bounding box slab test
+	BoundingBox box(unitLo, unitHi);
+	addRayKernels(kernels, "bbox", unitLo, unitHi, seed, [box](ray& r)
+	{
+		double tmin, tmax;
+		return box.intersect(r, tmin, tmax) ? tmin : 0.0;
+	});
+
+	// primitives, in their local space
+	// (through the concrete type; intersectLocal is protected in Geometry)
+	auto addPrim = [&](const string& name, auto owned,
+	                   const glm::dvec3& lo, const glm::dvec3& hi)
+	{
+		fx.objects.push_back(owned);
+		addRayKernels(kernels, name, lo, hi, seed, [owned](ray& r)
+		{
+			isect i;
+			return hitT(owned->intersectLocal(r, i), i);
+		});
+	};
+	addPrim("sphere", std::make_shared<Sphere>(&fx.prims, new Material()), unitLo, unitHi);
+	addPrim("box", std::make_shared<Box>(&fx.prims, new Material()), glm::dvec3(-0.5), glm::dvec3(0.5));
+	addPrim("cylinder", std::make_shared<Cylinder>(&fx.prims, new Material()),
+	        glm::dvec3(-1.0, -1.0, 0.0), glm::dvec3(1.0, 1.0, 1.0));
+	addPrim("cone", std::make_shared<Cone>(&fx.prims, new Material(), 1.0, 1.0, 0.0, true),
+	        glm::dvec3(-1.0, -1.0, 0.0), glm::dvec3(1.0, 1.0, 1.0));
+
+	fx.mesh = std::make_shared<Trimesh>(&fx.prims, new Material(), &fx.prims.transformRoot);
+	fx.mesh->addVertex(glm::dvec3(-1.0, -1.0, 0.0));
+	fx.mesh->addVertex(glm::dvec3(1.0, -1.0, 0.0));
+	fx.mesh->addVertex(glm::dvec3(0.0, 1.0, 0.0));
+	fx.mesh->addFace(0, 1, 2);
+	TrimeshFace* face = fx.mesh->get_faces()[0];
+	addRayKernels(kernels, "triangle", glm::dvec3(-1.0, -1.0, -0.5), glm::dvec3(1.0, 1.0, 0.5), seed,
+	              [face](ray& r)
+	{
+		isect i;
+		return hitT(face->intersectLocal(r, i), i);
+	});
+
+	// BVH traversal, from the root
+	auto addBVH = [&](const string& name, const string& text,
+	                  const glm::dvec3& lo, const glm::dvec3& hi)
+	{
+		fx.scenes.push_back(parseScene(text));
+		const Scene* scene = fx.scenes.back().get();
+		addRayKernels(kernels, name, lo, hi, seed, [scene](ray& r)
+		{
+			isect i;
+			return hitT(scene->intersect_BVH(r, i, 0), i);
+		});
+	};
+	addBVH("bvh/spheres-512", sphereGrid(8), glm::dvec3(-4.0), glm::dvec3(4.0));
+	addBVH("bvh/mesh-32768", meshGrid(128), glm::dvec3(-4.0, -4.0, -0.5), glm::dvec3(4.0, 4.0, 0.5));
+
+	// textures: one 512x512 map, six 256x256 cube faces
+	const char* tmp = getenv("TMPDIR");
+	string pattern = string(tmp && *tmp ? tmp : "/tmp") + "/ray_kernelsXXXXXX";
+	std::vector<char> buf(pattern.begin(), pattern.end());
+	buf.push_back('\0');
+	if (!mkdtemp(buf.data()))
+		throw std::runtime_error("can't make a temporary directory in " + pattern);
+	fx.tmpdir = buf.data();
+	auto texFile = [&](int k) { return fx.tmpdir + "/" + std::to_string(k) + ".bmp"; };
+
+	writeTexture(texFile(6), 512, 6);
+	fx.texture.reset(new TextureMap(texFile(6)));
+	const TextureMap* tex = fx.texture.get();
+	addCoordKernels(kernels, "texture/bilinear", seed, [tex](const glm::dvec2& uv)
+	{
+		return tex->getMappedValue(uv)[0];
+	});
+	// a footprint of four texels, so the lookup blends mip levels 2 and 3
+	glm::dvec2 dx(4.0 / tex->getWidth(), 0.0), dy(0.0, 4.0 / tex->getHeight());
+	addCoordKernels(kernels, "texture/trilinear", seed, [tex, dx, dy](const glm::dvec2& uv)
+	{
+		return tex->getMappedValue(uv, dx, dy)[0];
+	});
+
+	fx.cubemap.reset(new CubeMap());
+	for (int k = 0; k < 6; k++)
+	{
+		writeTexture(texFile(k), 256, k);
+		fx.cubemap->setNthMap(k, new TextureMap(texFile(k)));
+	}
+	// cube map rays all start at the center; only the direction matters
+	const CubeMap* cubemap = fx.cubemap.get();
+	BenchUI* bui = &ui;
+	for (int width : { 1, 8 })
+		addRayKernels(kernels, "cubemap/filter" + std::to_string(width),
+		              glm::dvec3(-1.0), glm::dvec3(1.0), seed,
+		              [cubemap, bui, width](ray& r)
+		{
+			bui->setFilterWidth(width);
+			return cubemap->getColor(r.getDirection())[0];
+		});
+
+	// the Phong light loop: one camera ray through traceRay, at depth 0
+	for (int lights : { 1, 8 })
+	{
+		fx.tracers.emplace_back(new RayTracer());
+		RayTracer* rt = fx.tracers.back().get();
+		rt->setScene(parseScene(lightScene(lights)));
+		rt->traceSetup(64, 64);
+		for (bool shadows : { false, true })
+		{
+			string name = "phong/lights" + std::to_string(lights) + (shadows ? "-shadows" : "");
+			addRayKernels(kernels, name, glm::dvec3(-4.0, -4.0, 0.0), glm::dvec3(4.0, 4.0, 1.0), seed,
+			              [rt, bui, shadows](ray& r)
+			{
+				bui->setShadows(shadows);
+				double t;
+				return rt->traceRay(r, glm::dvec3(1.0), 0, t, 1.0)[0];
+			});
+		}
+	}
+	return kernels;
+}
+
+// timing
+
+double runFor(const Kernel& kernel, size_t ops, double& sink)
+{
+	auto start = std::chrono::steady_clock::now();
+	sink += kernel.run(ops);
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+Result measure(const Kernel& kernel, const Options& opt, double& sink)
+{
+	// warm up, then grow the batch until one takes long enough
+	size_t ops = 1024;
+	runFor(kernel, ops, sink);
+	for (;;)
+	{
+		double ns = runFor(kernel, ops, sink);
+		if (ns >= opt.trial_ms * 1e6)
+			break;
+		double grow = ns > 0.0 ? opt.trial_ms * 1e6 / ns : 10.0;
+		ops = (size_t)(ops * std::min(10.0, std::max(1.5, grow * 1.1)));
+	}
+
+	std::vector<double> per_op;
+	for (int k = 0; k < opt.trials; k++)
+		per_op.push_back(runFor(kernel, ops, sink) / ops);
+	std::sort(per_op.begin(), per_op.end());
+
+	Result res;
+	res.name = kernel.name;
+	res.ops = ops;
+	res.ns_median = per_op[per_op.size() / 2];
+	res.ns_min = per_op.front();
+	res.ns_max = per_op.back();
+	return res;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	Options opt;
+	int c;
+	while ((c = getopt(argc, argv, "f:o:n:m:s:lh")) != -1)
+	{
+		switch (c)
+		{
+		case 'f': opt.filter = optarg; break;
+		case 'o': opt.output = optarg; break;
+		case 'n': opt.trials = std::max(1, atoi(optarg)); break;
+		case 'm': opt.trial_ms = std::max(1.0, atof(optarg)); break;
+		case 's': opt.seed = strtoull(optarg, nullptr, 10); break;
+		case 'l': opt.list = true; break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (optind != argc)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+
+	BenchUI ui;
+	traceUI = &ui;
+
+	Fixtures fx;
+	std::vector<Kernel> kernels;
+	try {
+		kernels = makeKernels(fx, ui, opt.seed);
+	}
+	catch( SyntaxErrorException& pe ) {
+		std::cerr << pe.formattedMessage() << std::endl;
+		return 2;
+	}
+	catch( ParserException& pe ) {
+		std::cerr << "Parser: " << pe.message() << std::endl;
+		return 2;
+	}
+	catch( TextureMapException& e ) {
+		std::cerr << "Texture: " << e.message() << std::endl;
+		return 2;
+	}
+	catch( std::exception& e ) {
+		std::cerr << e.what() << std::endl;
+		return 2;
+	}
+
+	if (opt.list)
+	{
+		for (const Kernel& k : kernels)
+			std::cout << k.name << std::endl;
+		return 0;
+	}
+
+	std::vector<Result> results;
+	double sink = 0.0;
+	std::cout << std::left << std::setw(32) << "kernel" << std::right
+	          << std::setw(12) << "ns/op" << std::setw(12) << "min" << std::setw(12) << "max"
+	          << std::setw(12) << "Mops/s" << std::endl;
+	for (const Kernel& k : kernels)
+	{
+		if (!opt.filter.empty() && k.name.find(opt.filter) == string::npos)
+			continue;
+		Result r = measure(k, opt, sink);
+		results.push_back(r);
+		std::cout << std::left << std::setw(32) << r.name << std::right << std::fixed
+		          << std::setprecision(2) << std::setw(12) << r.ns_median
+		          << std::setw(12) << r.ns_min << std::setw(12) << r.ns_max
+		          << std::setw(12) << 1e3 / r.ns_median << std::endl;
+	}
+	if (results.empty())
+	{
+		std::cerr << "no kernel matches " << opt.filter << std::endl;
+		return 2;
+	}
+
+	if (!opt.output.empty())
+	{
+		Json out;
+		out["seed"] = opt.seed;
+		out["trials"] = opt.trials;
+		out["kernels"] = Json::array();
+		for (const Result& r : results)
+			out["kernels"].push_back({ { "name", r.name }, { "ops", r.ops },
+			                           { "ns_per_op", r.ns_median }, { "ns_min", r.ns_min },
+			                           { "ns_max", r.ns_max }, { "mops_per_s", 1e3 / r.ns_median } });
+		std::ofstream f(opt.output);
+		f << std::setw(2) << out << std::endl;
+		if (!f)
+		{
+			std::cerr << "couldn't write " << opt.output << std::endl;
+			return 2;
+		}
+	}
+
+	kernelSink = sink;
+	return 0;
+}
@@ -92,9 +92,9 @@ std::vector<uint8_t> readBMP(const char *fname, int& width, int& height)
 	return image; 
 } 
  
-void writeBMP(const char *iname, int width, int height, const void* vdata) 
-{ 
-	const unsigned char* data = (const unsigned char*)vdata;
+// the two headers of a width x height 24 bit bitmap
+void writeBMPHeader(FILE* foo, int width, int height)
+{
 	int bytes, pad;
 	bytes = width * 3;
 	pad = (bytes%4) ? 4-(bytes%4) : 0;
@@ -120,8 +120,6 @@ void writeBMP(const char *iname, int width, int height, const void* vdata)
 	bmih.biClrUsed = 0;
 	bmih.biClrImportant = 0;
 
-	FILE *foo=fopen(iname, "wb"); 
-
 	//	fwrite(&bmfh, sizeof(BMP_BITMAPFILEHEADER), 1, foo);
 	fwrite( &(bmfh.bfType), 2, 1, foo); 
 	fwrite( &(bmfh.bfSize), 4, 1, foo); 
@@ -130,12 +128,21 @@ void writeBMP(const char *iname, int width, int height, const void* vdata)
 	fwrite( &(bmfh.bfOffBits), 4, 1, foo); 
 
 	fwrite(&bmih, sizeof(BMP_BITMAPINFOHEADER), 1, foo); 
+}
+
+// rows y0..y0+count-1 (bottom row first, like the file) go straight to
+// their place in the file, in any order
+void writeBMPRows(FILE* foo, int width, int y0, int count, const unsigned char* data)
+{
+	int bytes = width * 3;
+	int pad = (bytes%4) ? 4-(bytes%4) : 0;
+	bytes += pad;
 
-	bytes /= height;
+	fseek(foo, 14 + sizeof(BMP_BITMAPINFOHEADER) + (long)y0 * bytes, SEEK_SET);
 	std::vector<unsigned char> scanline(bytes);
-	for ( int j = 0; j < height; ++j )
+	for ( int j = 0; j < count; ++j )
 	{
-		memcpy( scanline.data(), data + j*3*width, bytes );
+		memcpy( scanline.data(), data + j*3*width, width*3 );
 		for ( int i = 0; i < width; ++i )
 		{
 			unsigned char temp = scanline[i*3];
@@ -144,6 +151,12 @@ void writeBMP(const char *iname, int width, int height, const void* vdata)
 		}
 		fwrite( scanline.data(), bytes, 1, foo);
 	}
+}
 
+void writeBMP(const char *iname, int width, int height, const void* vdata) 
+{ 
+	FILE *foo=fopen(iname, "wb"); 
+	writeBMPHeader(foo, width, height);
+	writeBMPRows(foo, width, 0, height, (const unsigned char*)vdata);
 	fclose(foo);
-} 
+}
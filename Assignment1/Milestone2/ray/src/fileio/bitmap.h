@@ -45,5 +45,9 @@ typedef struct {
 extern std::vector<uint8_t> readBMP(const char *fname, int& width, int& height);
 extern void writeBMP(const char *iname, int width, int height, const void* data); 
 
+// writeBMP in pieces, for images written a band at a time
+extern void writeBMPHeader(FILE* file, int width, int height);
+extern void writeBMPRows(FILE* file, int width, int y0, int count, const unsigned char* data);
+
 #endif
 
@@ -6,16 +6,19 @@
 
 
 /*
-  The Buffer class is essentially a wrapper for an istream.
-  It is here mainly to keep track of the current file location
-  (line number, column number) to print intelligent error messages.
+  The Buffer class holds the text being scanned as one contiguous
+  block of characters, either a caller's block (normally a mapped
+  file, see mappedfile.h) or a copy of everything in an istream.
+  The tokenizer walks it with a pointer, keeping track of the
+  current file location (line number, column number) to print
+  intelligent error messages.
 
 
   If you find yourself changing stuff in this file, you're probably
   doing something wrong.
 
   This class was borrowed from the stock PL0 source code used for
-  CSE401, because I didn't feel like rewriting it. 
+  CSE401, because I didn't feel like rewriting it.
   ( see http://www.cs.washington.edu/401 for details )
 */
 
@@ -29,29 +32,19 @@ using std::string;
 
 class Buffer {
  public:
-  Buffer(std::istream& file, bool printChars, bool printLines);
+  Buffer(const char* begin, const char* end);   // text must outlive the buffer
+  Buffer(std::istream& file);
 
-  char GetCh();			// Read and return next character
-  bool isEOF() { return !(inStream); }	// Return whether is end of file
+  const char* Begin() const { return _begin; }
+  const char* End() const { return _end; }
 
-  void PrintLine(std::ostream& out) const;		// Print current line
+  // Print the line starting at lineStart
+  void PrintLine(std::ostream& out, const char* lineStart) const;
 
-  int  CurColumn() const { return ColNumber; }
-  int  CurLine() const { return LineNumber; }	// Return current line #
-  
 protected:
-  void  GetLine();		// Read next line from file
-
-  std::istream& inStream;            // The file pointer to the source file
-
-  std::string Line;                  // The line buffer
-  std::string::const_iterator PositionInCurrentLine;
-
-  int   ColNumber;		// The number of the current column
-  int   LineNumber;             // The number of the line in the file
-  mutable int   LastPrintedLine;        // The line number of the last printed line
-
-  bool _printLines, _printChars; // printing flags
+  std::string Storage;               // the text, when it was read from a stream
+  const char* _begin;
+  const char* _end;
 };
 
 #endif
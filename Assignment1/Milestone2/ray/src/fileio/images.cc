@@ -2,6 +2,7 @@
 #include "bitmap.h"
 #include "pngimage.h"
 #include <string>
+#include <string.h>
 #if defined(_MSC_VER)
 #define strncasecmp _strnicmp
 #define strcasecmp _stricmp
@@ -66,3 +67,81 @@ void writeImage(const char *fname, int width, int height, const void* data)
 	}
 	handler->writer(fname, width, height, data);
 }
+
+AsyncImageWriter::~AsyncImageWriter()
+{
+	try {
+		finish();
+	} catch (...) {
+	}
+}
+
+void AsyncImageWriter::write(const char *fname, int width, int height, const void* data)
+{
+	finish();
+	pixels.assign((const uint8_t*)data, (const uint8_t*)data + width * height * 3);
+	string name(fname);
+	pending = std::async(std::launch::async, [this, name, width, height]() {
+		writeImage(name.c_str(), width, height, pixels.data());
+	});
+}
+
+void AsyncImageWriter::finish()
+{
+	if (pending.valid())
+		pending.get();
+}
+
+StripImageWriter::StripImageWriter(const char *fname, int width, int height)
+	: width(width), height(height), bmp(nullptr)
+{
+	auto handler = find_handler(fname);
+	if (handler && handler->writer == writePNG) {
+		int level, threads;
+		getPNGCompression(level, threads);
+		png.reset(new PNGWriter(fname, width, height, level, threads));
+		return;
+	}
+	if (!handler)
+		std::cerr << "Unrecognized extension for file " << fname
+			<< ", writing bmp format" << std::endl;
+	bmp = fopen(fname, "wb");
+	if (!bmp)
+		throw string("File could not be opened for writing: ") + fname;
+	writeBMPHeader(bmp, width, height);
+}
+
+StripImageWriter::~StripImageWriter()
+{
+	if (bmp)
+		fclose(bmp);
+}
+
+void StripImageWriter::writeRows(const void *data, int y0, int count)
+{
+	const unsigned char* rows = (const unsigned char*)data;
+	if (png) {
+		// png wants the top row first
+		std::vector<const unsigned char*> top_down(count);
+		for (int r = 0; r < count; r++)
+			top_down[count - r - 1] = rows + r * width * 3;
+		png->writeRows(top_down.data(), count);
+		return;
+	}
+	writeBMPRows(bmp, width, y0, count, rows);
+}
+
+void StripImageWriter::finish()
+{
+	if (png) {
+		png->finish();
+		return;
+	}
+	if (bmp) {
+		bool failed = ferror(bmp) != 0;
+		fclose(bmp);
+		bmp = nullptr;
+		if (failed)
+			throw string("Error while writing the image");
+	}
+}
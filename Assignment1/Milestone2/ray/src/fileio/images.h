@@ -1,9 +1,14 @@
 #ifndef FILEIO_IMAGES_H
 #define FILEIO_IMAGES_H
 
+#include <stdio.h>
+#include <future>
+#include <memory>
 #include <vector>
 #include <stdint.h>
 
+class PNGWriter;
+
 /*
  * Improved readBMP/writeBMP.
  * Automatically detects extensions and read/write the data.
@@ -13,4 +18,42 @@
 extern std::vector<uint8_t> readImage(const char *fname, int& width, int& height);
 extern void writeImage(const char *iname, int width, int height, const void *data); 
 
+/*
+ * Writes images in the background so the next one can be rendered
+ * meanwhile.  write() copies the pixels and returns as soon as the
+ * previous image is on disk (only one is in flight), finish() waits for
+ * the last one.  A failed write throws its error string from the next
+ * write() or finish().
+ */
+class AsyncImageWriter {
+public:
+	~AsyncImageWriter();
+	void write(const char *iname, int width, int height, const void *data);
+	void finish();
+
+private:
+	std::vector<uint8_t> pixels;
+	std::future<void> pending;
+};
+
+/*
+ * Writes an image a band of rows at a time without ever holding all of
+ * it: png bands are compressed as they come (see PNGWriter), bmp rows go
+ * straight to their place in the file.  Bands must come top band first;
+ * each holds rows y0..y0+count-1 (y = 0 is the bottom row), bottom row
+ * first like the frame buffer.  Errors are thrown as strings.
+ */
+class StripImageWriter {
+public:
+	StripImageWriter(const char *iname, int width, int height);
+	~StripImageWriter();
+	void writeRows(const void *data, int y0, int count);
+	void finish();
+
+private:
+	int width, height;
+	std::unique_ptr<PNGWriter> png;
+	FILE* bmp;
+};
+
 #endif
@@ -0,0 +1,63 @@
+#include "mappedfile.h"
+
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+	: addr(nullptr), length(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& filename)
+{
+	close();
+#ifndef _WIN32
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		void* a = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (a != MAP_FAILED)
+		{
+			addr = a;
+			length = (size_t)st.st_size;
+			::close(fd);
+			return true;
+		}
+	}
+	::close(fd);
+#endif
+
+	std::ifstream in(filename, std::ios::binary);
+	if (!in)
+		return false;
+	copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	length = copy.size();
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifndef _WIN32
+	if (addr)
+		munmap(addr, length);
+#endif
+	addr = nullptr;
+	length = 0;
+	copy.clear();
+}
@@ -0,0 +1,42 @@
+//
+// mappedfile.h
+//
+// read-only view of a whole file
+//
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Maps a file read-only so it can be scanned in place, without copying it
+ * into a buffer first.  Files that can't be mapped (empty files, pipes, or
+ * any file on Windows) are read into memory instead, so data() is always
+ * the file's contents.
+ */
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	// false if the file can't be read
+	bool open(const std::string& filename);
+	void close();
+
+	const char* data() const { return addr ? (const char*)addr : copy.data(); }
+	size_t size() const { return length; }
+	bool mapped() const { return addr != nullptr; }
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	void* addr;
+	size_t length;
+	std::vector<char> copy;
+};
+
+#endif
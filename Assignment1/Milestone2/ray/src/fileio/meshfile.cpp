@@ -0,0 +1,892 @@
+#include "meshfile.h"
+#include "mappedfile.h"
+#include "../parser/ParserException.h"
+#include "../ui/json.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/matrix.hpp>
+#include <glm/geometric.hpp>
+
+using std::string;
+using Json = nlohmann::json;
+
+namespace {
+
+void meshError(const string& filename, const string& msg)
+{
+	throw ParserException("Mesh file '" + filename + "': " + msg);
+}
+
+bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+bool isNumberChar(char c)
+{
+	return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+const double powersOf10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// exact for the usual short decimals, see Tokenizer.cpp
+bool fastNumber(const char* p, const char* end, double& out)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		any = true;
+		if (mantissa || *p != '0')
+		{
+			if (++digits > 19)
+				return false;
+			mantissa = mantissa * 10 + (*p - '0');
+		}
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			any = true;
+			exponent--;
+			if (mantissa || *p != '0')
+			{
+				if (++digits > 19)
+					return false;
+				mantissa = mantissa * 10 + (*p - '0');
+			}
+		}
+	}
+	if (!any)
+		return false;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool negExp = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negExp = *p++ == '-';
+		const char* start = p;
+		int e = 0;
+		for (; p < end && *p >= '0' && *p <= '9' && p - start < 4; p++)
+			e = e * 10 + (*p - '0');
+		if (p == start)
+			return false;
+		exponent += negExp ? -e : e;
+	}
+	if (p != end || mantissa > (uint64_t(1) << 53) || exponent < -22 || exponent > 22)
+		return false;
+
+	double value = (double)mantissa;
+	value = exponent < 0 ? value / powersOf10[-exponent] : value * powersOf10[exponent];
+	out = negative ? -value : value;
+	return true;
+}
+
+// the number at p, after any blanks; the file isn't 0 terminated, so
+// strtod only ever sees a copy
+bool readNumber(const char*& p, const char* end, double& out)
+{
+	while (p < end && isSpace(*p))
+		p++;
+	const char* start = p;
+	while (p < end && isNumberChar(*p))
+		p++;
+	if (p == start)
+		return false;
+	if (fastNumber(start, p, out))
+		return true;
+
+	char buf[64];
+	size_t n = std::min((size_t)(p - start), sizeof(buf) - 1);
+	memcpy(buf, start, n);
+	buf[n] = '\0';
+	char* e;
+	out = strtod(buf, &e);
+	return e != buf;
+}
+
+bool readInt(const char*& p, const char* end, long long& out)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	const char* start = p;
+	long long v = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+		v = v * 10 + (*p - '0');
+	out = negative ? -v : v;
+	return p != start;
+}
+
+bool hasExtension(const string& filename, const char* ext)
+{
+	size_t n = strlen(ext);
+	if (filename.size() < n)
+		return false;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (tolower(filename[filename.size() - n + i]) != ext[i])
+			return false;
+	}
+	return true;
+}
+
+//
+// OBJ
+//
+
+// one piece of an OBJ file, parsed on its own.  Indices are made 0 based;
+// negative (relative) ones are counted from this piece's end of the list
+// and fixed up once the earlier pieces' counts are known.
+struct ObjPiece {
+	std::vector<glm::dvec3> positions, normals;
+	std::vector<long long> corners;			// vertex of each triangle corner
+	std::vector<long long> cornerNormals;	// its normal, -1 if none
+	std::vector<size_t> relative;			// corners with relative vertices
+	std::vector<size_t> relativeNormals;	// corners with relative normals
+	const char* error = nullptr;
+
+	void parse(const char* p, const char* end);
+};
+
+void ObjPiece::parse(const char* p, const char* end)
+{
+	struct Corner {
+		long long v, vn;
+		bool relative, relativeNormal;
+	};
+	std::vector<Corner> poly;
+	while (p < end && !error)
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		while (p < eol && isSpace(*p))
+			p++;
+
+		if (eol - p > 2 && p[0] == 'v' && isSpace(p[1]))
+		{
+			p += 2;
+			glm::dvec3 v;
+			if (!readNumber(p, eol, v[0]) || !readNumber(p, eol, v[1]) || !readNumber(p, eol, v[2]))
+				error = "bad vertex";
+			positions.push_back(v);
+		}
+		else if (eol - p > 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2]))
+		{
+			p += 3;
+			glm::dvec3 n;
+			if (!readNumber(p, eol, n[0]) || !readNumber(p, eol, n[1]) || !readNumber(p, eol, n[2]))
+				error = "bad normal";
+			normals.push_back(n);
+		}
+		else if (eol - p > 2 && p[0] == 'f' && isSpace(p[1]))
+		{
+			p += 2;
+			poly.clear();
+			for (;;)
+			{
+				while (p < eol && isSpace(*p))
+					p++;
+				if (p >= eol)
+					break;
+
+				// v, v/vt, v//vn or v/vt/vn
+				long long v, vt, vn = 0;
+				if (!readInt(p, eol, v) || v == 0)
+				{
+					error = "bad face";
+					break;
+				}
+				if (p < eol && *p == '/')
+				{
+					p++;
+					readInt(p, eol, vt);
+					if (p < eol && *p == '/')
+					{
+						p++;
+						readInt(p, eol, vn);
+					}
+				}
+				Corner c;
+				c.relative = v < 0;
+				c.v = v > 0 ? v - 1 : (long long)positions.size() + v;
+				c.relativeNormal = vn < 0;
+				c.vn = vn > 0 ? vn - 1 : vn < 0 ? (long long)normals.size() + vn : -1;
+				poly.push_back(c);
+			}
+			if (!error && poly.size() < 3)
+				error = "face with fewer than 3 vertices";
+
+			// a triangle fan around the first corner
+			for (size_t k = 1; !error && k + 1 < poly.size(); k++)
+			{
+				const Corner* fan[3] = { &poly[0], &poly[k], &poly[k + 1] };
+				for (const Corner* c : fan)
+				{
+					if (c->relative)
+						relative.push_back(corners.size());
+					if (c->relativeNormal)
+						relativeNormals.push_back(corners.size());
+					corners.push_back(c->v);
+					cornerNormals.push_back(c->vn);
+				}
+			}
+		}
+		p = eol + 1;
+	}
+}
+
+void readObj(const string& filename, const char* data, size_t size, MeshData& mesh, int threads)
+{
+	// big files are cut at line ends into pieces parsed side by side
+	size_t pieces = 1;
+	if (threads > 1)
+		pieces = std::max((size_t)1, std::min((size_t)threads, size / (1 << 20)));
+	std::vector<const char*> cuts(pieces + 1);
+	cuts[0] = data;
+	cuts[pieces] = data + size;
+	for (size_t k = 1; k < pieces; k++)
+	{
+		const char* cut = std::max(cuts[k - 1], data + size / pieces * k);
+		const char* eol = (const char*)memchr(cut, '\n', data + size - cut);
+		cuts[k] = eol ? eol + 1 : data + size;
+	}
+
+	std::vector<ObjPiece> parsed(pieces);
+	std::vector<std::thread> workers;
+	for (size_t k = 1; k < pieces; k++)
+		workers.emplace_back([&parsed, &cuts, k] { parsed[k].parse(cuts[k], cuts[k + 1]); });
+	parsed[0].parse(cuts[0], cuts[1]);
+	for (auto& t : workers)
+		t.join();
+
+	size_t vertexCount = 0, normalCount = 0, cornerCount = 0;
+	bool cornersHaveNormals = true;
+	for (auto& piece : parsed)
+	{
+		if (piece.error)
+			meshError(filename, piece.error);
+		vertexCount += piece.positions.size();
+		normalCount += piece.normals.size();
+		cornerCount += piece.corners.size();
+	}
+	if (vertexCount >= UINT32_MAX)
+		meshError(filename, "too many vertices");
+
+	mesh.vertices.clear();
+	mesh.vertices.reserve(vertexCount);
+	mesh.faces.resize(cornerCount);
+	std::vector<glm::dvec3> normals;
+	normals.reserve(normalCount);
+	std::vector<long long> vertexNormal;
+
+	size_t vertexBase = 0, normalBase = 0, corner = 0;
+	for (auto& piece : parsed)
+	{
+		for (size_t c : piece.relative)
+			piece.corners[c] += vertexBase;
+		for (size_t c : piece.relativeNormals)
+			piece.cornerNormals[c] += normalBase;
+		for (size_t c = 0; c < piece.corners.size(); c++)
+		{
+			long long v = piece.corners[c];
+			if (v < 0 || (size_t)v >= vertexCount)
+				meshError(filename, "face index out of range");
+			mesh.faces[corner++] = (uint32_t)v;
+			long long vn = piece.cornerNormals[c];
+			if (vn < 0 || (size_t)vn >= normalCount)
+				cornersHaveNormals = false;
+		}
+		mesh.vertices.insert(mesh.vertices.end(), piece.positions.begin(), piece.positions.end());
+		normals.insert(normals.end(), piece.normals.begin(), piece.normals.end());
+		vertexBase += piece.positions.size();
+		normalBase += piece.normals.size();
+		std::vector<glm::dvec3>().swap(piece.positions);
+		std::vector<glm::dvec3>().swap(piece.normals);
+	}
+
+	// normals belong to corners in OBJ but to vertices here; keep them
+	// only if that is the same thing
+	mesh.normals.clear();
+	if (normalCount == 0 || !cornersHaveNormals)
+		return;
+	vertexNormal.assign(vertexCount, -1);
+	corner = 0;
+	for (auto& piece : parsed)
+	{
+		for (size_t c = 0; c < piece.corners.size(); c++, corner++)
+		{
+			long long& assigned = vertexNormal[mesh.faces[corner]];
+			if (assigned >= 0 && assigned != piece.cornerNormals[c])
+				return;
+			assigned = piece.cornerNormals[c];
+		}
+	}
+	mesh.normals.resize(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		if (vertexNormal[v] >= 0)
+			mesh.normals[v] = normals[vertexNormal[v]];
+	}
+}
+
+//
+// PLY
+//
+
+enum PlyType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_NONE };
+
+const int plyTypeSize[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+PlyType plyType(const string& name)
+{
+	static const char* names[][2] = {
+		{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+		{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" },
+	};
+	for (int t = 0; t < PLY_NONE; t++)
+	{
+		if (name == names[t][0] || name == names[t][1])
+			return (PlyType)t;
+	}
+	return PLY_NONE;
+}
+
+struct PlyProperty {
+	string name;
+	PlyType type;
+	PlyType countType;		// PLY_NONE unless this is a list
+};
+
+struct PlyElement {
+	string name;
+	size_t count;
+	std::vector<PlyProperty> props;
+};
+
+// reads the values of a binary or ascii PLY body in order
+class PlyReader {
+public:
+	PlyReader(const string& filename, const char* p, const char* end, bool ascii, bool swap)
+		: filename(filename), p(p), end(end), ascii(ascii), swap(swap) {}
+
+	double value(PlyType type)
+	{
+		if (ascii)
+		{
+			while (p < end && (isSpace(*p) || *p == '\n'))
+				p++;
+			double v;
+			if (!readNumber(p, end, v))
+				meshError(filename, p < end ? "bad number" : "file is truncated");
+			return v;
+		}
+
+		int size = plyTypeSize[type];
+		if (end - p < size)
+			meshError(filename, "file is truncated");
+		unsigned char b[8];
+		memcpy(b, p, size);
+		p += size;
+		if (swap)
+			std::reverse(b, b + size);
+		switch (type)
+		{
+		case PLY_INT8: { int8_t v; memcpy(&v, b, 1); return v; }
+		case PLY_UINT8: return b[0];
+		case PLY_INT16: { int16_t v; memcpy(&v, b, 2); return v; }
+		case PLY_UINT16: { uint16_t v; memcpy(&v, b, 2); return v; }
+		case PLY_INT32: { int32_t v; memcpy(&v, b, 4); return v; }
+		case PLY_UINT32: { uint32_t v; memcpy(&v, b, 4); return v; }
+		case PLY_FLOAT32: { float v; memcpy(&v, b, 4); return v; }
+		default: { double v; memcpy(&v, b, 8); return v; }
+		}
+	}
+
+	void skip(const PlyProperty& prop)
+	{
+		if (prop.countType == PLY_NONE)
+		{
+			value(prop.type);
+			return;
+		}
+		size_t n = (size_t)value(prop.countType);
+		for (size_t i = 0; i < n; i++)
+			value(prop.type);
+	}
+
+private:
+	const string& filename;
+	const char* p;
+	const char* end;
+	bool ascii, swap;
+};
+
+void readPly(const string& filename, const char* data, size_t size, MeshData& mesh)
+{
+	const char* end = data + size;
+	const char* marker = "end_header";
+	const char* body = std::search(data, end, marker, marker + strlen(marker));
+	if (size < 4 || memcmp(data, "ply", 3) != 0 || body == end)
+		meshError(filename, "not a PLY file");
+	body = (const char*)memchr(body, '\n', end - body);
+	body = body ? body + 1 : end;
+
+	std::istringstream header(string(data, body));
+	std::vector<PlyElement> elements;
+	string line, format;
+	while (std::getline(header, line))
+	{
+		std::istringstream words(line);
+		string word;
+		words >> word;
+		if (word == "format")
+			words >> format;
+		else if (word == "element")
+		{
+			PlyElement element;
+			words >> element.name >> element.count;
+			elements.push_back(element);
+		}
+		else if (word == "property" && !elements.empty())
+		{
+			PlyProperty prop;
+			string type;
+			words >> type;
+			prop.countType = PLY_NONE;
+			if (type == "list")
+			{
+				string countType;
+				words >> countType >> type;
+				prop.countType = plyType(countType);
+				if (prop.countType == PLY_NONE)
+					meshError(filename, "unknown property type " + countType);
+			}
+			prop.type = plyType(type);
+			if (prop.type == PLY_NONE)
+				meshError(filename, "unknown property type " + type);
+			words >> prop.name;
+			elements.back().props.push_back(prop);
+		}
+	}
+
+	bool ascii = format == "ascii";
+	uint32_t one = 1;
+	bool littleEndian = *(const unsigned char*)&one == 1;
+	if (!ascii && format != "binary_little_endian" && format != "binary_big_endian")
+		meshError(filename, "unknown format " + format);
+	PlyReader in(filename, body, end, ascii, !ascii && (format == "binary_little_endian") != littleEndian);
+
+	// Check the counts against the size of the body before allocating
+	// anything for them, so a corrupt header is an error instead of a huge
+	// allocation.  In ascii every value takes at least a digit and a
+	// separator, lists at least their count (and faces three indices).
+	size_t left = end - body + 1;	// the last value needs no separator
+	for (const PlyElement& element : elements)
+	{
+		size_t record = 0;
+		for (const PlyProperty& prop : element.props)
+		{
+			if (prop.countType == PLY_NONE)
+				record += ascii ? 2 : plyTypeSize[prop.type];
+			else
+			{
+				size_t items = element.name == "face" &&
+				               (prop.name == "vertex_indices" || prop.name == "vertex_index") ? 3 : 0;
+				record += ascii ? 2 * (1 + items) : plyTypeSize[prop.countType] + items * plyTypeSize[prop.type];
+			}
+		}
+		if (record == 0 ? element.count > 0 : element.count > left / record)
+			meshError(filename, "element " + element.name + " has more entries than the file has room for");
+		left -= element.count * record;
+	}
+
+	mesh.vertices.clear();
+	mesh.normals.clear();
+	mesh.faces.clear();
+	for (const PlyElement& element : elements)
+	{
+		if (element.name == "vertex")
+		{
+			if (element.count >= UINT32_MAX)
+				meshError(filename, "too many vertices");
+			// which property fills which coordinate
+			std::vector<int> slot(element.props.size(), -1);
+			int found = 0;
+			const char* names[] = { "x", "y", "z", "nx", "ny", "nz" };
+			for (size_t k = 0; k < element.props.size(); k++)
+			{
+				for (int s = 0; s < 6; s++)
+				{
+					if (element.props[k].name == names[s] && element.props[k].countType == PLY_NONE)
+					{
+						slot[k] = s;
+						found |= 1 << s;
+					}
+				}
+			}
+			if ((found & 7) != 7)
+				meshError(filename, "vertices without x, y and z");
+			bool withNormals = (found & 56) == 56;
+
+			mesh.vertices.resize(element.count);
+			if (withNormals)
+				mesh.normals.resize(element.count);
+			for (size_t i = 0; i < element.count; i++)
+			{
+				for (size_t k = 0; k < element.props.size(); k++)
+				{
+					if (slot[k] < 0)
+						in.skip(element.props[k]);
+					else if (slot[k] < 3)
+						mesh.vertices[i][slot[k]] = in.value(element.props[k].type);
+					else
+					{
+						double v = in.value(element.props[k].type);
+						if (withNormals)
+							mesh.normals[i][slot[k] - 3] = v;
+					}
+				}
+			}
+		}
+		else if (element.name == "face")
+		{
+			mesh.faces.reserve(mesh.faces.size() + element.count * 3);
+			for (size_t i = 0; i < element.count; i++)
+			{
+				for (const PlyProperty& prop : element.props)
+				{
+					if (prop.countType == PLY_NONE || (prop.name != "vertex_indices" && prop.name != "vertex_index"))
+					{
+						in.skip(prop);
+						continue;
+					}
+					size_t n = (size_t)in.value(prop.countType);
+					if (n < 3)
+						meshError(filename, "face with fewer than 3 vertices");
+					// a triangle fan around the first corner
+					uint32_t first = (uint32_t)in.value(prop.type);
+					uint32_t prev = (uint32_t)in.value(prop.type);
+					for (size_t c = 2; c < n; c++)
+					{
+						uint32_t next = (uint32_t)in.value(prop.type);
+						mesh.faces.push_back(first);
+						mesh.faces.push_back(prev);
+						mesh.faces.push_back(next);
+						prev = next;
+					}
+				}
+			}
+		}
+		else
+		{
+			for (size_t i = 0; i < element.count; i++)
+			{
+				for (const PlyProperty& prop : element.props)
+					in.skip(prop);
+			}
+		}
+	}
+
+	for (uint32_t v : mesh.faces)
+	{
+		if (v >= mesh.vertices.size())
+			meshError(filename, "face index out of range");
+	}
+}
+
+//
+// glb (binary glTF 2.0)
+//
+
+uint32_t readU32(const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+// a typed view of the binary chunk
+struct GltfAccessor {
+	const char* data;
+	size_t count, stride;
+	int componentType, components;
+
+	double get(size_t i, int c) const
+	{
+		const char* p = data + i * stride;
+		switch (componentType)
+		{
+		case 5120: return ((const int8_t*)p)[c];
+		case 5121: return ((const uint8_t*)p)[c];
+		case 5122: { int16_t v; memcpy(&v, p + 2 * c, 2); return v; }
+		case 5123: { uint16_t v; memcpy(&v, p + 2 * c, 2); return v; }
+		case 5125: { uint32_t v; memcpy(&v, p + 4 * c, 4); return v; }
+		default: { float v; memcpy(&v, p + 4 * c, 4); return v; }
+		}
+	}
+};
+
+class GlbReader {
+public:
+	GlbReader(const string& filename, const Json& doc, const char* bin, size_t binSize, MeshData& mesh)
+		: filename(filename), doc(doc), bin(bin), binSize(binSize), mesh(mesh) {}
+
+	void read()
+	{
+		mesh.vertices.clear();
+		mesh.normals.clear();
+		mesh.faces.clear();
+		allNormals = true;
+
+		if (doc.count("scenes") && !doc["scenes"].empty())
+		{
+			size_t scene = doc.value("scene", 0);
+			const Json& roots = doc["scenes"].at(scene)["nodes"];
+			for (const Json& node : roots)
+				addNode(node.get<size_t>(), glm::dmat4x4(1.0), 0);
+		}
+		else if (doc.count("meshes"))
+		{
+			for (size_t m = 0; m < doc["meshes"].size(); m++)
+				addMesh(m, glm::dmat4x4(1.0));
+		}
+
+		if (!allNormals)
+			mesh.normals.clear();
+	}
+
+private:
+	const string& filename;
+	const Json& doc;
+	const char* bin;
+	size_t binSize;
+	MeshData& mesh;
+	bool allNormals;
+
+	void addNode(size_t index, const glm::dmat4x4& parent, size_t depth)
+	{
+		const Json& nodes = doc["nodes"];
+		if (depth > nodes.size())
+			meshError(filename, "node hierarchy has a cycle");
+		const Json& node = nodes.at(index);
+		glm::dmat4x4 xform = parent * localTransform(node);
+		if (node.count("mesh"))
+			addMesh(node["mesh"].get<size_t>(), xform);
+		if (node.count("children"))
+		{
+			for (const Json& child : node["children"])
+				addNode(child.get<size_t>(), xform, depth + 1);
+		}
+	}
+
+	static glm::dmat4x4 localTransform(const Json& node)
+	{
+		glm::dmat4x4 m(1.0);
+		if (node.count("matrix"))
+		{
+			// column major, as glm
+			for (int k = 0; k < 16; k++)
+				m[k / 4][k % 4] = node["matrix"][k].get<double>();
+			return m;
+		}
+		glm::dvec3 t(0.0), s(1.0);
+		double q[4] = { 0.0, 0.0, 0.0, 1.0 };
+		for (int k = 0; k < 3 && node.count("translation"); k++)
+			t[k] = node["translation"][k].get<double>();
+		for (int k = 0; k < 3 && node.count("scale"); k++)
+			s[k] = node["scale"][k].get<double>();
+		for (int k = 0; k < 4 && node.count("rotation"); k++)
+			q[k] = node["rotation"][k].get<double>();
+
+		// T * R * S
+		double x = q[0], y = q[1], z = q[2], w = q[3];
+		glm::dmat3x3 r;
+		r[0] = glm::dvec3(1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w));
+		r[1] = glm::dvec3(2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w));
+		r[2] = glm::dvec3(2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y));
+		for (int c = 0; c < 3; c++)
+		{
+			for (int k = 0; k < 3; k++)
+				m[c][k] = r[c][k] * s[c];
+		}
+		m[3] = glm::dvec4(t[0], t[1], t[2], 1.0);
+		return m;
+	}
+
+	GltfAccessor accessor(size_t index)
+	{
+		const Json& acc = doc["accessors"].at(index);
+		if (acc.count("sparse") || !acc.count("bufferView"))
+			meshError(filename, "sparse accessors aren't supported");
+		const Json& view = doc["bufferViews"].at(acc["bufferView"].get<size_t>());
+		if (view.value("buffer", 0) != 0 || doc["buffers"].at(0).count("uri"))
+			meshError(filename, "only the embedded buffer is supported");
+
+		GltfAccessor a;
+		a.componentType = acc["componentType"].get<int>();
+		a.count = acc["count"].get<size_t>();
+		string type = acc["type"].get<string>();
+		a.components = type == "SCALAR" ? 1 : type == "VEC2" ? 2 : type == "VEC3" ? 3 : type == "VEC4" ? 4 : 0;
+		int size = a.componentType == 5120 || a.componentType == 5121 ? 1 :
+		           a.componentType == 5122 || a.componentType == 5123 ? 2 :
+		           a.componentType == 5125 || a.componentType == 5126 ? 4 : 0;
+		if (!a.components || !size)
+			meshError(filename, "unsupported accessor type");
+
+		size_t viewOffset = view.value("byteOffset", (size_t)0);
+		size_t viewLength = view["byteLength"].get<size_t>();
+		size_t offset = acc.value("byteOffset", (size_t)0);
+		size_t element = (size_t)size * a.components;
+		a.stride = view.value("byteStride", element);
+		if (viewOffset > binSize || viewLength > binSize - viewOffset ||
+		    (a.count && (offset > viewLength || (a.count - 1) * a.stride + element > viewLength - offset)))
+			meshError(filename, "accessor is outside the buffer");
+		a.data = bin + viewOffset + offset;
+		return a;
+	}
+
+	void addMesh(size_t index, const glm::dmat4x4& xform)
+	{
+		glm::dmat3x3 normalXform = glm::transpose(glm::inverse(glm::dmat3x3(xform)));
+		for (const Json& prim : doc["meshes"].at(index)["primitives"])
+		{
+			// only triangle lists
+			if (prim.value("mode", 4) != 4)
+				continue;
+			const Json& attributes = prim["attributes"];
+			if (!attributes.count("POSITION"))
+				continue;
+
+			GltfAccessor positions = accessor(attributes["POSITION"].get<size_t>());
+			if (positions.components < 3)
+				meshError(filename, "positions aren't 3d");
+			size_t base = mesh.vertices.size();
+			if (base + positions.count >= UINT32_MAX)
+				meshError(filename, "too many vertices");
+			mesh.vertices.resize(base + positions.count);
+			for (size_t i = 0; i < positions.count; i++)
+			{
+				glm::dvec4 p(positions.get(i, 0), positions.get(i, 1), positions.get(i, 2), 1.0);
+				glm::dvec4 w = xform * p;
+				mesh.vertices[base + i] = glm::dvec3(w[0], w[1], w[2]);
+			}
+
+			if (attributes.count("NORMAL") && allNormals)
+			{
+				GltfAccessor normals = accessor(attributes["NORMAL"].get<size_t>());
+				if (normals.count != positions.count || normals.components < 3)
+					meshError(filename, "bad normals");
+				mesh.normals.resize(base + normals.count);
+				for (size_t i = 0; i < normals.count; i++)
+				{
+					glm::dvec3 n(normals.get(i, 0), normals.get(i, 1), normals.get(i, 2));
+					n = normalXform * n;
+					double len = glm::length(n);
+					mesh.normals[base + i] = len > 0.0 ? n / len : n;
+				}
+			}
+			else
+				allNormals = false;
+
+			if (prim.count("indices"))
+			{
+				GltfAccessor indices = accessor(prim["indices"].get<size_t>());
+				size_t first = mesh.faces.size();
+				mesh.faces.resize(first + indices.count / 3 * 3);
+				for (size_t i = 0; i < indices.count / 3 * 3; i++)
+				{
+					double v = indices.get(i, 0);
+					if (v >= positions.count)
+						meshError(filename, "face index out of range");
+					mesh.faces[first + i] = (uint32_t)(base + (size_t)v);
+				}
+			}
+			else
+			{
+				for (size_t i = 0; i + 2 < positions.count; i += 3)
+				{
+					mesh.faces.push_back((uint32_t)(base + i));
+					mesh.faces.push_back((uint32_t)(base + i + 1));
+					mesh.faces.push_back((uint32_t)(base + i + 2));
+				}
+			}
+		}
+	}
+};
+
+void readGlb(const string& filename, const char* data, size_t size, MeshData& mesh)
+{
+	if (size < 20 || memcmp(data, "glTF", 4) != 0)
+		meshError(filename, "not a binary glTF file");
+	if (readU32(data + 4) != 2)
+		meshError(filename, "only glTF 2.0 is supported");
+
+	// a JSON chunk, then the binary chunk
+	const char* json = nullptr;
+	const char* bin = nullptr;
+	size_t jsonSize = 0, binSize = 0;
+	for (size_t pos = 12; pos + 8 <= size;)
+	{
+		size_t length = readU32(data + pos);
+		uint32_t type = readU32(data + pos + 4);
+		if (length > size - pos - 8)
+			meshError(filename, "file is truncated");
+		if (type == 0x4E4F534A && !json)
+		{
+			json = data + pos + 8;
+			jsonSize = length;
+		}
+		else if (type == 0x004E4942 && !bin)
+		{
+			bin = data + pos + 8;
+			binSize = length;
+		}
+		pos += 8 + ((length + 3) & ~(size_t)3);
+	}
+	if (!json)
+		meshError(filename, "no JSON chunk");
+
+	try {
+		Json doc = Json::parse(json, json + jsonSize);
+		GlbReader(filename, doc, bin, binSize, mesh).read();
+	}
+	catch (std::exception& e) {
+		meshError(filename, e.what());
+	}
+}
+
+} // anonymous namespace
+
+void readMesh(const string& filename, MeshData& mesh, int threads)
+{
+	MappedFile file;
+	if (!file.open(filename))
+		meshError(filename, "can't read it");
+
+	if (hasExtension(filename, ".obj"))
+		readObj(filename, file.data(), file.size(), mesh, threads);
+	else if (hasExtension(filename, ".ply"))
+		readPly(filename, file.data(), file.size(), mesh);
+	else if (hasExtension(filename, ".glb"))
+		readGlb(filename, file.data(), file.size(), mesh);
+	else
+		meshError(filename, "unknown format, use .obj, .ply or .glb");
+}
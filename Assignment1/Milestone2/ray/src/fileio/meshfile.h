@@ -0,0 +1,40 @@
+//
+// meshfile.h
+//
+// triangle meshes read from OBJ, PLY and binary glTF files
+//
+
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+/*
+ * The file is mapped and read straight into these arrays, which are sized
+ * once from the file's own counts (PLY, glb) or per parsing thread (OBJ);
+ * no memory is allocated per vertex or face.  Polygons are split into
+ * triangle fans.
+ */
+struct MeshData {
+	std::vector<glm::dvec3> vertices;
+	std::vector<glm::dvec3> normals;	// one per vertex, or none
+	std::vector<uint32_t> faces;		// three vertex indices per triangle
+};
+
+/*
+ * Reads .obj, .ply (binary or ascii) or .glb by extension and throws
+ * ParserException if it can't.  OBJ files are split into pieces that up
+ * to threads threads parse at once.
+ *
+ * OBJ normals are kept only if every corner of a vertex names the same
+ * normal (otherwise the mesh is flat shaded, or use gennormals).  glb
+ * meshes are put together from every triangle primitive in the default
+ * scene, moved by their node transforms.
+ */
+void readMesh(const std::string& filename, MeshData& mesh, int threads);
+
+#endif
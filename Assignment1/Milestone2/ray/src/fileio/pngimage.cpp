@@ -3,6 +3,10 @@
 #include <png.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <vector>
 #include <string>
 
@@ -216,71 +220,276 @@ std::vector<uint8_t> readPNG(const char *fname, int& width, int& height)
 	return data;
 }
 
-/*
- * Copyright 2002-2010 Guillaume Cottenceau.
- *
- * This software may be freely redistributed under the terms
- * of the X11 license.
- *
- */
+namespace {
 
-void writePNG(const char *fname, int width, int height, const void *data)
+int png_level = 6;
+int png_threads = 1;
+
+// a band is only split into pieces of at least this many rows
+const int MIN_PIECE_ROWS = 16;
+// deflate looks back this far, pieces are primed with as much
+const size_t WINDOW_SIZE = 32768;
+
+void put32(unsigned char* p, unsigned long v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+inline int paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+// Filter one RGB row into out (filter byte + row), trying all five
+// filters and keeping the one with the smallest sum of absolute values,
+// the same heuristic libpng uses.  prev is null for the top row.
+void filterRow(const unsigned char* row, const unsigned char* prev, int bytes,
+               unsigned char* out, std::vector<unsigned char>& scratch)
+{
+	const int bpp = 3;
+	scratch.resize(5 * bytes);
+	unsigned long best_sum = ~0UL;
+	int best = 0;
+	for (int f = 0; f < 5; f++)
+	{
+		unsigned char* dst = &scratch[f * bytes];
+		for (int i = 0; i < bytes; i++)
+		{
+			int a = i >= bpp ? row[i - bpp] : 0;
+			int b = prev ? prev[i] : 0;
+			int c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+			int pred;
+			if (f == 0)
+				pred = 0;
+			else if (f == 1)
+				pred = a;
+			else if (f == 2)
+				pred = b;
+			else if (f == 3)
+				pred = (a + b) / 2;
+			else
+				pred = paeth(a, b, c);
+			dst[i] = (unsigned char)(row[i] - pred);
+		}
+
+		unsigned long sum = 0;
+		for (int i = 0; i < bytes; i++)
+			sum += dst[i] < 128 ? dst[i] : 256 - dst[i];
+		if (sum < best_sum)
+		{
+			best_sum = sum;
+			best = f;
+		}
+	}
+	out[0] = (unsigned char)best;
+	memcpy(out + 1, &scratch[best * bytes], bytes);
+}
+
+// run job(0..n-1) on up to `threads` threads, the caller included
+template <typename Job>
+void parallelFor(int n, int threads, Job job)
 {
-	constexpr png_byte color_type = PNG_COLOR_TYPE_RGB;
-	constexpr png_byte bit_depth = 8;
-
-	png_structp png_ptr;
-	png_infop info_ptr;
-	int number_of_passes;
-	/* create file */
-	FILE *fp = fopen(fname, "wb");
+	int workers = std::max(1, std::min(threads, n));
+	std::atomic<int> next(0);
+	auto loop = [&]() {
+		for (int k = next++; k < n; k = next++)
+			job(k);
+	};
+	std::vector<std::thread> pool;
+	for (int t = 1; t < workers; t++)
+		pool.emplace_back(loop);
+	loop();
+	for (auto& t : pool)
+		t.join();
+}
+
+// one piece of a band: its filtered rows and their deflate stream
+struct Piece {
+	int first, count;
+	std::vector<unsigned char> filtered;
+	std::vector<unsigned char> out;
+	unsigned long adler;
+};
+
+} // anonymous namespace
+
+void setPNGCompression(int level, int threads)
+{
+	png_level = std::max(0, std::min(level, 9));
+	png_threads = std::max(threads, 1);
+}
+
+void getPNGCompression(int& level, int& threads)
+{
+	level = png_level;
+	threads = png_threads;
+}
+
+PNGWriter::PNGWriter(const char* fname, int width, int height, int level, int threads)
+	: width(width), height(height), level(level), threads(std::max(threads, 1)), rows_done(0), adler(adler32(0L, Z_NULL, 0))
+{
+	fp = fopen(fname, "wb");
 	if (!fp)
 		throw string("[write_png_file] File could not be opened for writing: ") + fname;
 
-	/* initialize stuff */
-	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+	fwrite(signature, 1, 8, fp);
 
-	if (!png_ptr)
-		throw string("[write_png_file] png_create_write_struct failed");
+	unsigned char ihdr[13];
+	put32(ihdr, width);
+	put32(ihdr + 4, height);
+	ihdr[8] = 8;	// bit depth
+	ihdr[9] = 2;	// rgb
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;	// deflate, adaptive filtering, no interlace
+	writeChunk("IHDR", ihdr, sizeof(ihdr));
+}
 
-	info_ptr = png_create_info_struct(png_ptr);
-	if (!info_ptr)
-		throw string("[write_png_file] png_create_info_struct failed");
+PNGWriter::~PNGWriter()
+{
+	if (fp)
+		fclose(fp);
+}
 
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw string("[write_png_file] Error during init_io");
+void PNGWriter::writeChunk(const char* type, const unsigned char* data, size_t size)
+{
+	unsigned char head[8];
+	put32(head, (unsigned long)size);
+	memcpy(head + 4, type, 4);
+	unsigned long crc = crc32(0L, head + 4, 4);
+	if (size > 0)
+		crc = crc32(crc, data, (uInt)size);
+	unsigned char tail[4];
+	put32(tail, crc);
+	fwrite(head, 1, 8, fp);
+	fwrite(data, 1, size, fp);
+	fwrite(tail, 1, 4, fp);
+}
 
-	png_init_io(png_ptr, fp);
+void PNGWriter::writeRows(const unsigned char* const* rows, int count)
+{
+	if (!fp || count <= 0)
+		return;
+	if (rows_done + count > height)
+		throw string("[write_png_file] More rows than the image has");
 
-	/* write header */
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw string("[write_png_file] Error during writing header");
+	const int bytes = width * 3;
+	bool last_band = rows_done + count == height;
+	int pieces = std::max(1, std::min(threads, count / MIN_PIECE_ROWS));
 
-	png_set_IHDR(png_ptr, info_ptr, width, height,
-			bit_depth, color_type, PNG_INTERLACE_NONE,
-			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	std::vector<Piece> band(pieces);
+	for (int k = 0; k < pieces; k++)
+	{
+		band[k].first = (int)((long long)count * k / pieces);
+		band[k].count = (int)((long long)count * (k + 1) / pieces) - band[k].first;
+	}
 
-	std::vector<png_bytep> row_pointers(height);
-	for (int i = 0; i < height; i++)
-		row_pointers[height - i - 1] = (unsigned char*)data + i * width * 3;
+	// filter every piece, each only needs the raw row above it
+	parallelFor(pieces, threads, [&](int k)
+	{
+		Piece& p = band[k];
+		std::vector<unsigned char> scratch;
+		p.filtered.resize((size_t)p.count * (bytes + 1));
+		for (int r = 0; r < p.count; r++)
+		{
+			int row = p.first + r;
+			const unsigned char* above = row > 0 ? rows[row - 1] : (prev.empty() ? nullptr : prev.data());
+			filterRow(rows[row], above, bytes, &p.filtered[(size_t)r * (bytes + 1)], scratch);
+		}
+	});
 
-#if 1
-	png_set_rows(png_ptr, info_ptr, row_pointers.data());
-	png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
-#else
-	png_write_info(png_ptr, info_ptr);
-	/* write bytes */
-	if (setjmp(png_jmpbuf(png_ptr)))
-		abort_("[write_png_file] Error during writing bytes");
-	png_write_image(png_ptr, row_pointers);
-#endif
+	// deflate every piece as its own raw stream, ending on a byte boundary
+	// (a sync flush) so the streams can simply be concatenated
+	parallelFor(pieces, threads, [&](int k)
+	{
+		Piece& p = band[k];
+		bool final_piece = last_band && k == pieces - 1;
+
+		// prime with the 32K of filtered data that precedes the piece
+		std::vector<unsigned char> dict;
+		for (int j = k - 1; j >= -1 && dict.size() < WINDOW_SIZE; j--)
+		{
+			const std::vector<unsigned char>& src = j >= 0 ? band[j].filtered : window;
+			size_t take = std::min(src.size(), WINDOW_SIZE - dict.size());
+			dict.insert(dict.begin(), src.end() - take, src.end());
+		}
 
-	/* end write */
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw string("[write_png_file] Error during end of write");
+		z_stream zs = {};
+		deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+		if (!dict.empty())
+			deflateSetDictionary(&zs, dict.data(), (uInt)dict.size());
+		p.out.resize(deflateBound(&zs, (uLong)p.filtered.size()) + 64);
+		zs.next_in = p.filtered.data();
+		zs.avail_in = (uInt)p.filtered.size();
+		zs.next_out = p.out.data();
+		zs.avail_out = (uInt)p.out.size();
+		deflate(&zs, final_piece ? Z_FINISH : Z_SYNC_FLUSH);
+		p.out.resize(zs.total_out);
+		deflateEnd(&zs);
+
+		p.adler = adler32(adler32(0L, Z_NULL, 0), p.filtered.data(), (uInt)p.filtered.size());
+	});
+
+	for (int k = 0; k < pieces; k++)
+	{
+		Piece& p = band[k];
+		adler = adler32_combine(adler, p.adler, (z_off_t)p.filtered.size());
+
+		// the zlib header goes in front of the first stream, the checksum
+		// of everything after the last one
+		if (rows_done == 0 && k == 0)
+		{
+			unsigned char flevel = level < 2 ? 0x01 : level < 6 ? 0x5e : level == 6 ? 0x9c : 0xda;
+			unsigned char header[2] = { 0x78, flevel };
+			p.out.insert(p.out.begin(), header, header + 2);
+		}
+		if (last_band && k == pieces - 1)
+		{
+			unsigned char sum[4];
+			put32(sum, adler);
+			p.out.insert(p.out.end(), sum, sum + 4);
+		}
+		if (!p.out.empty())
+			writeChunk("IDAT", p.out.data(), p.out.size());
+	}
 
-	png_write_end(png_ptr, NULL);
+	// keep what the next band needs
+	prev.assign(rows[count - 1], rows[count - 1] + bytes);
+	for (auto& p : band)
+		window.insert(window.end(), p.filtered.begin(), p.filtered.end());
+	if (window.size() > WINDOW_SIZE)
+		window.erase(window.begin(), window.end() - WINDOW_SIZE);
+	rows_done += count;
+}
 
+void PNGWriter::finish()
+{
+	if (!fp)
+		return;
+	if (rows_done != height)
+		throw string("[write_png_file] Image ended before its last row");
+	writeChunk("IEND", nullptr, 0);
+	bool failed = ferror(fp) != 0;
 	fclose(fp);
-	png_destroy_write_struct(&png_ptr, &info_ptr);
+	fp = nullptr;
+	if (failed)
+		throw string("[write_png_file] Error during writing bytes");
+}
+
+void writePNG(const char *fname, int width, int height, const void *data)
+{
+	// the frame buffer starts with the bottom row
+	std::vector<const unsigned char*> rows(height);
+	for (int i = 0; i < height; i++)
+		rows[height - i - 1] = (const unsigned char*)data + i * width * 3;
+
+	PNGWriter writer(fname, width, height, png_level, png_threads);
+	writer.writeRows(rows.data(), height);
+	writer.finish();
 }
@@ -1,6 +1,7 @@
 #ifndef FILEIO_PNGIMAGE_H
 #define FILEIO_PNGIMAGE_H
 
+#include <stdio.h>
 #include <vector>
 #include <stdint.h>
 
@@ -9,4 +10,40 @@ void png_version_info(void);
 std::vector<uint8_t> readPNG(const char *fname, int& width, int& height);
 void writePNG(const char *iname, int width, int height, const void* data); 
 
+// settings used by writePNG: zlib level (0-9) and how many threads
+// compress an image
+void setPNGCompression(int level, int threads);
+void getPNGCompression(int& level, int& threads);
+
+/*
+ * Writes an 8 bit RGB PNG a band of rows at a time, top row first.
+ * Each band is cut into pieces that are filtered and deflated on their
+ * own threads as independent deflate streams (primed with the 32K that
+ * precede them, so compression barely suffers), then stitched into the
+ * file's single zlib stream.  Only the last row of the previous band is
+ * kept between bands.  Errors are thrown as strings.
+ */
+class PNGWriter {
+public:
+	PNGWriter(const char* fname, int width, int height, int level, int threads);
+	~PNGWriter();
+
+	// rows[0..count) are consecutive image rows, top row first
+	void writeRows(const unsigned char* const* rows, int count);
+
+	// after the last row: write the end of the file and close it
+	void finish();
+
+private:
+	void writeChunk(const char* type, const unsigned char* data, size_t size);
+
+	FILE* fp;
+	int width, height;
+	int level, threads;
+	int rows_done;
+	unsigned long adler;				// of all the (filtered) image data so far
+	std::vector<unsigned char> prev;	// last row of the previous band
+	std::vector<unsigned char> window;	// last 32K of filtered data, primes the next band
+};
+
 #endif
@@ -10,7 +10,6 @@ using namespace std;
 RayTracer* theRayTracer;
 TraceUI* traceUI;
 int TraceUI::m_threads = max(std::thread::hardware_concurrency(), (unsigned)1);
-int TraceUI::rayCount[MAX_THREADS];
 
 // usage : ray [option] in.ray out.bmp
 // Simply keying in ray will invoke a graphics mode version.
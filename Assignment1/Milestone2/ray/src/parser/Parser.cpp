@@ -10,6 +10,7 @@
 #include "../scene/scene.h"
 #include "../scene/material.h"
 #include "../ui/TraceUI.h"
+#include "../fileio/meshfile.h"
 #include <glm/mat4x4.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
@@ -28,17 +29,20 @@ Scene* Parser::parseScene()
 {
   _tokenizer.Read(SBT_RAYTRACER);
 
-  unique_ptr<Token> versionNumber( _tokenizer.Read(SCALAR) );
+  Token versionNumber = _tokenizer.Read(SCALAR);
 
-  if( versionNumber->value() > 1.1 )
+  if( versionNumber.value() > 1.1 )
   {
     ostringstream ost;
-    ost << "SBT-raytracer version number " << versionNumber->value() << 
+    ost << "SBT-raytracer version number " << versionNumber.value() << 
       " too high; only able to parse v1.1 and below.";
     throw ParserException( ost.str() );
   }
 
-  Scene* scene = new Scene;
+  // owned here until it is complete, so a syntax error doesn't leave
+  // its background loading running in a leaked scene
+  unique_ptr<Scene> owner( new Scene );
+  Scene* scene = owner.get();
   unique_ptr<Material> mat( new Material );
 
   for( ;; )
@@ -53,6 +57,7 @@ Scene* Parser::parseScene()
       case CYLINDER:
       case CONE:
       case TRIMESH:
+      case MESH:
       case TRANSLATE:
       case ROTATE:
       case SCALE:
@@ -83,7 +88,7 @@ Scene* Parser::parseScene()
          break;
       case EOFSYM:
          std::cout << "finished parsing..." << std::endl;
-         return scene;
+         return owner.release();
       default:
          throw SyntaxErrorException( "Expected: geometry, camera, or light information", _tokenizer );
     }
@@ -166,6 +171,7 @@ void Parser::parseTransformableElement( Scene* scene, TransformNode* transform,
       case CYLINDER:
       case CONE:
       case TRIMESH:
+      case MESH:
       case TRANSLATE:
       case ROTATE:
       case SCALE:
@@ -196,6 +202,7 @@ void Parser::parseGroup(Scene* scene, TransformNode* transform, const Material&
       case CYLINDER:
       case CONE:
       case TRIMESH:
+      case MESH:
       case TRANSLATE:
       case ROTATE:
       case SCALE:
@@ -241,6 +248,9 @@ void Parser::parseGeometry(Scene* scene, TransformNode* transform, const Materia
     case TRIMESH:
       parseTrimesh(scene, transform, mat);
       return;
+    case MESH:
+      parseMesh(scene, transform, mat);
+      return;
     case TRANSLATE:
       parseTranslate(scene, transform, mat);
       return;
@@ -561,9 +571,8 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
   _tokenizer.Read( LBRACE );
 
   bool generateNormals( false );
-  list<glm::dvec3> faces;
+  std::vector<glm::dvec3> faces;
 
-  const char* error;
   for( ;; )
   {
     const Token* t = _tokenizer.Peek();
@@ -670,51 +679,120 @@ void Parser::parseTrimesh(Scene* scene, TransformNode* transform, const Material
       {
         _tokenizer.Read( RBRACE );
 
-        // Now add all the faces into the trimesh, since hopefully
-        // the vertices have been parsed out
-        for( list<glm::dvec3>::const_iterator vitr = faces.begin(); vitr != faces.end(); vitr++ )
+        // The faces, normals and face bounds are built in the background
+        // while parsing goes on; errors come out of scene->finishLoading()
+        scene->add( tmesh );
+        scene->add_mesh( tmesh, [tmesh, faces, generateNormals]()
         {
-          if( !tmesh->addFace( (*vitr)[0], (*vitr)[1], (*vitr)[2] ) )
+          // Now add all the faces into the trimesh, since hopefully
+          // the vertices have been parsed out
+          for( std::vector<glm::dvec3>::const_iterator vitr = faces.begin(); vitr != faces.end(); vitr++ )
           {
-            ostringstream oss;
-            oss << "Bad face in trimesh: (" << (*vitr)[0] << ", " << (*vitr)[1] << 
-              ", " << (*vitr)[2] << ")";
-            throw ParserException( oss.str() );
+            if( !tmesh->addFace( (*vitr)[0], (*vitr)[1], (*vitr)[2] ) )
+            {
+              ostringstream oss;
+              oss << "Bad face in trimesh: (" << (*vitr)[0] << ", " << (*vitr)[1] << 
+                ", " << (*vitr)[2] << ")";
+              throw ParserException( oss.str() );
+            }
           }
-        }
 
-        if( generateNormals )
-          tmesh->generateNormals();
+          if( generateNormals )
+            tmesh->generateNormals();
 
+          const char* error;
+          if ((error = tmesh->doubleCheck()))
+            throw ParserException(error);
+        });
+        return;
+      }
 
-        if ((error = tmesh->doubleCheck()))
-          throw ParserException(error);
+      default:
+        throw SyntaxErrorException( "Expected: trimesh attributes", _tokenizer );
+    }
+  }
+}
 
-        // add each trimesh face to bvh list
-        for (auto face : tmesh->get_faces())
-        {
-            scene->add_bvh(face, "trimesh face"); // add to bvh list
-        }
+// mesh { file = "model.ply"; } reads a trimesh from an OBJ, PLY or glb
+// file (see meshfile.h) instead of from the scene text
+void Parser::parseMesh(Scene* scene, TransformNode* transform, const Material& mat)
+{
+  unique_ptr<Material> newMat;
+  string filename;
+  bool generateNormals( false );
+
+  _tokenizer.Read( MESH );
+  _tokenizer.Read( LBRACE );
+
+  for( ;; )
+  {
+    const Token* t = _tokenizer.Peek();
+
+    switch( t->kind() )
+    {
+      case FILENAME:
+        filename = parseIdentExpression();
+        break;
+
+      case GENNORMALS:
+        _tokenizer.Read( GENNORMALS );
+        _tokenizer.Read( SEMICOLON );
+        generateNormals = true;
+        break;
+
+      case MATERIAL:
+        newMat.reset( parseMaterialExpression( scene, mat ) );
+        break;
+
+      case NAME:
+        parseIdentExpression();
+        break;
+
+      case RBRACE:
+      {
+        if( filename.empty() )
+          throw SyntaxErrorException( "Expected: file = \"name\"", _tokenizer );
+        _tokenizer.Read( RBRACE );
+
+        if( filename[0] != '/' && filename[0] != '\\' )
+          filename = _basePath + "/" + filename;
+        MeshData data;
+        readMesh( filename, data, traceUI ? traceUI->getThreads() : 1 );
+
+        Trimesh* tmesh = new Trimesh( scene, newMat ? newMat.release() : new Material(mat), transform );
+        tmesh->vertNorms = !data.normals.empty();
+        tmesh->setVertexData( std::move( data.vertices ), std::move( data.normals ) );
         scene->add( tmesh );
+
+        // the faces are built in the background like a trimesh's
+        auto faces = std::make_shared<std::vector<uint32_t>>( std::move( data.faces ) );
+        scene->add_mesh( tmesh, [tmesh, faces, generateNormals]()
+        {
+          for( size_t f = 0; f + 2 < faces->size(); f += 3 )
+            tmesh->addFace( (*faces)[f], (*faces)[f + 1], (*faces)[f + 2] );
+          if( generateNormals )
+            tmesh->generateNormals();
+        });
         return;
       }
 
       default:
-        throw SyntaxErrorException( "Expected: trimesh attributes", _tokenizer );
+        throw SyntaxErrorException( "Expected: mesh attributes", _tokenizer );
     }
   }
 }
 
-void Parser::parseFaces( list< glm::dvec3 >& faces )
+void Parser::parseFaces( std::vector< glm::dvec3 >& faces )
 {
-  list< double > points = parseScalarList();
+  std::vector< double >& points = _scalars;
+  parseScalarList( points );
 
   // triangulate here and now.  assume the poly is
   // concave (convex?) and we can triangulate using an arbitrary fan
   if( points.size() < 3 )
      throw SyntaxErrorException( "Faces must have at least 3 vertices.", _tokenizer );
 
-  list<double>::const_iterator i = points.begin();
+  std::vector<double>::const_iterator i = points.begin();
   double a = (*i++);
   double b = (*i++);
   while( i != points.end() )
@@ -907,22 +985,22 @@ string Parser::parseIdentExpression()
 
 double Parser::parseScalar()
 {
-  unique_ptr<Token> scalar( _tokenizer.Read( SCALAR ) );
+  Token scalar = _tokenizer.Read( SCALAR );
 
-  return scalar->value();
+  return scalar.value();
 }
 
 string Parser::parseIdent()
 {
-  unique_ptr<Token> scalar( _tokenizer.Read( IDENT ) );
+  Token scalar = _tokenizer.Read( IDENT );
 
-  return scalar->ident();
+  return scalar.ident();
 }
 
 
-list<double> Parser::parseScalarList()
+void Parser::parseScalarList( std::vector<double>& ret )
 {
-  list<double> ret;
+  ret.clear();
 
   _tokenizer.Read( LPAREN );
   if( RPAREN != _tokenizer.Peek()->kind() )
@@ -938,9 +1016,6 @@ list<double> Parser::parseScalarList()
     }
   }
   _tokenizer.Read( RPAREN );
-
-  return ret;
-
 }
 
 bool Parser::parseBoolean()
@@ -962,34 +1037,34 @@ bool Parser::parseBoolean()
 glm::dvec3 Parser::parseVec3d()
 {
   _tokenizer.Read( LPAREN );
-  unique_ptr<Token> value1( _tokenizer.Read( SCALAR ) );
+  Token value1 = _tokenizer.Read( SCALAR );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value2( _tokenizer.Read( SCALAR ) );
+  Token value2 = _tokenizer.Read( SCALAR );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value3( _tokenizer.Read( SCALAR ) );
+  Token value3 = _tokenizer.Read( SCALAR );
   _tokenizer.Read( RPAREN );
 
-  return glm::dvec3( value1->value(), 
-    value2->value(), 
-    value3->value() );
+  return glm::dvec3( value1.value(), 
+    value2.value(), 
+    value3.value() );
 }
 
 glm::dvec4 Parser::parseVec4d()
 {
   _tokenizer.Read( LPAREN );
-  unique_ptr<Token> value1( _tokenizer.Read( SCALAR ) );
+  Token value1 = _tokenizer.Read( SCALAR );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value2( _tokenizer.Read( SCALAR ) );
+  Token value2 = _tokenizer.Read( SCALAR );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value3( _tokenizer.Read( SCALAR ) );
+  Token value3 = _tokenizer.Read( SCALAR );
   _tokenizer.Read( COMMA );
-  unique_ptr<Token> value4( _tokenizer.Read( SCALAR ) );
+  Token value4 = _tokenizer.Read( SCALAR );
   _tokenizer.Read( RPAREN );
 
-  return glm::dvec4( value1->value(), 
-    value2->value(), 
-    value3->value(),
-    value4->value() );
+  return glm::dvec4( value1.value(), 
+    value2.value(), 
+    value3.value(),
+    value4.value() );
 }
 
 Material* Parser::parseMaterial( Scene* scene, const Material& parent )
@@ -1056,7 +1131,7 @@ Material* Parser::parseMaterial( Scene* scene, const Material& parent )
 
       case NAME:
          _tokenizer.Read(NAME);
-         name = (_tokenizer.Read(IDENT))->ident();
+         name = _tokenizer.Read(IDENT).ident();
          _tokenizer.Read( SEMICOLON );
          break;
 
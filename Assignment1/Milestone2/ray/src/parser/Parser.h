@@ -6,6 +6,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 #include "ParserException.h"
 #include "Tokenizer.h"
@@ -71,7 +72,8 @@ private:
     void      parseCylinder(Scene* scene, TransformNode* transform, const Material& mat);
     void      parseCone(Scene* scene, TransformNode* transform, const Material& mat);
     void      parseTrimesh(Scene* scene, TransformNode* transform, const Material& mat);
-    void      parseFaces( std::list< glm::dvec3 >& faces );
+    void      parseMesh(Scene* scene, TransformNode* transform, const Material& mat);
+    void      parseFaces( std::vector< glm::dvec3 >& faces );
 
     // Parse transforms
     void parseTranslate(Scene* scene, TransformNode* transform, const Material& mat);
@@ -95,7 +97,7 @@ private:
     // Helper functions for parsing things like vectors
     // and idents.
     double parseScalar();
-    std::list<double> parseScalarList();
+    void parseScalarList( std::vector<double>& ret );
     glm::dvec3 parseVec3d();
     glm::dvec4 parseVec4d();
     bool parseBoolean();
@@ -106,6 +108,7 @@ private:
     Tokenizer& _tokenizer;
     mmap materials;
     std::string _basePath;
+    std::vector<double> _scalars;   // parseFaces' scratch list
 };
 
 #endif
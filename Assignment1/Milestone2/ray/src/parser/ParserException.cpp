@@ -8,7 +8,7 @@
 
 
 SyntaxErrorException::SyntaxErrorException( const string& msg, const Tokenizer& tokenizer )
-	: ParserException( msg )
+	: ParserException( msg ), _line( tokenizer.CurLine() ), _column( tokenizer.CurColumn() )
 {
   std::ostringstream out;
   tokenizer.PrintLine( out );
@@ -18,7 +18,7 @@ SyntaxErrorException::SyntaxErrorException( const string& msg, const Tokenizer&
   }
   out << "^" << std::endl;
 
-  out << "Line " << tokenizer.CurLine() << ": syntax error: "
+  out << "Line " << _line << ", column " << _column + 1 << ": syntax error: "
     << message() << std::endl;
 
   _formattedMsg = out.str();
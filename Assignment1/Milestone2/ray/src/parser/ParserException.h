@@ -48,8 +48,14 @@ class SyntaxErrorException
      SyntaxErrorException( const std::string& msg, const Tokenizer& tok );
      string formattedMessage( ) const { return _formattedMsg; }
 
+     // where the offending token starts (line from 1, column from 0)
+     int line( ) const { return _line; }
+     int column( ) const { return _column; }
+
   private:
      string _formattedMsg;
+     int _line;
+     int _column;
 };
 
 #endif
@@ -1,8 +1,10 @@
 #pragma warning (disable: 4786)
 
 #include <stdio.h>
+#include <string.h>
 #include "Token.h"
 
+#include <algorithm>
 #include <map>
 #include <sstream>
 
@@ -56,6 +58,8 @@ string getNameForToken( const SYMBOL kind )
     tokenNames[ CYLINDER ]          = "cylinder";
     tokenNames[ CONE ]              = "cone";
     tokenNames[ TRIMESH ]           = "trimesh";
+    tokenNames[ MESH ]              = "mesh";
+    tokenNames[ FILENAME ]          = "file";
     tokenNames[ POSITION ]          = "position";
     tokenNames[ VIEWDIR ]           = "viewdir";
     tokenNames[ UPDIR ]             = "updir";
@@ -102,86 +106,156 @@ string getNameForToken( const SYMBOL kind )
 /* This function is used by the parser to lookup 
    "reserved" words (i.e., things like "sphere", "cone",
    etc.).  What you will be concerned with is adding
-   entries to the reservedWords map as appropriate;
+   entries to the reservedWords list as appropriate;
    if you add a new reserved word to the parser, 
    simply add it to the list below.  I.e., if you had
    the reserved word "regular17gon" as your new primitive,
    for example, and the SYMBOL representing it was
    "SEVENTEENGON", you'd add the line
-      reservedWords["regular17gon"] = SEVENTEENGON;
+      { "regular17gon", SEVENTEENGON },
    to the list below.
+
+   The tokenizer looks up every identifier it scans, so
+   the list is turned into a perfect hash table: a seed
+   is searched for once that gives every word its own
+   slot, and a lookup is then one hash and at most one
+   compare.
 */
-SYMBOL lookupReservedWord(const string& ident) {
-  static std::map<string, SYMBOL> reservedWords;
+namespace {
 
-  if( reservedWords.empty() )
-  {
-    reservedWords["ambient_light"] = AMBIENT_LIGHT;
-    reservedWords["ambient"] = AMBIENT;
-    reservedWords["aspectratio"] = ASPECTRATIO;
-    reservedWords["bottom_radius"] = BOTTOM_RADIUS;
-    reservedWords["box"] = BOX;
-    reservedWords["camera"] = CAMERA;
-    reservedWords["capped"] = CAPPED;
-    reservedWords["color"] = COLOR;
-    reservedWords["colour"] = COLOR;
-    reservedWords["cone"] = CONE;
-    reservedWords["constant_attenuation_coeff"] = CONSTANT_ATTENUATION_COEFF;
-    reservedWords["cylinder"] = CYLINDER;
-    reservedWords["diffuse"] = DIFFUSE;
-    reservedWords["direction"] = DIRECTION;
-    reservedWords["directional_light"] = DIRECTIONAL_LIGHT;
-    reservedWords["emissive"] = EMISSIVE;
-    reservedWords["faces"] = FACES;
-    reservedWords["false"] = SYMFALSE;
-    reservedWords["fov"] = FOV;
-    reservedWords["gennormals"] = GENNORMALS;
-    reservedWords["height"] = HEIGHT;
-    reservedWords["index"] = INDEX;
-    reservedWords["linear_attenuation_coeff"] = LINEAR_ATTENUATION_COEFF;
-    reservedWords["material"] = MATERIAL;
-    reservedWords["materials"] = MATERIALS;
-    reservedWords["map"] = MAP;
-    reservedWords["name"] = NAME;
-    reservedWords["normal"] = NORMAL;
-    reservedWords["normals"] = NORMALS;
-    reservedWords["point_light"] = POINT_LIGHT;
-    reservedWords["points"] = POLYPOINTS;
-    reservedWords["polymesh"] = TRIMESH;
-    reservedWords["position"] = POSITION;
-    reservedWords["quadratic_attenuation_coeff"] = QUADRATIC_ATTENUATION_COEFF;
-    reservedWords["quaternian"] = QUATERNIAN;
-    reservedWords["reflective"] = REFLECTIVE;
-    reservedWords["rotate"] = ROTATE;
-    reservedWords["SBT-raytracer"] = SBT_RAYTRACER;
-    reservedWords["scale"] = SCALE;
-    reservedWords["shininess"] = SHININESS;
-    reservedWords["specular"] = SPECULAR;
-    reservedWords["sphere"] = SPHERE;
-    reservedWords["square"] = SQUARE;
-    reservedWords["top_radius"] = TOP_RADIUS;
-    reservedWords["transform"] = TRANSFORM;
-    reservedWords["translate"] = TRANSLATE;
-    reservedWords["transmissive"] = TRANSMISSIVE;
-    reservedWords["trimesh"] = TRIMESH;
-    reservedWords["true"] = SYMTRUE;
-    reservedWords["updir"] = UPDIR;
-    reservedWords["viewdir"] = VIEWDIR;
+struct ReservedWord {
+  const char* name;
+  SYMBOL symbol;
+};
+
+const ReservedWord reservedWords[] = {
+  { "ambient_light", AMBIENT_LIGHT },
+  { "ambient", AMBIENT },
+  { "aspectratio", ASPECTRATIO },
+  { "bottom_radius", BOTTOM_RADIUS },
+  { "box", BOX },
+  { "camera", CAMERA },
+  { "capped", CAPPED },
+  { "color", COLOR },
+  { "colour", COLOR },
+  { "cone", CONE },
+  { "constant_attenuation_coeff", CONSTANT_ATTENUATION_COEFF },
+  { "cylinder", CYLINDER },
+  { "diffuse", DIFFUSE },
+  { "direction", DIRECTION },
+  { "directional_light", DIRECTIONAL_LIGHT },
+  { "emissive", EMISSIVE },
+  { "faces", FACES },
+  { "false", SYMFALSE },
+  { "file", FILENAME },
+  { "fov", FOV },
+  { "gennormals", GENNORMALS },
+  { "height", HEIGHT },
+  { "index", INDEX },
+  { "linear_attenuation_coeff", LINEAR_ATTENUATION_COEFF },
+  { "material", MATERIAL },
+  { "materials", MATERIALS },
+  { "map", MAP },
+  { "mesh", MESH },
+  { "name", NAME },
+  { "normal", NORMAL },
+  { "normals", NORMALS },
+  { "point_light", POINT_LIGHT },
+  { "points", POLYPOINTS },
+  { "polymesh", TRIMESH },
+  { "position", POSITION },
+  { "quadratic_attenuation_coeff", QUADRATIC_ATTENUATION_COEFF },
+  { "quaternian", QUATERNIAN },
+  { "reflective", REFLECTIVE },
+  { "rotate", ROTATE },
+  { "SBT-raytracer", SBT_RAYTRACER },
+  { "scale", SCALE },
+  { "shininess", SHININESS },
+  { "specular", SPECULAR },
+  { "sphere", SPHERE },
+  { "square", SQUARE },
+  { "top_radius", TOP_RADIUS },
+  { "transform", TRANSFORM },
+  { "translate", TRANSLATE },
+  { "transmissive", TRANSMISSIVE },
+  { "trimesh", TRIMESH },
+  { "true", SYMTRUE },
+  { "updir", UPDIR },
+  { "viewdir", VIEWDIR },
+};
 
+const int NUM_RESERVED = sizeof( reservedWords ) / sizeof( reservedWords[0] );
+
+// FNV-1a, the top byte picks the slot
+inline unsigned int hashWord( const char* name, size_t length, unsigned int seed )
+{
+  unsigned int h = 2166136261u ^ seed;
+  for( size_t i = 0; i < length; i++ )
+  {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
   }
+  return h >> 24;
+}
 
-  // search ReservedWords table
-  std::map<string, SYMBOL>::const_iterator itr = 
-    reservedWords.find( ident );
-  if( itr == reservedWords.end() )
-    return UNKNOWN;
-  else
-    return (*itr).second;
+class ReservedWordTable {
+  public:
+    ReservedWordTable() : seed( 0 )
+    {
+      // roughly one seed in a few hundred puts ~50 words in 256
+      // slots without a collision, so this is quick
+      for( ;; seed++ )
+      {
+        std::fill( slots, slots + 256, 0 );
+        int i = 0;
+        for( ; i < NUM_RESERVED; i++ )
+        {
+          unsigned char& slot = slots[ hashWord( reservedWords[i].name, strlen( reservedWords[i].name ), seed ) ];
+          if( slot )
+            break;
+          slot = (unsigned char)( i + 1 );
+        }
+        if( i == NUM_RESERVED )
+          break;
+      }
+    }
+
+    SYMBOL find( const char* name, size_t length ) const
+    {
+      unsigned char slot = slots[ hashWord( name, length, seed ) ];
+      if( !slot )
+        return UNKNOWN;
+      const ReservedWord& word = reservedWords[ slot - 1 ];
+      if( strncmp( word.name, name, length ) != 0 || word.name[ length ] != '\0' )
+        return UNKNOWN;
+      return word.symbol;
+    }
+
+  private:
+    unsigned int seed;
+    unsigned char slots[256];   // index + 1 into reservedWords, 0 = empty
+};
+
+} // anonymous namespace
+
+SYMBOL lookupReservedWord( const char* name, size_t length ) {
+  static const ReservedWordTable table;
+  return table.find( name, length );
+}
+
+SYMBOL lookupReservedWord( const string& ident ) {
+  return lookupReservedWord( ident.data(), ident.size() );
 }
 
 string Token::toString() const
 {
-  return getNameForToken( kind() );
+  ostringstream oss;
+  oss << getNameForToken( kind() );
+  if( IDENT == kind() )
+    oss << ": \"" << ident() << "\"";
+  else if( SCALAR == kind() )
+    oss << ": " << value();
+  return oss.str();
 }
 
 void Token::Print( ostream& out ) const {
@@ -192,15 +266,3 @@ void Token::Print( ) const {
   Print( std::cout );
 }
 
-string IdentToken::toString( ) const {
-  ostringstream oss( Token::toString() );
-  oss << ": \"" << _ident << "\"";
-  return oss.str();
-}
-
-string ScalarToken::toString( ) const {
-  ostringstream oss( Token::toString() );
-  oss << ": " << _value;
-  return oss.str();
-}
- 
@@ -21,8 +21,8 @@
    to the list below (I recommend at the bottom) and 
    also to the lookup table (see Token.cpp).  If you
    are adding a reserved word (you probably are) you
-   need also to add it to the reserved words lookup 
-   table in Token.cpp.
+   need also to add it to the reserved words list
+   in Token.cpp.
 */
 
 enum SYMBOL {
@@ -56,6 +56,7 @@ enum SYMBOL {
   CYLINDER,
   CONE,
   TRIMESH,  
+  MESH,                     // a trimesh read from a file
 
   POSITION, VIEWDIR,		// keywords affecting primitives
   UPDIR, ASPECTRATIO,
@@ -71,6 +72,7 @@ enum SYMBOL {
   POLYPOINTS, NORMALS,			// keywords affecting polygons
   MATERIALS, FACES,
   GENNORMALS,
+  FILENAME,
 
   TRANSLATE, SCALE,			// Transforms
   ROTATE, TRANSFORM,
@@ -88,54 +90,49 @@ enum SYMBOL {
 // Helper functions
 string getNameForToken( const SYMBOL kind );
 SYMBOL lookupReservedWord( const string& name );
+SYMBOL lookupReservedWord( const char* name, size_t length );
 
+/* Tokens are small values.  An identifier's text is not copied
+   out of the scanned file; the token points at it (see
+   Tokenizer.h), so the file has to outlive its tokens.
+   ident() makes a string of it.
+*/
 class Token {
   public:
-    Token(SYMBOL kind) : _kind( kind ) { }
+    Token() : _kind( UNKNOWN ), _text( NULL ), _length( 0 ), _value( 0.0 ) { }
+    Token(SYMBOL kind) : _kind( kind ), _text( NULL ), _length( 0 ), _value( 0.0 ) { }
+
+    static Token Ident(const char* text, size_t length)
+      { Token t( IDENT ); t._text = text; t._length = length; return t; }
+    static Token Scalar(double value)
+      { Token t( SCALAR ); t._value = value; return t; }
 
     SYMBOL kind() const { return _kind; }
 
     // Note that these errors should not ever be encountered at runtime,
     // and signify parser bugs of some kind.
-    virtual std::string ident() const   
-      { throw ParserFatalException("not an IdentToken"); return std::string(); }
-    virtual double value() const   
-      { throw ParserFatalException("not a ScalarToken"); return 0.0; }
-
-
-    // Utility functions
-    virtual void Print(std::ostream& out) const;
-    virtual void Print() const;
-    virtual string toString() const;
+    std::string ident() const
+      { if( IDENT != _kind ) throw ParserFatalException("not an IdentToken");
+        return std::string( _text, _length ); }
+    double value() const
+      { if( SCALAR != _kind ) throw ParserFatalException("not a ScalarToken");
+        return _value; }
 
-	virtual ~Token() {}
-  protected:
-    const SYMBOL _kind;
-};
-
-class IdentToken : public Token {
-  public:
-    IdentToken(std::string ident) : Token(IDENT), _ident( ident ) { 
-    }
+    // an identifier's characters, in place
+    const char* text() const { return _text; }
+    size_t length() const { return _length; }
 
-    std::string ident() const { return _ident; }
-
-    string toString() const;
-
-  protected:
-    const std::string _ident;
-};
-
-class ScalarToken : public Token {
-  public:
-    ScalarToken(double value) : Token(SCALAR), _value( value ) { }
-    
-    double value() const { return _value; }
 
+    // Utility functions
+    void Print(std::ostream& out) const;
+    void Print() const;
     string toString() const;
 
   protected:
-    const double _value;
+    SYMBOL _kind;
+    const char* _text;
+    size_t _length;
+    double _value;
 };
 
 
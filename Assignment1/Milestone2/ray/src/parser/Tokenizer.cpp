@@ -1,8 +1,8 @@
 // Tokenizer.cpp
 // Breaks the input stream up into tokens
-#include <string> 
-#include <map>
+#include <string>
 #include <sstream>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "../fileio/buffer.h"
@@ -26,22 +26,170 @@
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Tokenizer::Tokenizer(istream&) constructor
+// Character classes
+//
+//   One table lookup tells what a character may start or continue.
+// Identifiers start with a letter or '_' and may contain '-' (for
+// "SBT-raytracer"); numbers are made of digits, '-', '.' and 'e'.
+//
+
+namespace {
+
+enum {
+  CH_SPACE        = 1,
+  CH_IDENT_START  = 2,
+  CH_IDENT        = 4,
+  CH_SCALAR_START = 8,
+  CH_SCALAR       = 16
+};
+
+struct CharTable {
+  unsigned char cls[256];
+  SYMBOL punct[256];
+
+  CharTable() {
+    for( int c = 0; c < 256; c++ ) {
+      cls[c] = 0;
+      punct[c] = UNKNOWN;
+    }
+    const char* space = " \t\n\v\f\r";
+    for( const char* s = space; *s; s++ )
+      cls[(unsigned char)*s] = CH_SPACE;
+    for( int c = 'a'; c <= 'z'; c++ ) {
+      cls[c] |= CH_IDENT_START | CH_IDENT;
+      cls[c - 'a' + 'A'] |= CH_IDENT_START | CH_IDENT;
+    }
+    for( int c = '0'; c <= '9'; c++ )
+      cls[c] |= CH_IDENT | CH_SCALAR_START | CH_SCALAR;
+    cls['_'] |= CH_IDENT_START | CH_IDENT;
+    cls['-'] |= CH_IDENT | CH_SCALAR_START | CH_SCALAR;
+    cls['.'] |= CH_SCALAR_START | CH_SCALAR;
+    cls['e'] |= CH_SCALAR;
+
+    punct['('] = LPAREN;
+    punct[')'] = RPAREN;
+    punct['{'] = LBRACE;
+    punct['}'] = RBRACE;
+    punct[','] = COMMA;
+    punct['='] = EQUALS;
+    punct[';'] = SEMICOLON;
+  }
+};
+
+const CharTable charTable;
+
+inline bool is( char c, int cls ) {
+  return ( charTable.cls[(unsigned char)c] & cls ) != 0;
+}
+
+const double powersOf10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Numbers of the form -123.456e-7 whose digits fit in a double and
+// whose exponent is small come out exactly as strtod would round them
+// from one multiply or divide (powers of ten up to 1e22 are exact).
+// Returns false for anything else.
+bool fastScalar( const char* p, const char* end, double& out ) {
+  bool negative = false;
+  if( p < end && '-' == *p ) {
+    negative = true;
+    p++;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  for( ; p < end && *p >= '0' && *p <= '9'; p++ ) {
+    any = true;
+    if( mantissa || *p != '0' ) {
+      if( ++digits > 19 )
+        return false;
+      mantissa = mantissa * 10 + ( *p - '0' );
+    }
+  }
+  if( p < end && '.' == *p ) {
+    for( p++; p < end && *p >= '0' && *p <= '9'; p++ ) {
+      any = true;
+      exponent--;
+      if( mantissa || *p != '0' ) {
+        if( ++digits > 19 )
+          return false;
+        mantissa = mantissa * 10 + ( *p - '0' );
+      }
+    }
+  }
+  if( !any )
+    return false;
+
+  if( p < end && 'e' == *p ) {
+    p++;
+    bool negExp = false;
+    if( p < end && '-' == *p ) {
+      negExp = true;
+      p++;
+    }
+    int e = 0;
+    const char* start = p;
+    for( ; p < end && *p >= '0' && *p <= '9' && p - start < 4; p++ )
+      e = e * 10 + ( *p - '0' );
+    if( p == start )
+      return false;
+    exponent += negExp ? -e : e;
+  }
+
+  if( p != end || mantissa > ( uint64_t( 1 ) << 53 ) || exponent < -22 || exponent > 22 )
+    return false;
+
+  double value = (double)mantissa;
+  value = exponent < 0 ? value / powersOf10[-exponent] : value * powersOf10[exponent];
+  out = negative ? -value : value;
+  return true;
+}
+
+} // anonymous namespace
+
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Tokenizer::Tokenizer(const char*, const char*) constructor
 //
 //   This constructor sets up the initial state that we need in order
-// to start scanning.  Note that we will be passed an OPEN file.  This
-// simplifies the scanner part, since we don't have to open it and
-// error check to see if it exists.  We assume that the caller (which
-// will be the main() function) sets up everything and passes us a VALID
-// file pointer.
+// to start scanning.  The text is scanned where it is, so it (and with
+// it the identifiers of the tokens) has to stay around while the
+// tokens are in use.
+//
+
+Tokenizer::Tokenizer(const char* begin, const char* end, bool printTokens)
+  : buffer( begin, end )
+{
+    Init( printTokens );
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Tokenizer::Tokenizer(istream&) constructor
+//
+//   Reads the whole stream and scans its copy.
 //
 
-Tokenizer::Tokenizer(istream& fp, bool printTokens) 
-  : buffer( fp, false, false )
-{ 
+Tokenizer::Tokenizer(istream& fp, bool printTokens)
+  : buffer( fp )
+{
+    Init( printTokens );
+}
+
+void Tokenizer::Init(bool printTokens) {
+    Pos = buffer.Begin();
+    End = buffer.End();
+    LineStart = Pos;
+    LineNumber = 1;
+    HasLookahead = false;
     TokenColumn = 0;
-    CurrentCh = ' ';
-    UnGetToken = NULL;
+    TokenLine = 1;
+    TokenLineStart = Pos;
     _printTokens = printTokens;
 }
 
@@ -49,79 +197,76 @@ Tokenizer::Tokenizer(istream& fp, bool printTokens)
 //
 // repeatedly scan tokens in and throw them away.  Useful if this is the
 // last phase to be executed
-// 
+//
 void Tokenizer::ScanProgram() {
-    while (Get()->kind() != EOFSYM) ;
+    while (Get().kind() != EOFSYM) ;
 }
 
 
-unique_ptr<Token> Tokenizer::Get() {
-  return unique_ptr<Token>(GetNext());
-}
-
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Get() method
+// Token Tokenizer::Get() method
 //
 // Advance through the source to find the next token. Returns peeked token,
 // if there is one.
 //
 
-Token* Tokenizer::GetNext() {
-  Token* T = NULL;
-
-  // First check to see if there is an UnGetToken. If there is, use it.
-  if (UnGetToken != NULL) {
-    T = UnGetToken;
-    UnGetToken = NULL;
-    return T;
+Token Tokenizer::Get() {
+  if (HasLookahead) {
+    HasLookahead = false;
+    return Lookahead;
   }
+  Token T;
+  Scan(T);
+  return T;
+}
 
-  // Otherwise, crank up the scanner and get a new token.
-
+void Tokenizer::Scan(Token& T) {
   // Get rid of any whitespace
   SkipWhiteSpace();
 
   // test for end of file
-  if (buffer.isEOF()) {
-    T = new Token(EOFSYM);
+  if (Pos >= End) {
+    MarkToken(Pos);
+    T = Token(EOFSYM);
 
   } else {
-    
-    // Save the starting position of the symbol in a variable,
+
+    // Save the starting position of the symbol,
     // so that nicer error messages can be produced.
-    TokenColumn = buffer.CurColumn();
-    
+    MarkToken(Pos);
+
     // Check kind of current character
-    
+
     // Note that _'s are now allowed in identifiers.
-    if (isalpha(CurrentCh) || '_' == CurrentCh) {
+    char c = *Pos;
+    if (is(c, CH_IDENT_START)) {
       // grab identifier or reserved word
       T = GetIdent();
-    } else if ( '"' == CurrentCh)  {
-      T = GetQuotedIdent(); 
-    } else if (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh) {
+    } else if ( '"' == c )  {
+      T = GetQuotedIdent();
+    } else if (is(c, CH_SCALAR_START)) {
       T = GetScalar();
-    } else { 
+    } else {
       //
       // Check for other tokens
       //
-      
+
       T = GetPunct();
     }
   }
-  
-  if (T == NULL) {
-    throw ParserFatalException("didn't get a token");
-  }
 
   if (_printTokens) {
     std::cout << "Token read: ";
-    T->Print();
+    T.Print();
     std::cout << std::endl;
   }
+}
 
-  return T;
+void Tokenizer::MarkToken(const char* start) {
+  TokenColumn = (int)(start - LineStart);
+  TokenLine = LineNumber;
+  TokenLineStart = LineStart;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -129,180 +274,153 @@ Token* Tokenizer::GetNext() {
 // Skips spaces, tabs, newlines, and comments
 //
 void Tokenizer::SkipWhiteSpace() {
-  while (isspace(CurrentCh)) {
-    GetCh();
-  }
+  for( ;; ) {
+    while (Pos < End && is(*Pos, CH_SPACE)) {
+      if ('\n' == *Pos)
+        LineStart = Pos + 1, LineNumber++;
+      Pos++;
+    }
 
-  if( '/' == CurrentCh )  // Look for comments
-  {
-    GetCh();
-    if( '/' == CurrentCh )
+    if( Pos >= End || '/' != *Pos )
+      return;
+
+    // Look for comments
+    MarkToken(Pos);
+    Pos++;
+    if( Pos < End && '/' == *Pos )
     {
       // Throw out everything until the end of the line
-      while( '\n' != CurrentCh )
-      {
-        GetCh();
-      }
+      while( Pos < End && '\n' != *Pos )
+        Pos++;
     }
-    else if ( '*' == CurrentCh )
+    else if ( Pos < End && '*' == *Pos )
     {
-      int startLine = CurLine();
-      while( true )
+      int startLine = LineNumber;
+      for( Pos++; ; Pos++ )
       {
-        GetCh();
-        if( '*' == CurrentCh )
-        {
-          GetCh();
-          if( CondReadCh( '/' ) )
-            break;
-          else if ( buffer.isEOF() )
-          {
-            std::ostringstream ost;
-            ost << "Unterminated comment in line ";
-            ost << startLine;
-            throw SyntaxErrorException( ost.str(), *this );
-          }
-        }
-        else if ( buffer.isEOF() )
+        if( Pos + 1 >= End )
         {
           std::ostringstream ost;
           ost << "Unterminated comment in line ";
           ost << startLine;
           throw SyntaxErrorException( ost.str(), *this );
         }
+        if( '\n' == *Pos )
+          LineStart = Pos + 1, LineNumber++;
+        else if( '*' == Pos[0] && '/' == Pos[1] )
+        {
+          Pos += 2;
+          break;
+        }
       }
     }
     else
     {
       std::ostringstream ost;
-      ost << "unexpected character: '" << CurrentCh << "'";
-	  throw SyntaxErrorException( ost.str(), *this );
+      ost << "unexpected character: '" << ( Pos < End ? *Pos : ' ' ) << "'";
+      throw SyntaxErrorException( ost.str(), *this );
     }
-
-    SkipWhiteSpace();  // We may need to throw out
-                       //  more white space/comments
-                       // This is admittedly tail recursion...
   }
 }
 
-Token* Tokenizer::GetQuotedIdent() {
-  GetCh();   // Throw out beginning '"'
+Token Tokenizer::GetQuotedIdent() {
+  const char* start = ++Pos;   // Throw out beginning '"'
 
-  std::ostringstream ident;
-  while ( '"' != CurrentCh ) {
-    if( '\n' == CurrentCh )
+  while ( Pos < End && '"' != *Pos ) {
+    if( '\n' == *Pos )
       throw SyntaxErrorException( "Unterminated string constant", *this );
-
-    ident << CurrentCh;
-    GetCh();
+    Pos++;
   }
-  GetCh();
-  return new IdentToken( ident.str() );
+  if( Pos >= End )
+    throw SyntaxErrorException( "Unterminated string constant", *this );
+  Pos++;
+  return Token::Ident( start, Pos - 1 - start );
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetIdent method
+// Token Tokenizer::GetIdent method
 //
 //   GetIdent scans an identifier-like token.  It returns an
 //   identifier or a reserved word token.
 //
 
-Token* Tokenizer::GetIdent() {
+Token Tokenizer::GetIdent() {
   // an IDENTIFIER or a RESERVED WORD token
-  std::ostringstream ident;
-  while (isalnum(CurrentCh) || '_' == CurrentCh || '-' == CurrentCh) { 
-    // While we still have something that can
-    ident << CurrentCh;
-    GetCh();
-  }
-  return SearchReserved(ident.str());
+  const char* start = Pos;
+  while (Pos < End && is(*Pos, CH_IDENT))
+    Pos++;
+
+  SYMBOL tokSymbol = lookupReservedWord( start, Pos - start );
+  if( UNKNOWN == tokSymbol )
+    return Token::Ident( start, Pos - start );
+  return Token( tokSymbol );
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetInt method
+// Token Tokenizer::GetScalar method
 //
-//   GetInt scans an integer.  It returns an integer token.
+//   GetScalar scans a number.  It returns a scalar token.  Anything
+//   the fast path can't do exactly goes through atof, which also
+//   decides what odd strings like "1-2" mean.
 //
 
-Token* Tokenizer::GetScalar() {
-  // an INTEGER token
-  string ret( "" );
-  while (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh || 'e' == CurrentCh ) {
-    ret += CurrentCh;
-    GetCh();
-  }
-  return new ScalarToken( atof( ret.c_str() ) );
+Token Tokenizer::GetScalar() {
+  const char* start = Pos;
+  while (Pos < End && is(*Pos, CH_SCALAR))
+    Pos++;
+
+  double value;
+  if (!fastScalar(start, Pos, value))
+    value = atof( string( start, Pos ).c_str() );
+  return Token::Scalar( value );
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetPunct() method
+// Token Tokenizer::GetPunct() method
 //
 //   Gets a punctuation token from input stream and returns it.
 //
 
-Token* Tokenizer::GetPunct() {
-  Token* T;
-
-  switch (CurrentCh) {
-  case '(':  GetCh(); T = new Token(LPAREN);     break;
-  case ')':  GetCh(); T = new Token(RPAREN);     break;
-  case '{':  GetCh(); T = new Token(LBRACE);     break;
-  case '}':  GetCh(); T = new Token(RBRACE);     break;
-  case ',':  GetCh(); T = new Token(COMMA);      break;
-  case '=':  GetCh(); T = new Token(EQUALS);     break;
-  case ';':  GetCh(); T = new Token(SEMICOLON);  break;
-
-  default:
+Token Tokenizer::GetPunct() {
+  SYMBOL kind = charTable.punct[(unsigned char)*Pos];
+  if (UNKNOWN == kind) {
     std::ostringstream ost;
-    ost << "unexpected character: '" << CurrentCh << "'";
+    ost << "unexpected character: '" << *Pos << "'";
     throw SyntaxErrorException(ost.str(), *this);
   }
-
-  return T;
-}
-
-//////////////////////////////////////////////////////////////////////////
-//
-// void Tokenizer::UnGet(Token*) method
-//
-//   UnGet returns the last read token to the input, where it will be
-//   returned for the next Get call.  At most 1 token can be pushed back
-//   at a time this way and this token is pointed to by the pointer
-//   TokenToUnGet.  TokenToUnGet must be non null.
-
-void Tokenizer::UnGet(Token* TokenToUnGet) {
-  if (UnGetToken != NULL) {
-    throw ParserFatalException("trying to UnGet more than one token");
-  }
-  UnGetToken = TokenToUnGet;
+  Pos++;
+  return Token(kind);
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Peek() method
+// const Token* Tokenizer::Peek() method
 //
-//   Peek reads the next token and pushes it back on the token stream
+//   Peek reads the next token and pushes it back on the token stream;
+//   the pointer is good until the next Get.
 //
 
 const Token* Tokenizer::Peek() {
-  Token* T = GetNext();
-  UnGet(T);
-  return T;
+  if (!HasLookahead) {
+    Scan(Lookahead);
+    HasLookahead = true;
+  }
+  return &Lookahead;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::Read(SYMBOL) method
+// Token Tokenizer::Read(SYMBOL) method
 //
 //   Read gets the next token and checks that it's of the expected type.
 //
 
-unique_ptr<Token> Tokenizer::Read(SYMBOL kind) {
-  unique_ptr<Token> T( Get() );
-  if (T->kind() != kind) {
+Token Tokenizer::Read(SYMBOL kind) {
+  Token T = Get();
+  if (T.kind() != kind) {
     string msg( getNameForToken( kind ) );
     msg.append( " expected" );
     throw SyntaxErrorException(msg, *this);
@@ -320,55 +438,8 @@ unique_ptr<Token> Tokenizer::Read(SYMBOL kind) {
 //
 
 bool Tokenizer::CondRead(SYMBOL kind) {
-  const Token* T = Peek();
-  if (T->kind() == kind) {
-    Get( );
-    return true;
-  } else {
-    return false;
-  }
-}
-
-//////////////////////////////////////////////////////////////////////////
-//
-// Token* Tokenizer::SearchReserved(const string&) private method
-//
-//   SearchReserved() maps a character string to an IdentToken or one of
-// several possible reserved word tokens, using a binary search on the
-// ReservedWords structure.
-//
-
-//
-// The list of all the Reserved words and their associated symbols,
-// in alphabetical order so this can be searched using binary search.
-//
-
-typedef std::map<string, SYMBOL> ReservedWordsMap;
-
-Token* Tokenizer::SearchReserved(const string& ident) const {
-  SYMBOL tokSymbol = lookupReservedWord( ident );
-  if( UNKNOWN == tokSymbol )
-  {
-    return new IdentToken( ident );
-  }
-  else
-  {
-    return new Token( tokSymbol );
-  }
-}
-
-//////////////////////////////////////////////////////////////////////////
-//
-// bool Tokenizer::CondReadCh(char) private method
-//
-//   CondReadCh checks to see if the CurrentCh is the same as the argument.
-// If so, CondReadCh eats that character (by calling GetCh())
-// and returns true.  If not, just return false.
-//
-
-bool Tokenizer::CondReadCh(char c) {
-  if (c == CurrentCh) {
-    GetCh();
+  if (Peek()->kind() == kind) {
+    HasLookahead = false;
     return true;
   } else {
     return false;
@@ -6,14 +6,12 @@
 #include "../fileio/buffer.h"
 
 #include <string>
-#include <memory>
 
 // Needed to correct for annoying "feature" in MSVC's compiler
 #pragma warning (disable: 4786)
 
 using std::string;
 using std::istream;
-using std::unique_ptr;
 
 
 /*
@@ -23,6 +21,11 @@ using std::unique_ptr;
    most of the stuff that you might want to change is in
    Token.{h,cpp} and Parser.{h,cpp}.
 
+   The whole file is scanned in place (normally it is
+   mapped, see RayTracer::loadScene) with a character class
+   table, and tokens are returned by value pointing into it,
+   so nothing is allocated per token.
+
    This tokenizer is based on the tokenizer from the
    PL0 project used for CSE401
    (http://www.cs.washington.edu/401).
@@ -31,27 +34,29 @@ using std::unique_ptr;
 
 class Tokenizer {
   public:
+    // scan the text [begin, end), which must outlive the tokens
+    Tokenizer(const char* begin, const char* end, bool printTokens);
     Tokenizer(istream& fp, bool printTokens);
 
     // destructively read & return the next token, skipping over whitespace
-    unique_ptr<Token> Get();
+    Token Get();
 
     // non-destructively get the next token, pushing it back to be read again
     const Token* Peek();
 
     // Get() the next token, and check that it's of the expected SYMBOL type
-    unique_ptr<Token> Read(SYMBOL expected);
+    Token Read(SYMBOL expected);
 
     // read the next token only if it matches the expected token type.
     // Return whether it matches.
     bool CondRead(SYMBOL expected);
 
     // display the current source line onto the screen.
-    void PrintLine( ostream& out) const { buffer.PrintLine(out); }
+    void PrintLine( ostream& out) const { buffer.PrintLine(out, TokenLineStart); }
 
     // return the column number/line number of the current token.
     int CurColumn() const { return TokenColumn; }
-    int CurLine() const { return buffer.CurLine(); }
+    int CurLine() const { return TokenLine; }
 
     // Repeatedly scan tokens and throw them away.  Useful if this is the
     // last phase to be executed
@@ -60,36 +65,34 @@ class Tokenizer {
 protected:
     // private methods:
 
-    // push the argument token back onto the scanner's token stream;
-    // it will be returned by the next Get/Peek/Read/CondRead call
-    Token* GetNext();
-    void UnGet(Token* t);
-
-    Token* SearchReserved(const string&) const; // Convert ident string into token
+    void Init(bool printTokens);
+    void Scan(Token& T);          // scan the next token from the text
 
-    void GetCh() { CurrentCh = buffer.GetCh(); }
-    bool CondReadCh(char expected);        // consume a character, if it matches
+    void SkipWhiteSpace();        // skip spaces, tabs, newlines, comments
+    void MarkToken(const char* start);  // remember where a token starts
 
-    void SkipWhiteSpace();        // skip spaces, tabs, newlines
-
-    Token* GetPunct();            // scan punctuation token
-    Token* GetScalar();           // scan integer token
-    Token* GetIdent();            // scan identifier token
-    Token* GetQuotedIdent();
+    Token GetPunct();             // scan punctuation token
+    Token GetScalar();            // scan number token
+    Token GetIdent();             // scan identifier token
+    Token GetQuotedIdent();
 
 
     // private data:
 
-    Buffer buffer;                // The file buffer
-    char CurrentCh;               // The current character in the current line
+    Buffer buffer;                // The text being scanned
+    const char* Pos;              // The current character
+    const char* End;
+    const char* LineStart;        // First character of the current line
+    int LineNumber;
 
-    Token* UnGetToken;            // The token that has been "ungot"
+    Token Lookahead;              // The token that has been peeked at
+    bool HasLookahead;
 
-    int TokenColumn;              // The column where the last read token starts,
-                                  // for generating error messages
+    int TokenColumn;              // The column/line where the last read token
+    int TokenLine;                // starts, for generating error messages
+    const char* TokenLineStart;
 
     bool _printTokens;            // printing flag
 };
 
 #endif
-
@@ -30,6 +30,23 @@ Camera::rayThrough(double x, double y, ray &r)
 	r.setDirection(dir);
 }
 
+void
+Camera::rayThrough(double x, double y, double dx, double dy, ray &r)
+{
+	rayThrough(x, y, r);
+
+	// derivative of normalize(d) along u and v, scaled to one pixel
+	glm::dvec3 d = look + (x - 0.5) * u + (y - 0.5) * v;
+	double dd = glm::dot(d, d);
+	double len3 = dd * glm::sqrt(dd);
+	ray::Differentials diff;
+	diff.dPdx = glm::dvec3(0.0);
+	diff.dPdy = glm::dvec3(0.0);
+	diff.dDdx = dx * (dd * u - glm::dot(d, u) * d) / len3;
+	diff.dDdy = dy * (dd * v - glm::dot(d, v) * d) / len3;
+	r.setDifferentials(diff);
+}
+
 void
 Camera::setEye(const glm::dvec3 &eye)
 {
@@ -74,6 +91,13 @@ Camera::setLook(const glm::dvec3 &viewDir, const glm::dvec3 &upDir)
     update();
 }
 
+void
+Camera::aim(const glm::dvec3 &viewDir, const glm::dvec3 &upDir)
+{
+    glm::dvec3 dir = glm::normalize(viewDir);
+    setLook(dir, glm::normalize(upDir - dir * glm::dot(upDir, dir)));
+}
+
 void
 Camera::setFOV(double fov)
 // fov - field of view (height) in degrees    
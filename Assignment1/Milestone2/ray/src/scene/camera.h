@@ -7,12 +7,18 @@
 
 class Camera
 {
+    friend class SceneFile;  // compiled scenes store the raw fields
 public:
     Camera();
     void rayThrough( double x, double y, ray &r );
+    // same, and give the ray differentials for a pixel that is
+    // dx by dy in normalized window coordinates
+    void rayThrough( double x, double y, double dx, double dy, ray &r );
     void setEye( const glm::dvec3 &eye );
     void setLook( double, double, double, double );
     void setLook( const glm::dvec3 &viewDir, const glm::dvec3 &upDir );
+    // like setLook, but straightens upDir so it is perpendicular to viewDir
+    void aim( const glm::dvec3 &viewDir, const glm::dvec3 &upDir );
     void setFOV( double );
     void setAspectRatio( double );
 
@@ -1,15 +1,15 @@
 #include "cubeMap.h"
-#include "ray.h"
 #include "../ui/TraceUI.h"
 #include "../scene/material.h"
+#include <algorithm>
 #include <iostream>
 extern TraceUI* traceUI;
 
 
-glm::dvec3 CubeMap::getColor(ray r) const
+glm::dvec3 CubeMap::getColor(const glm::dvec3& direction) const
 {
 	// determine which face the ray will hit and get UV coords
-	glm::dvec3 dir = glm::normalize(r.getDirection());
+	glm::dvec3 dir = glm::normalize(direction);
 	glm::dvec3 abs_dir = glm::abs(dir);
 	int tm_index = 0;
 	double ma = 0.0;
@@ -36,7 +36,16 @@ glm::dvec3 CubeMap::getColor(ray r) const
 	}
 
 	uv = uv * ma + 0.5;
-	return tMap[tm_index]->getMappedValue(uv);
+
+	// a filter_width x filter_width texel box maps to a mip level of the
+	// face, prefiltered when the texture was loaded
+	const TextureMap* face = tMap[tm_index].get();
+	double width = (double)std::max(traceUI->getFilterWidth(), 1);
+	if (width <= 1.0)
+		return face->getMappedValue(uv);
+	glm::dvec2 dx(width / face->getWidth(), 0.0);
+	glm::dvec2 dy(0.0, width / face->getHeight());
+	return face->getMappedValue(uv, dx, dy);
 }
 
 CubeMap::CubeMap()
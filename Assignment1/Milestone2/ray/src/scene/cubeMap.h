@@ -4,7 +4,6 @@
 #include <glm/vec3.hpp>
 
 class TextureMap;
-class ray;
 
 class CubeMap {
 	std::unique_ptr<TextureMap> tMap[6];
@@ -33,6 +32,8 @@ public:
 
 	void setNthMap(int n, TextureMap* m);
 
-	glm::dvec3 getColor(ray r) const;
+	// color seen in direction dir, box filtered over filter_width texels
+	// of the face (one lookup in the face's mip chain, whatever the width)
+	glm::dvec3 getColor(const glm::dvec3& dir) const;
 
 };
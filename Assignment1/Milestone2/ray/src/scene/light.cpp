@@ -2,6 +2,7 @@
 #include <iostream>
 
 #include "light.h"
+#include "rayStats.h"
 #include <glm/glm.hpp>
 #include <glm/gtx/io.hpp>
 
@@ -10,6 +11,37 @@ using namespace std;
 
 const double EPSILON = 0.000001;
 
+void Light::setThreads(int threads)
+{
+	if (lastOccluder.size() != (size_t)threads)
+		lastOccluder.assign(threads, OccluderSlot());
+}
+
+bool Light::blockedByLastOccluder(ray& shadow_r, const glm::dvec3& light_dir) const
+{
+	if (ray_thread_id >= lastOccluder.size())
+		return false;
+	const SceneObject* obj = lastOccluder[ray_thread_id].obj;
+	if (!obj)
+		return false;
+
+	// still blocked if it is hit on this side of the light and is opaque
+	isect i;
+	bool blocked = obj->intersect(shadow_r, i) &&
+	               glm::dot(getDirection(shadow_r.at(i)), light_dir) > 0.0 &&
+	               !i.getMaterial().Trans();
+	RayStats::count(RayStats::SHADOW_CACHE_TESTS);
+	if (blocked)
+		RayStats::count(RayStats::SHADOW_CACHE_HITS);
+	return blocked;
+}
+
+void Light::setLastOccluder(const SceneObject* obj) const
+{
+	if (ray_thread_id < lastOccluder.size())
+		lastOccluder[ray_thread_id].obj = obj;
+}
+
 double DirectionalLight::distanceAttenuation(const glm::dvec3& P) const
 {
 	// distance to light is infinite, so f(di) goes to 0.  Return 1.
@@ -28,6 +60,8 @@ glm::dvec3 DirectionalLight::shadowAttenuation(const ray& r, const glm::dvec3& p
 	// shoot ray from shadow point to light
 	glm::dvec3 light_dir = getDirection(p);
 	ray shadow_r(p, light_dir, glm::dvec3(1, 1, 1), ray::SHADOW);
+	if (blockedByLastOccluder(shadow_r, light_dir))
+		return glm::dvec3(0.0);
 	isect shadow_i;
 	bool hit = scene->intersect(shadow_r, shadow_i);
 
@@ -41,6 +75,7 @@ glm::dvec3 DirectionalLight::shadowAttenuation(const ray& r, const glm::dvec3& p
 		if (!m.Trans())
 		{
 			// object is not translucent, therefore no light from light source can reach it
+			setLastOccluder(shadow_i.getPrimitive());
 			return glm::dvec3(0.0);
 		}
 		else
@@ -105,6 +140,33 @@ double PointLight::distanceAttenuation(const glm::dvec3& P) const
 	return atten;
 }
 
+bool PointLight::influenceSphere(double cutoff, glm::dvec3& center, double& radius) const
+{
+	// find d where max(color) / (a + b d + c d^2) drops to the cutoff
+	double brightest = glm::max(color[0], glm::max(color[1], color[2]));
+	double target = brightest / cutoff;
+	center = position;
+	if (constantTerm >= target)
+	{
+		// never bright enough
+		radius = 0.0;
+		return true;
+	}
+	if (quadraticTerm > 0.0)
+	{
+		double a = quadraticTerm, b = linearTerm, c = constantTerm - target;
+		radius = (-b + std::sqrt(b * b - 4.0 * a * c)) / (2.0 * a);
+		return true;
+	}
+	if (linearTerm > 0.0)
+	{
+		radius = (target - constantTerm) / linearTerm;
+		return true;
+	}
+	// no falloff
+	return false;
+}
+
 glm::dvec3 PointLight::getColor() const
 {
 	return color;
@@ -127,6 +189,8 @@ glm::dvec3 PointLight::shadowAttenuation(const ray& r, const glm::dvec3& p, cons
 	// shoot ray from shadow point to light
 	glm::dvec3 light_dir = getDirection(p);
 	ray shadow_r(p, light_dir, glm::dvec3(1, 1, 1), ray::SHADOW);
+	if (blockedByLastOccluder(shadow_r, light_dir))
+		return glm::dvec3(0.0);
 	isect shadow_i;
 	bool hit = scene->intersect(shadow_r, shadow_i);
 
@@ -142,6 +206,7 @@ glm::dvec3 PointLight::shadowAttenuation(const ray& r, const glm::dvec3& p, cons
 		if (!m.Trans())
 		{	
 			// object is not translucent, therefore no light from light source can reach it
+			setLastOccluder(shadow_i.getPrimitive());
 			return glm::dvec3(0.0);
 		}
 		else
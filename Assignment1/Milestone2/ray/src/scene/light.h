@@ -9,7 +9,11 @@ using std::max;
 
 #include "scene.h"
 #include "../ui/TraceUI.h"
+#ifndef RAY_NO_GL
 #include <FL/gl.h>
+#else
+typedef unsigned int GLenum;	// only for the glDraw declarations
+#endif
 
 class Light
 	: public SceneElement
@@ -20,12 +24,35 @@ public:
 	virtual glm::dvec3 getColor() const = 0;
 	virtual glm::dvec3 getDirection (const glm::dvec3& P) const = 0;
 
+	// make room in the occluder cache for ray_thread_id 0 .. threads-1;
+	// not while rendering
+	void setThreads(int threads);
+
+	// the sphere outside of which this light adds less than cutoff to any
+	// color channel, false if it reaches everywhere
+	virtual bool influenceSphere(double /*cutoff*/, glm::dvec3& /*center*/, double& /*radius*/) const { return false; }
+
 
 protected:
 	Light(Scene *scene, const glm::dvec3& col) : SceneElement(scene), color(col) {}
 
 	glm::dvec3 color;
 
+	// Shadow rays from neighboring points are usually blocked by the same
+	// object, so every thread remembers the last opaque primitive (a face,
+	// for meshes) that blocked this light and tries it before searching
+	// the whole scene.
+	bool blockedByLastOccluder(ray& shadow_r, const glm::dvec3& light_dir) const;
+	void setLastOccluder(const SceneObject* obj) const;
+
+private:
+	// one cache line per thread so the threads don't fight over it
+	struct OccluderSlot {
+		const SceneObject* obj = nullptr;
+		char pad[64 - sizeof(const SceneObject*)];
+	};
+	mutable std::vector<OccluderSlot> lastOccluder;
+
 public:
 	virtual void glDraw(GLenum lightID) const { }
 	virtual void glDraw() const { }
@@ -34,6 +61,7 @@ public:
 class DirectionalLight
 	: public Light
 {
+	friend class SceneFile;
 public:
 	DirectionalLight(Scene *scene, const glm::dvec3& orien, const glm::dvec3& color)
 		: Light(scene, color), orientation(glm::normalize(orien)) { }
@@ -53,6 +81,7 @@ public:
 class PointLight
 	: public Light
 {
+	friend class SceneFile;
 public:
 	PointLight( Scene *scene, const glm::dvec3& pos, const glm::dvec3& color,
 		float constantAttenuationTerm, float linearAttenuationTerm,
@@ -67,6 +96,7 @@ public:
 	virtual double distanceAttenuation(const glm::dvec3& P) const;
 	virtual glm::dvec3 getColor() const;
 	virtual glm::dvec3 getDirection(const glm::dvec3& P) const;
+	virtual bool influenceSphere(double cutoff, glm::dvec3& center, double& radius) const;
 
 	void setAttenuationConstants(float a, float b, float c)
 	{
@@ -2,9 +2,12 @@
 #include "../ui/TraceUI.h"
 #include "light.h"
 #include "ray.h"
+#include "textureCache.h"
 extern TraceUI* traceUI;
 
 #include <glm/gtx/io.hpp>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include "../fileio/images.h"
 
@@ -48,88 +51,89 @@ glm::dvec3 Material::shade(Scene* scene, const ray& r, const isect& i) const
 	return kd(i);
 }
 
-TextureMap::TextureMap(string filename)
+TextureMap::TextureMap(string filename, bool decode)
+	: filename(filename), width(0), height(0)
 {
-	data = readImage(filename.c_str(), width, height);
-	if (data.empty()) {
-		width = 0;
-		height = 0;
-		string error("Unable to load texture map '");
-		error.append(filename);
-		error.append("'.");
-		throw TextureMapException(error);
-	}
-	/*
-	std::cout << "width: " << width << std::endl;
-	std::cout << "height: " << height << std::endl;
-	std::cout << "image data: " << data.size() << std::endl;
-	*/
+	if (decode)
+		load();
 }
 
-glm::dvec3 TextureMap::getMappedValue(const glm::dvec2& coord) const
+void TextureMap::load()
 {
-	// In order to add texture mapping support to the
-	// raytracer, you need to implement this function.
-	// What this function should do is convert from
-	// parametric space which is the unit square
-	// [0, 1] x [0, 1] in 2-space to bitmap coordinates,
-	// and use these to perform bilinear interpolation
-	// of the values.
-
-	double u = (double)(height - 1) * coord[1];
-	double v = (double)(width - 1) * coord[0];
-
-	double u_1 = glm::floor(u);
-	double u_2 = glm::ceil(u);
-	double v_1 = glm::floor(v);
-	double v_2 = glm::ceil(v);
-
-	double alpha = (u_2 - u) / (u_2 - u_1);
-	double beta = (u - u_1) / (u_2 - u_1);
-	double gamma = (v_2 - v) / (v_2 - v_1);
-	double delta = (v - v_1) / (v_2 - v_1);
-
-	glm::dvec3 a = getPixelAt((int)u_1, (int)v_1);
-	glm::dvec3 b = getPixelAt((int)u_2, (int)v_1);
-	glm::dvec3 c = getPixelAt((int)u_2, (int)v_2);
-	glm::dvec3 d = getPixelAt((int)u_1, (int)v_2);
-
-	glm::dvec3 val = (gamma * ((alpha * a) + (beta * b))) + (delta * ((alpha * d) + (beta * c)));
-	//glm::dvec3 ori = getPixelAt((int)u, (int)v);
-
-	//std::cout << "ori: " << ori << " bilin: " << val << std::endl;
-	return val;
+	// decoded once and shared, see textureCache.h
+	tex = TextureCache::load(filename);
+	width = tex->width;
+	height = tex->height;
 }
 
-glm::dvec3 TextureMap::getPixelAt(int x, int y) const
+glm::dvec3 TextureMap::bilinear(const TextureLevel& level, const glm::dvec2& coord) const
 {
-	// In order to add texture mapping support to the
-	// raytracer, you need to implement this function.
-
-	// clamp x and y to be between 0 and width/height respectively
-	x = glm::clamp(x, 0, width - 1);
-	y = glm::clamp(y, 0, height - 1);
+	// rows follow the second coordinate, columns the first
+	double u = glm::clamp((double)(level.height - 1) * coord[1], 0.0, (double)(level.height - 1));
+	double v = glm::clamp((double)(level.width - 1) * coord[0], 0.0, (double)(level.width - 1));
+
+	int u_1 = (int)u;
+	int v_1 = (int)v;
+	int u_2 = std::min(u_1 + 1, level.height - 1);
+	int v_2 = std::min(v_1 + 1, level.width - 1);
+
+	double beta = u - u_1;
+	double alpha = 1.0 - beta;
+	double delta = v - v_1;
+	double gamma = 1.0 - delta;
+
+	const float* a = level.texel(u_1, v_1);
+	const float* b = level.texel(u_2, v_1);
+	const float* c = level.texel(u_2, v_2);
+	const float* d = level.texel(u_1, v_2);
+
+	glm::dvec3 val;
+	for (int k = 0; k < 3; k++)
+		val[k] = (gamma * ((alpha * a[k]) + (beta * b[k]))) + (delta * ((alpha * d[k]) + (beta * c[k])));
+	return val;
+}
 
-	// data length = height * width * 3
-	int start_index = ((width * x) + (y)) * 3;
+glm::dvec3 TextureMap::getMappedValue(const glm::dvec2& coord) const
+{
+	// convert from parametric space, the unit square [0, 1] x [0, 1],
+	// to bitmap coordinates and interpolate bilinearly in the full image
+	return bilinear(tex->levels[0], coord);
+}
 
-	//std::cout << "x: " << x << " y: " << y << std::endl;
-	//std::cout << "start pixel: " << start_pixel << std::endl;
+glm::dvec3 TextureMap::getMappedValue(const glm::dvec2& coord, const glm::dvec2& dx, const glm::dvec2& dy) const
+{
+	// footprint of a pixel in texels of the full image
+	glm::dvec2 size((double)width, (double)height);
+	double footprint = std::max(glm::length(dx * size), glm::length(dy * size));
+	if (!(footprint > 1.0))
+		return bilinear(tex->levels[0], coord);
+
+	double lod = std::min(std::log2(footprint), (double)(tex->levels.size() - 1));
+	int lo = (int)lod;
+	int hi = std::min(lo + 1, (int)tex->levels.size() - 1);
+	double f = lod - lo;
+
+	glm::dvec3 val = bilinear(tex->levels[lo], coord);
+	if (hi != lo && f > 0.0)
+		val = glm::mix(val, bilinear(tex->levels[hi], coord), f);
+	return val;
+}
 
-	glm::dvec3 pixel(
-		(double)data.at(start_index + 0) / 255.0,
-		(double)data.at(start_index + 1) / 255.0,
-		(double)data.at(start_index + 2) / 255.0
-		);
+glm::dvec3 TextureMap::getPixelAt(int x, int y) const
+{
+	// x is the row, y the column; clamp them to the image
+	const TextureLevel& level = tex->levels[0];
+	x = glm::clamp(x, 0, level.height - 1);
+	y = glm::clamp(y, 0, level.width - 1);
 
-	//std::cout << "pixel: " << pixel << std::endl;
-	return pixel;
+	const float* texel = level.texel(x, y);
+	return glm::dvec3(texel[0], texel[1], texel[2]);
 }
 
 glm::dvec3 MaterialParameter::value(const isect& is) const
 {
 	if (0 != _textureMap)
-		return _textureMap->getMappedValue(is.getUVCoordinates());
+		return _textureMap->getMappedValue(is.getUVCoordinates(), is.getUVdx(), is.getUVdy());
 	else
 		return _value;
 }
@@ -138,7 +142,7 @@ double MaterialParameter::intensityValue(const isect& is) const
 {
 	if (0 != _textureMap) {
 		glm::dvec3 value(
-		        _textureMap->getMappedValue(is.getUVCoordinates()));
+		        _textureMap->getMappedValue(is.getUVCoordinates(), is.getUVdx(), is.getUVdy()));
 		return (0.299 * value[0]) + (0.587 * value[1]) +
 		       (0.114 * value[2]);
 	} else
@@ -10,6 +10,7 @@
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/glm.hpp>
+#include <memory>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -17,6 +18,8 @@
 class Scene;
 class ray;
 class isect;
+class TextureData;
+struct TextureLevel;
 
 using std::string;
 
@@ -28,7 +31,10 @@ using std::string;
 */
 class TextureMap {
     public:
-       TextureMap( string filename );
+       // decode = false leaves the decoding to a later load(), so the
+       // scene can do it in the background (see Scene::getTexture)
+       TextureMap( string filename, bool decode = true );
+       void load();
 
        // Return the mapped value; here the coordinate
        // is assumed to be within the parametrization space:
@@ -36,6 +42,13 @@ class TextureMap {
        // (i.e., {(u, v): 0 <= u <= 1 and 0 <= v <= 1}
        glm::dvec3 getMappedValue( const glm::dvec2& coord ) const;
 
+       // Filtered lookup: dx and dy are how far coord moves from one
+       // pixel to the next.  The mip level is picked from that footprint
+       // and blended with the next one (trilinear filtering).  Zero
+       // derivatives give the plain bilinear lookup above.
+       glm::dvec3 getMappedValue( const glm::dvec2& coord,
+                                  const glm::dvec2& dx, const glm::dvec2& dy ) const;
+
        // Retrieve the value stored in a physical location
        // (with integer coordinates) in the bitmap.
        // Should be called from getMappedValue in order to
@@ -44,12 +57,16 @@ class TextureMap {
 
 	   int getWidth() const { return width; }
 	   int getHeight() const { return height; }
+	   const string& getFilename() const { return filename; }
 
 	  ~TextureMap() { }
 protected:
+       glm::dvec3 bilinear( const TextureLevel& level, const glm::dvec2& coord ) const;
+
+       string filename;
        int width;
        int height;
-       std::vector<uint8_t> data;
+       std::shared_ptr<const TextureData> tex;  // shared with other maps of the same file
 };
 
 class TextureMapException {
@@ -77,6 +94,8 @@ Material class is used often enough, that it is
 
 class MaterialParameter
 {
+    friend class SceneFile;  // compiled scenes store the raw fields
+    friend class MaterialTable;
 public:
     explicit MaterialParameter( const glm::dvec3& par )
       : _value( par ), _textureMap( 0 )
@@ -158,6 +177,8 @@ private:
 
 class Material
 {
+    friend class SceneFile;
+    friend class MaterialTable;  // compares the raw fields
 
 public:
     Material()
@@ -253,6 +274,12 @@ public:
 	bool Spec() const { return _spec; }
     bool Both() const { return _both; }
     bool UsesNormalMap() const { return _usesNormalMap; }
+    // any parameter read from a texture map?
+    bool Textured() const
+    {
+        return _ke.mapped() || _ka.mapped() || _ks.mapped() || _kd.mapped() || _kr.mapped() ||
+               _kt.mapped() || _shininess.mapped() || _index.mapped() || _normal.mapped();
+    }
 
 private:
     MaterialParameter _ke;                    // emissive
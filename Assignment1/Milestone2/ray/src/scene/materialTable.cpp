@@ -0,0 +1,86 @@
+#include "materialTable.h"
+#include "material.h"
+
+#include <string.h>
+
+// everything that makes two materials different, laid out flat
+struct MaterialTable::Key {
+	double values[9][3];
+	const TextureMap* maps[9];
+	unsigned char flags[8];
+};
+
+namespace {
+
+uint64_t hashBytes(const void* data, size_t size)
+{
+	// FNV-1a
+	const unsigned char* p = (const unsigned char*)data;
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= p[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+} // anonymous namespace
+
+MaterialTable::MaterialTable()
+	: count(0), requests(0)
+{
+	for (int k = 0; k < NUM_CHUNKS; k++)
+		chunks[k] = nullptr;
+}
+
+MaterialTable::~MaterialTable()
+{
+	for (int k = 0; k < NUM_CHUNKS; k++)
+		delete[] chunks[k];
+}
+
+void MaterialTable::makeKey(const Material& m, Key& key)
+{
+	memset(&key, 0, sizeof(key));
+	const MaterialParameter* params[9] = { &m._ke, &m._ka, &m._ks, &m._kd, &m._kr, &m._kt, &m._shininess, &m._index, &m._normal };
+	for (int k = 0; k < 9; k++)
+	{
+		for (int c = 0; c < 3; c++)
+			key.values[k][c] = params[k]->_value[c];
+		key.maps[k] = params[k]->_textureMap;
+	}
+	key.flags[0] = m._refl;
+	key.flags[1] = m._trans;
+	key.flags[2] = m._recur;
+	key.flags[3] = m._spec;
+	key.flags[4] = m._both;
+	key.flags[5] = m._usesNormalMap;
+}
+
+uint32_t MaterialTable::intern(const Material& m)
+{
+	Key key, other;
+	makeKey(m, key);
+	uint64_t hash = hashBytes(&key, sizeof(key));
+
+	std::lock_guard<std::mutex> lock(mtx);
+	requests++;
+	auto range = ids.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		makeKey((*this)[it->second], other);
+		if (memcmp(&key, &other, sizeof(key)) == 0)
+			return it->second;
+	}
+
+	uint32_t id = count.load(std::memory_order_relaxed);
+	uint32_t v = id + 1;
+	int k = highBit(v);
+	if (!chunks[k])
+		chunks[k] = new std::unique_ptr<Material>[1u << k];
+	chunks[k][v - (1u << k)].reset(new Material(m));
+	count.store(id + 1, std::memory_order_release);
+	ids.emplace(hash, id);
+	return id;
+}
@@ -0,0 +1,75 @@
+#ifndef __MATERIALTABLE_H__
+#define __MATERIALTABLE_H__
+
+// Every distinct material of a scene, stored once.
+//
+// Scenes repeat the same few materials over and over (every object of a
+// generated grid, every face of a mesh), so objects don't keep their own
+// copy: they intern it here and keep a 32 bit id (and the address, which
+// never changes).  Materials with the same values and the same texture
+// maps get the same id.
+//
+// Meshes are built on loader threads while the parser keeps interning, so
+// looking a material up takes no lock and must not race with intern: the
+// materials live in chunks that never move once allocated, chunk k holding
+// ids [2^k - 1, 2^(k+1) - 1).  An id is only ever looked up by a thread
+// that got it from intern (directly or through a job handed to a pool),
+// so its slot is always filled in by then.
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+class Material;
+
+class MaterialTable {
+public:
+	MaterialTable();
+	~MaterialTable();
+
+	// the id of a material equal to m, adding a copy of m if there is none
+	uint32_t intern(const Material& m);
+
+	const Material& operator[](uint32_t id) const
+	{
+		uint32_t v = id + 1;
+		int k = highBit(v);
+		return *chunks[k][v - (1u << k)];
+	}
+
+	size_t size() const { return count.load(std::memory_order_acquire); }
+	// how many materials were interned, counting repeats
+	size_t interned() const { return requests; }
+
+private:
+	MaterialTable(const MaterialTable&) = delete;
+	MaterialTable& operator=(const MaterialTable&) = delete;
+
+	struct Key;
+	static void makeKey(const Material& m, Key& key);
+
+	static int highBit(uint32_t v)
+	{
+#if defined(_MSC_VER)
+		unsigned long bit;
+		_BitScanReverse(&bit, v);
+		return (int)bit;
+#else
+		return 31 - __builtin_clz(v);
+#endif
+	}
+
+	static const int NUM_CHUNKS = 32;
+	std::unique_ptr<Material>* chunks[NUM_CHUNKS];
+	std::atomic<uint32_t> count;
+	std::unordered_multimap<uint64_t, uint32_t> ids;	// by hash of the values
+	size_t requests;
+	std::mutex mtx;
+};
+
+#endif // __MATERIALTABLE_H__
@@ -1,6 +1,6 @@
 #include "ray.h"
-#include "../ui/TraceUI.h"
 #include "material.h"
+#include "rayStats.h"
 #include "scene.h"
 
 
@@ -13,14 +13,15 @@ ray::ray(const glm::dvec3& pp,
 	 const glm::dvec3& dd,
 	 const glm::dvec3& w,
          RayType tt)
-        : p(pp), d(dd), atten(w), t(tt)
+        : p(pp), d(dd), atten(w), t(tt), has_diff(false)
 {
-	TraceUI::addRay(ray_thread_id);
+	// RayType and the ray counters are in the same order
+	RayStats::count(RayStats::Counter(RayStats::CAMERA_RAYS + tt));
 }
 
-ray::ray(const ray& other) : p(other.p), d(other.d), atten(other.atten), t(other.t)
+ray::ray(const ray& other)
+        : p(other.p), d(other.d), atten(other.atten), t(other.t), has_diff(other.has_diff), diff(other.diff)
 {
-	TraceUI::addRay(ray_thread_id);
 }
 
 ray::~ray()
@@ -33,6 +34,8 @@ ray& ray::operator=(const ray& other)
 	d     = other.d;
 	atten = other.atten;
 	t     = other.t;
+	has_diff = other.has_diff;
+	diff  = other.diff;
 	return *this;
 }
 
@@ -19,7 +19,9 @@ class SceneObject;
 class isect;
 
 /*
- * ray_thread_id: a thread local variable for statistical purpose.
+ * ray_thread_id: the render worker's index (0 .. threads-1), set by each
+ * job; picks this thread's slot in per-light caches.  Statistics don't
+ * use it, see rayStats.h.
  */
 extern thread_local unsigned int ray_thread_id;
 
@@ -48,11 +50,26 @@ public:
 	void setPosition(const glm::dvec3& pp) { p = pp; }
 	void setDirection(const glm::dvec3& dd) { d = dd; }
 
+	// Ray differentials: how the origin and direction change from one
+	// pixel to the next in x and y.  Camera rays get them from
+	// Camera::rayThrough and hand them on to their reflections and
+	// refractions; texture lookups turn them into a filter footprint.
+	struct Differentials {
+		glm::dvec3 dPdx, dPdy;
+		glm::dvec3 dDdx, dDdy;
+	};
+
+	bool hasDifferentials() const { return has_diff; }
+	const Differentials& getDifferentials() const { return diff; }
+	void setDifferentials(const Differentials& dd) { diff = dd; has_diff = true; }
+
 private:
 	glm::dvec3 p;
 	glm::dvec3 d;
 	glm::dvec3 atten;
 	RayType t;
+	bool has_diff;
+	Differentials diff;
 };
 
 
@@ -60,7 +77,7 @@ private:
 
 class isect {
 public:
-	isect() : obj(NULL), t(0.0), N(), material(nullptr) {}
+	isect() : obj(NULL), prim(NULL), t(0.0), N(), uvDx(0.0), uvDy(0.0), material(nullptr) {}
 	isect(const isect& other)
 	{
 		copyFromOther(other);
@@ -74,7 +91,13 @@ public:
 		return *this;
 	}
 
-	void setObject(const SceneObject* o) { obj = o; }
+	void setObject(const SceneObject* o) { obj = prim = o; }
+	const SceneObject* getObject() const { return obj; }
+	// the primitive that was actually hit, when the hit is reported as a
+	// bigger object (a mesh face for its mesh); intersect this one to hit
+	// the same surface again.  Set after setObject.
+	void setPrimitive(const SceneObject* p) { prim = p; }
+	const SceneObject* getPrimitive() const { return prim; }
 
 	// Get/Set Time of flight
 	void setT(double tt) { t = tt; }
@@ -95,6 +118,15 @@ public:
 		uvCoordinates = coords;
 	}
 	glm::dvec2 getUVCoordinates() const { return uvCoordinates; }
+	// change of the uv coordinates to the neighbouring pixels, zero when
+	// the ray had no differentials
+	void setUVDifferentials(const glm::dvec2& dx, const glm::dvec2& dy)
+	{
+		uvDx = dx;
+		uvDy = dy;
+	}
+	glm::dvec2 getUVdx() const { return uvDx; }
+	glm::dvec2 getUVdy() const { return uvDy; }
 	void setBary(const glm::dvec3& weights) { bary = weights; }
 	void setBary(const double alpha, const double beta, const double gamma)
 	{
@@ -108,10 +140,13 @@ private:
 		if (this == &other)
 			return ;
 		obj           = other.obj;
+		prim          = other.prim;
 		t             = other.t;
 		N             = other.N;
 		bary          = other.bary;
 		uvCoordinates = other.uvCoordinates;
+		uvDx          = other.uvDx;
+		uvDy          = other.uvDy;
 		if (other.material) {
 			setMaterial(*other.material);
 		} else {
@@ -120,9 +155,11 @@ private:
 	}
 
 	const SceneObject* obj;
+	const SceneObject* prim;
 	double t;
 	glm::dvec3 N;
 	glm::dvec2 uvCoordinates;
+	glm::dvec2 uvDx, uvDy;
 	glm::dvec3 bary;
 
 	// if this intersection has its own material
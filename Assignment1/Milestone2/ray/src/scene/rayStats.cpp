@@ -0,0 +1,114 @@
+#include "rayStats.h"
+
+#include <mutex>
+#include <new>
+
+namespace {
+
+std::mutex blocksMutex;
+
+} // anonymous namespace
+
+// gives the thread's block back when the thread exits
+struct RayStatsOwner {
+	RayStats::Block* block = nullptr;
+	~RayStatsOwner()
+	{
+		if (block)
+			RayStats::detach(block);
+	}
+};
+
+namespace {
+
+thread_local RayStatsOwner owner;
+
+} // anonymous namespace
+
+thread_local RayStats::Block* RayStats::local = nullptr;
+RayStats::Block* RayStats::blocks = nullptr;
+RayStats::Block* RayStats::free_blocks = nullptr;
+
+RayStats::Block* RayStats::attach()
+{
+	Block* b;
+	{
+		std::lock_guard<std::mutex> lock(blocksMutex);
+		if (free_blocks)
+		{
+			b = free_blocks;
+			free_blocks = b->next_free;
+		}
+		else
+		{
+			// new doesn't have to honour alignas(64) before C++17, so
+			// line the block up by hand.  Blocks are reused, never freed.
+			char* raw = (char*)::operator new(sizeof(Block) + alignof(Block));
+			uintptr_t p = ((uintptr_t)raw + alignof(Block) - 1) & ~(uintptr_t)(alignof(Block) - 1);
+			b = new ((void*)p) Block;
+			for (auto& c : b->counts)
+				c.store(0, std::memory_order_relaxed);
+			b->next = blocks;
+			blocks = b;
+		}
+		b->next_free = nullptr;
+	}
+	owner.block = b;
+	local = b;
+	return b;
+}
+
+void RayStats::detach(Block* b)
+{
+	std::lock_guard<std::mutex> lock(blocksMutex);
+	b->next_free = free_blocks;
+	free_blocks = b;
+	local = nullptr;
+}
+
+RayStats::Totals RayStats::total()
+{
+	Totals t;
+	std::lock_guard<std::mutex> lock(blocksMutex);
+	for (Block* b = blocks; b; b = b->next)
+		for (int c = 0; c < NUM_COUNTERS; c++)
+			t.counts[c] += b->counts[c].load(std::memory_order_relaxed);
+	return t;
+}
+
+RayStats::Totals RayStats::reset()
+{
+	Totals t;
+	std::lock_guard<std::mutex> lock(blocksMutex);
+	for (Block* b = blocks; b; b = b->next)
+		for (int c = 0; c < NUM_COUNTERS; c++)
+			t.counts[c] += b->counts[c].exchange(0, std::memory_order_relaxed);
+	return t;
+}
+
+uint64_t RayStats::Totals::primitiveTests() const
+{
+	uint64_t n = 0;
+	for (int c = SPHERE_TESTS; c <= TRIANGLE_TESTS; c++)
+		n += counts[c];
+	return n;
+}
+
+RayStats::Totals& RayStats::Totals::operator+=(const Totals& other)
+{
+	for (int c = 0; c < NUM_COUNTERS; c++)
+		counts[c] += other.counts[c];
+	return *this;
+}
+
+const char* RayStats::name(Counter c)
+{
+	static const char* names[NUM_COUNTERS] = {
+		"camera rays", "reflection rays", "refraction rays", "shadow rays",
+		"pruned rays", "BVH nodes", "bounding box tests",
+		"sphere tests", "box tests", "square tests", "cylinder tests",
+		"cone tests", "triangle tests",
+		"shadow cache tests", "shadow cache hits"
+	};
+	return c >= 0 && c < NUM_COUNTERS ? names[c] : "?";
+}
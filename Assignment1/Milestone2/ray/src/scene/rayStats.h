@@ -0,0 +1,90 @@
+#ifndef __RAYSTATS_H__
+#define __RAYSTATS_H__
+
+// Render statistics.
+//
+// Every thread that counts something gets its own block of counters,
+// aligned to a cache line, the first time it counts; only that thread
+// ever writes to it, so counting is a plain add with no locking and no
+// cache line bouncing between threads.  total() adds up the blocks of
+// every thread when the numbers are wanted.  Blocks of threads that
+// have exited are handed to the next new thread (their counts stay in
+// the total), so any number of threads can come and go.
+
+#include <atomic>
+#include <stdint.h>
+
+class RayStats {
+public:
+	enum Counter {
+		// rays created, by ray::RayType
+		CAMERA_RAYS,
+		REFLECTION_RAYS,
+		REFRACTION_RAYS,
+		SHADOW_RAYS,
+		PRUNED_RAYS,		// never traced, see RayTracer::traceRay
+		// acceleration structure
+		BVH_NODES,			// BVH nodes whose box the ray hit
+		BBOX_TESTS,			// ray / bounding box tests, nodes and objects
+		// ray / primitive tests
+		SPHERE_TESTS,
+		BOX_TESTS,
+		SQUARE_TESTS,
+		CYLINDER_TESTS,
+		CONE_TESTS,
+		TRIANGLE_TESTS,
+		// shadow occluder cache, see Light::blockedByLastOccluder
+		SHADOW_CACHE_TESTS,
+		SHADOW_CACHE_HITS,
+		NUM_COUNTERS
+	};
+
+	// add n to this thread's counter c
+	static void count(Counter c, uint64_t n = 1)
+	{
+		Block* b = local;
+		if (!b)
+			b = attach();
+		// relaxed load and store: only this thread writes, so no lock
+		// prefix is needed, but total() may read at any time
+		b->counts[c].store(b->counts[c].load(std::memory_order_relaxed) + n,
+		                   std::memory_order_relaxed);
+	}
+
+	struct Totals {
+		uint64_t counts[NUM_COUNTERS] = {};
+
+		uint64_t operator[](Counter c) const { return counts[c]; }
+		// every ray created (not counting pruned ones)
+		uint64_t rays() const
+		{
+			return counts[CAMERA_RAYS] + counts[REFLECTION_RAYS] +
+			       counts[REFRACTION_RAYS] + counts[SHADOW_RAYS];
+		}
+		uint64_t primitiveTests() const;
+		Totals& operator+=(const Totals& other);
+	};
+
+	// the sum over every thread so far
+	static Totals total();
+	// total(), and start counting from zero
+	static Totals reset();
+
+	static const char* name(Counter c);
+
+private:
+	struct alignas(64) Block {
+		std::atomic<uint64_t> counts[NUM_COUNTERS];
+		Block* next;		// all blocks
+		Block* next_free;	// next in free_blocks
+	};
+
+	static thread_local Block* local;
+	static Block* blocks;		// every block, guarded by a mutex
+	static Block* free_blocks;	// blocks of exited threads
+	static Block* attach();
+	static void detach(Block* b);
+	friend struct RayStatsOwner;
+};
+
+#endif // __RAYSTATS_H__
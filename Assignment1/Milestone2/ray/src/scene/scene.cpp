@@ -3,17 +3,27 @@
 #include "scene.h"
 #include "light.h"
 #include "kdTree.h"
+#include "rayStats.h"
+#include "../SceneObjects/trimesh.h"
 #include "../ui/TraceUI.h"
 #include <glm/gtx/extended_min_max.hpp>
+#include <chrono>
 #include <iostream>
 #include <glm/gtx/io.hpp>
 
 
 using namespace std;
 
+extern TraceUI* traceUI;
+
 bool Geometry::intersect(ray& r, isect& i) const {
 	double tmin, tmax;
-	if (hasBoundingBoxCapability() && !(bounds.intersect(r, tmin, tmax))) return false;
+	if (hasBoundingBoxCapability())
+	{
+		RayStats::count(RayStats::BBOX_TESTS);
+		if (!bounds.intersect(r, tmin, tmax))
+			return false;
+	}
 	// Transform the ray into the object's local coordinate space
 	glm::dvec3 pos = transform->globalToLocalCoords(r.getPosition());
 	glm::dvec3 dir = transform->globalToLocalCoords(r.getPosition() + r.getDirection()) - pos;
@@ -90,6 +100,25 @@ void Geometry::ComputeBoundingBox() {
     bounds.setMin(glm::dvec3(newMin));
 }
 
+MaterialSceneObject::MaterialSceneObject(Scene* scene, Material* mat)
+	: SceneObject(scene)
+{
+	setMaterial(mat);
+}
+
+MaterialSceneObject::MaterialSceneObject(Scene* scene, uint32_t material_id)
+	: SceneObject(scene), material(&scene->materials()[material_id]),
+	  material_id(material_id)
+{
+}
+
+void MaterialSceneObject::setMaterial(Material* m)
+{
+	std::unique_ptr<Material> owned(m);
+	material_id = scene->materials().intern(*m);
+	material = &scene->materials()[material_id];
+}
+
 void MaterialSceneObject::compute_centroid()
 {
 	BoundingBox bb = getBoundingBox();
@@ -100,11 +129,14 @@ void MaterialSceneObject::compute_centroid()
 Scene::Scene()
 {
 	ambientIntensity = glm::dvec3(0, 0, 0);
+	load_us[LOAD_TEXTURES] = load_us[LOAD_MESHES] = 0;
 }
 
 Scene::~Scene()
 {
-
+	// jobs still queued (loading failed) would touch what is destroyed
+	loader.cancel();
+	loader.wait();
 }
 
 void Scene::add(Geometry* obj) {
@@ -126,8 +158,9 @@ void Scene::add_node(BVH_node* node)
 void Scene::add_bvh(MaterialSceneObject* obj, std::string type)
 {
 	// make sure object is not already in bvh_objects
-	if (std::find(bvh_objects.begin(), bvh_objects.end(), obj) == bvh_objects.end())
+	if (!obj->in_bvh)
 	{
+		obj->in_bvh = true;
 		obj->ComputeBoundingBox();
 		obj->compute_centroid();
 		// used to check that vector swaps were working
@@ -209,15 +242,172 @@ bool Scene::intersect(ray& r, isect& i, bool only_bb) const {
 	return have_one;
 }
 
+// lights per leaf of the light BVH
+#define LIGHT_LEAF_SIZE 4
+
+void Scene::build_light_BVH(double cutoff)
+{
+	if (cutoff == light_cutoff)
+		return;
+	light_cutoff = cutoff;
+	global_lights.clear();
+	bounded_lights.clear();
+	light_nodes.clear();
+
+	for (const auto& light : lights)
+	{
+		BoundedLight bl;
+		double radius;
+		if (cutoff > 0.0 && light->influenceSphere(cutoff, bl.center, radius))
+		{
+			// lights too dim to ever matter are dropped entirely
+			if (radius <= 0.0)
+				continue;
+			bl.light = light.get();
+			bl.radius2 = radius * radius;
+			bounded_lights.push_back(bl);
+		}
+		else
+		{
+			global_lights.push_back(light.get());
+		}
+	}
+
+	if (!bounded_lights.empty())
+		build_light_node(0, (int)bounded_lights.size());
+}
+
+int Scene::build_light_node(int first, int count)
+{
+	int index = (int)light_nodes.size();
+	light_nodes.push_back(LightNode());
+
+	glm::dvec3 bmin(1e30), bmax(-1e30);
+	glm::dvec3 cmin(1e30), cmax(-1e30);
+	for (int k = first; k < first + count; k++)
+	{
+		const BoundedLight& bl = bounded_lights[k];
+		double r = std::sqrt(bl.radius2);
+		bmin = glm::min(bmin, bl.center - glm::dvec3(r));
+		bmax = glm::max(bmax, bl.center + glm::dvec3(r));
+		cmin = glm::min(cmin, bl.center);
+		cmax = glm::max(cmax, bl.center);
+	}
+
+	int left = 0, right = 0;
+	if (count > LIGHT_LEAF_SIZE)
+	{
+		// median split of the centers along the widest axis
+		glm::dvec3 extent = cmax - cmin;
+		int axis = 0;
+		if (extent.y > extent.x) axis = 1;
+		if (extent.z > extent[axis]) axis = 2;
+		int half = count / 2;
+		std::nth_element(bounded_lights.begin() + first, bounded_lights.begin() + first + half,
+		                 bounded_lights.begin() + first + count,
+		                 [axis](const BoundedLight& a, const BoundedLight& b) { return a.center[axis] < b.center[axis]; });
+		left = build_light_node(first, half);
+		right = build_light_node(first + half, count - half);
+	}
+
+	// light_nodes may have grown, so only touch the node now
+	LightNode& node = light_nodes[index];
+	node.bmin = bmin;
+	node.bmax = bmax;
+	node.left = left;
+	node.right = right;
+	node.first = first;
+	node.count = count;
+	return index;
+}
+
 TextureMap* Scene::getTexture(string name) {
 	auto itr = textureCache.find(name);
 	if (itr == textureCache.end()) {
-		textureCache[name].reset(new TextureMap(name));
-		return textureCache[name].get();
+		TextureMap* map = new TextureMap(name, false);
+		textureCache[name].reset(map);
+		load_stats.textures++;
+		loadAsync(LOAD_TEXTURES, [map] { map->load(); });
+		return map;
 	}
 	return itr->second.get();
 }
 
+void Scene::loadAsync(LoadStage stage, std::function<void()> job)
+{
+	// once loading is over there is nothing to overlap with
+	if (!loading)
+	{
+		job();
+		return;
+	}
+	if (loader.size() == 0)
+		loader.resize(std::max(traceUI ? traceUI->getThreads() : 1, 1));
+
+	std::atomic<long long>* busy = &load_us[stage];
+	load_jobs.push_back(loader.submit([busy, job] {
+		auto start = std::chrono::steady_clock::now();
+		job();
+		*busy += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	}));
+}
+
+void Scene::add_mesh(Trimesh* mesh, std::function<void()> build)
+{
+	pending_meshes.emplace_back(bvh_objects.size(), mesh);
+	load_stats.meshes++;
+	loadAsync(LOAD_MESHES, [mesh, build] {
+		build();
+		// what add_bvh does for each face
+		for (auto face : mesh->get_faces())
+		{
+			face->in_bvh = true;
+			face->ComputeBoundingBox();
+			face->compute_centroid();
+		}
+	});
+}
+
+void Scene::finishLoading()
+{
+	auto start = std::chrono::steady_clock::now();
+	std::exception_ptr error;
+	for (auto& job : load_jobs)
+	{
+		try {
+			job.get();
+		} catch (...) {
+			if (!error)
+				error = std::current_exception();
+		}
+	}
+	load_jobs.clear();
+	loader.resize(0);
+	loading = false;
+	load_stats.wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	load_stats.texture_ms = load_us[LOAD_TEXTURES] / 1000.0;
+	load_stats.mesh_ms = load_us[LOAD_MESHES] / 1000.0;
+	if (error)
+		std::rethrow_exception(error);
+
+	// splice the mesh faces in where their meshes were added
+	if (!pending_meshes.empty())
+	{
+		std::vector<MaterialSceneObject*> merged;
+		size_t next = 0;
+		for (auto& pending : pending_meshes)
+		{
+			merged.insert(merged.end(), bvh_objects.begin() + next, bvh_objects.begin() + pending.first);
+			next = pending.first;
+			for (auto face : pending.second->get_faces())
+				merged.push_back(face);
+		}
+		merged.insert(merged.end(), bvh_objects.begin() + next, bvh_objects.end());
+		bvh_objects.swap(merged);
+		pending_meshes.clear();
+	}
+}
+
 /* N is the number of objects in the scene */
 void Scene::generate_BVH()
 {
@@ -260,6 +450,45 @@ void Scene::update_node_bounds(int node_index)
 	//std::cout << "updated node bounds -> node: " << node_index << ", aabb.min: " << node->aabb_min << ", aabb.max: " << node->aabb_max << std::endl;
 }
 
+void Scene::update_scene_bounds()
+{
+	sceneBounds = BoundingBox();
+	for (const auto& obj : objects)
+		sceneBounds.merge(obj->getBoundingBox());
+}
+
+double Scene::refit_BVH()
+{
+	update_scene_bounds();
+
+	// children are always stored after their parent, so walking the array
+	// backwards visits every node after both of its children
+	double cost = 0.0;
+	for (int j = (int)bvh_node_array.size() - 1; j >= 0; j--)
+	{
+		BVH_node* node = bvh_node_array.at(j).get();
+		if (node->prim_count > 0)
+		{
+			update_node_bounds(j);
+		}
+		else if (node->left_child != 0)
+		{
+			node->bb = bvh_node_array.at(node->left_child)->bb;
+			node->bb.merge(bvh_node_array.at(node->right_child)->bb);
+		}
+		cost += node->bb.area();
+	}
+	return cost;
+}
+
+void Scene::rebuild_BVH()
+{
+	update_scene_bounds();
+	bvh_node_array.clear();
+	used_nodes = 1;
+	generate_BVH();
+}
+
 void Scene::subdivide_node(int node_index)
 {
 	// get node and terminate reccursion once node contains one or zero prims
@@ -325,10 +554,12 @@ bool Scene::intersect_BVH(ray& r, isect& i, const int node_index) const
 	//std::cout << "intersecting BVH, node: " << node_index << " with " << node->prim_count << " nodes." << std::endl;
 	double tmin = 0;
 	double tmax = 0;
+	RayStats::count(RayStats::BBOX_TESTS);
 	if (!node->bb.intersect(r, tmin, tmax))
 	{
 		return false;
 	}
+	RayStats::count(RayStats::BVH_NODES);
 	// check if node is a leaf node
 	//std::cout << "node->prim_count: " << node->prim_count << std::endl;
 	if (node->prim_count > 0)
@@ -10,6 +10,9 @@
 #define __SCENE_H__
 
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
@@ -19,7 +22,9 @@
 #include "bbox.h"
 #include "camera.h"
 #include "material.h"
+#include "materialTable.h"
 #include "ray.h"
+#include "../ThreadPool.h"
 
 #include <glm/geometric.hpp>
 #include <glm/mat3x3.hpp>
@@ -112,6 +117,18 @@ public:
 
 	const glm::dmat4x4& transform() const { return xform; }
 
+	// replace this node's own transformation (relative to its parent) and
+	// carry the change down to every node below it
+	void setLocalTransform(const glm::dmat4x4& local)
+	{
+		glm::dmat4x4 oldInverse = inverse;
+		xform = parent ? parent->xform * local : local;
+		inverse = glm::inverse(xform);
+		normi = glm::transpose(glm::inverse(glm::dmat3x3(xform)));
+		for (auto c : children)
+			c->setLocalTransform(oldInverse * c->xform);
+	}
+
 protected:
 	// protected so that users can't directly construct one of these...
 	// force them to use the createChild() method.  Note that they CAN
@@ -162,6 +179,7 @@ public:
 	{
 		this->transform = transform;
 	};
+	TransformNode* getTransform() const { return transform; }
 
 	Geometry(Scene* scene) : SceneElement(scene) {}
 
@@ -199,30 +217,37 @@ protected:
 };
 
 // A simple extension of SceneObject that adds an instance of Material
-// for simple material bindings.
+// for simple material bindings.  The material itself lives in the
+// scene's material table (see materialTable.h); objects with equal
+// materials share one entry.
 class MaterialSceneObject : public SceneObject {
 public:
 	virtual ~MaterialSceneObject() {}
 
 	virtual const Material& getMaterial() const { return *material; }
-	virtual void setMaterial(Material* m) { material.reset(m); }
+	// interns m into the scene's table and deletes it
+	virtual void setMaterial(Material* m);
+	uint32_t getMaterialId() const { return material_id; }
 
 	// used to compute and store centroid of a geometry
 	virtual void compute_centroid();
 	glm::dvec3 centroid;
 	int insert_index = -1;
+	bool in_bvh = false;	// already in the scene's bvh_objects
 
 protected:
-	MaterialSceneObject(Scene* scene, Material* mat)
-	        : SceneObject(scene), material(mat)
-	{
-	}
+	// takes mat like setMaterial
+	MaterialSceneObject(Scene* scene, Material* mat);
+	MaterialSceneObject(Scene* scene, uint32_t material_id);
 
-	unique_ptr<Material> material;
+	const Material* material;	// entry material_id of the table
+	uint32_t material_id;
 };
 
 // code for BVH generation created by following tutorial:
 // https://jacco.ompf2.com/2022/04/13/how-to-build-a-bvh-part-1-basics/
+class Trimesh;
+
 class BVH_node
 {
 public:
@@ -263,6 +288,14 @@ public:
 	auto endLights() const { return lights.end(); }
 	const auto& getAllLights() const { return lights; }
 
+	// build the light BVH for this cutoff (no-op if it is already built
+	// for it).  A cutoff of 0 keeps every light everywhere.
+	void build_light_BVH(double cutoff);
+	// call f(const Light*) for every light that can add more than the
+	// cutoff at p.  Lights that reach everywhere come first, in scene order.
+	template <typename F>
+	void forEachLight(const glm::dvec3& p, F f) const;
+
 	auto beginObjects() const { return objects.cbegin(); }
 	auto endObjects() const { return objects.cend(); }
 
@@ -271,9 +304,31 @@ public:
 
 	// For efficiency reasons, we'll store texture maps in a cache
 	// in the Scene.  This makes sure they get deleted when the scene
-	// is destroyed.
+	// is destroyed.  New textures are decoded in the background.
 	TextureMap* getTexture(string name);
 
+	// Loading is pipelined: texture decodes and mesh builds run on
+	// background threads as soon as their data has been read, while the
+	// reader keeps going.  add_mesh queues build (adding the faces,
+	// normals) and then the face bounds; the faces join the BVH list
+	// where the mesh was added, as if add_bvh had been called for each.
+	// finishLoading waits for all of it and rethrows the first error;
+	// it has to be called before the BVH is built.
+	void add_mesh(Trimesh* mesh, std::function<void()> build);
+	void finishLoading();
+
+	struct LoadStats {
+		int textures = 0, meshes = 0;
+		double texture_ms = 0.0;	// decoding, summed over the threads
+		double mesh_ms = 0.0;		// mesh builds, summed over the threads
+		double wait_ms = 0.0;		// finishLoading blocked this long
+	};
+	const LoadStats& loadStats() const { return load_stats; }
+
+	// every distinct material in the scene, by id
+	MaterialTable& materials() { return material_table; }
+	const MaterialTable& materials() const { return material_table; }
+
 	// These two functions are for handling ambient light; in the Phong
 	// model,
 	// the "ambient" light is considered a property of the _scene_ as a
@@ -293,6 +348,11 @@ public:
 	// public BVH methods
 	void generate_BVH();
 	bool intersect_BVH(ray& r, isect& i, const int node_index) const;
+	// recompute the node boxes after objects moved, keeping the tree layout.
+	// returns the summed surface area of the nodes as a rough traversal cost
+	double refit_BVH();
+	// throw the tree away and build it again from the current object bounds
+	void rebuild_BVH();
 
 private:
 	// variables and methods for BVH
@@ -300,10 +360,30 @@ private:
 	int used_nodes = 1;
 	int bvh_object_insert_index = 1;
 	void update_node_bounds(int node_index);
+	void update_scene_bounds();
 	void subdivide_node(int node_index);
 	std::vector<std::unique_ptr<BVH_node>> bvh_node_array; // list of nodes that will act as a tree
 
+	// light BVH: bounded lights are spheres of influence grouped by a
+	// small tree, the rest are checked for every shading point
+	struct BoundedLight {
+		const Light* light;
+		glm::dvec3 center;
+		double radius2;
+	};
+	struct LightNode {
+		glm::dvec3 bmin, bmax;
+		int left, right;		// children, 0 for a leaf
+		int first, count;		// range in bounded_lights for a leaf
+	};
+	double light_cutoff = -1.0;	// cutoff the light BVH was built for, < 0 if never
+	std::vector<const Light*> global_lights;
+	std::vector<BoundedLight> bounded_lights;
+	std::vector<LightNode> light_nodes;
+	int build_light_node(int first, int count);
+
 	// default private vars
+	MaterialTable material_table;
 	std::vector<MaterialSceneObject*> bvh_objects;
 	std::vector<std::unique_ptr<Geometry>> objects;
 	std::vector<std::unique_ptr<Light>> lights;
@@ -325,6 +405,16 @@ private:
 
 	KdTree<Geometry>* kdtree;
 
+	// background loading, see finishLoading
+	enum LoadStage { LOAD_TEXTURES, LOAD_MESHES };
+	void loadAsync(LoadStage stage, std::function<void()> job);
+	ThreadPool loader;
+	std::vector<std::future<void>> load_jobs;
+	std::vector<std::pair<size_t, Trimesh*>> pending_meshes;	// bvh_objects position, mesh
+	std::atomic<long long> load_us[2];
+	bool loading = true;
+	LoadStats load_stats;
+
 	mutable std::mutex intersectionCacheMutex;
 
 public:
@@ -346,4 +436,47 @@ public:
 	mutable std::vector<std::pair<ray*, isect*>> intersectCache;
 };
 
+template <typename F>
+void Scene::forEachLight(const glm::dvec3& p, F f) const
+{
+	// not built yet (e.g. debugging rays traced outside a render)
+	if (light_cutoff < 0.0)
+	{
+		for (const auto& light : lights)
+			f(light.get());
+		return;
+	}
+
+	for (const Light* light : global_lights)
+		f(light);
+	if (light_nodes.empty())
+		return;
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const LightNode& node = light_nodes[stack[--top]];
+		if (p.x < node.bmin.x || p.y < node.bmin.y || p.z < node.bmin.z ||
+		    p.x > node.bmax.x || p.y > node.bmax.y || p.z > node.bmax.z)
+			continue;
+		if (node.left == 0)
+		{
+			for (int k = node.first; k < node.first + node.count; k++)
+			{
+				const BoundedLight& bl = bounded_lights[k];
+				glm::dvec3 d = p - bl.center;
+				if (glm::dot(d, d) <= bl.radius2)
+					f(bl.light);
+			}
+		}
+		else
+		{
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		}
+	}
+}
+
 #endif // __SCENE_H__
@@ -0,0 +1,652 @@
+#include "sceneFile.h"
+#include "scene.h"
+#include "light.h"
+#include "material.h"
+#include "../fileio/mappedfile.h"
+#include "../parser/ParserException.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+#include "../SceneObjects/trimesh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#endif
+
+using std::string;
+
+namespace {
+
+// Layout: the header, then every table and mesh array at its own 64 byte
+// aligned offset.  Sections are (byte offset, element count).  Numbers
+// are stored in the writer's byte order; the header records it.
+struct Section {
+	uint64_t offset;
+	uint64_t count;
+};
+
+struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t file_size;
+	Section camera;			// one CameraRecord
+	Section transforms;		// TransformRecord
+	Section materials;		// MaterialRecord
+	Section textures;		// TextureRecord, names are in text
+	Section text;			// chars
+	Section lights;			// LightRecord
+	Section objects;		// ObjectRecord, in scene order
+	Section meshes;			// MeshRecord
+	double ambient[3];
+	double pad;
+};
+
+struct CameraRecord {
+	double m[9];
+	double normalized_height, aspect_ratio;
+	double eye[3], look[3], u[3], v[3];
+};
+
+// world space, already multiplied out through the parents
+struct TransformRecord {
+	double m[16];
+};
+
+struct TextureRecord {
+	uint64_t offset, length;
+};
+
+struct ParamRecord {
+	double value[3];
+	int32_t texture;		// index into textures, -1 if not mapped
+	uint32_t pad;
+};
+
+struct MaterialRecord {
+	ParamRecord ke, ka, ks, kd, kr, kt, shininess, index, normal;
+	uint8_t refl, trans, recur, spec, both, uses_normal_map, pad[2];
+};
+
+enum { LIGHT_POINT, LIGHT_DIRECTIONAL };
+
+struct LightRecord {
+	uint32_t type;
+	float constant, linear, quadratic;
+	double color[3];
+	double vec[3];			// position or direction
+};
+
+enum { OBJECT_SPHERE, OBJECT_BOX, OBJECT_SQUARE, OBJECT_CYLINDER, OBJECT_CONE, OBJECT_TRIMESH };
+
+struct ObjectRecord {
+	uint32_t type;
+	uint32_t material;
+	uint32_t transform;
+	uint32_t mesh;			// trimeshes only
+	double height, bottom_radius, top_radius;	// cones only
+	uint32_t capped, pad;
+};
+
+struct MeshRecord {
+	Section vertices;		// 3 doubles each
+	Section normals;		// 3 doubles each, none or one per vertex
+	Section faces;			// 3 uint32 vertex indices each
+	Section materials;		// uint32 material per vertex, or none
+	uint32_t vert_norms, pad;
+};
+
+const char SCENE_MAGIC[8] = { 'R', 'A', 'Y', 'S', 'C', 'N', 'B', 0 };
+const uint32_t SCENE_VERSION = 1;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+static_assert(sizeof(glm::dvec3) == 3 * sizeof(double), "mesh arrays are used as glm::dvec3 in place");
+
+void copy3(double* dst, const glm::dvec3& v)
+{
+	dst[0] = v[0];
+	dst[1] = v[1];
+	dst[2] = v[2];
+}
+
+glm::dvec3 vec3(const double* v)
+{
+	return glm::dvec3(v[0], v[1], v[2]);
+}
+
+string absolutePath(const string& path)
+{
+	if (path.empty() || path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'))
+		return path;
+	char cwd[4096];
+	if (!getcwd(cwd, sizeof(cwd)))
+		return path;
+	string p = path;
+	while (p.compare(0, 2, "./") == 0)
+		p = p.substr(2);
+	return string(cwd) + "/" + p;
+}
+
+bool fileExists(const string& path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0;
+}
+
+// writes sections at 64 byte boundaries
+class Output {
+public:
+	Output(const string& filename) : out(filename, std::ios::binary | std::ios::trunc), pos(0) {}
+
+	template <typename T>
+	Section put(const T* data, size_t count)
+	{
+		static const char zeros[64] = {};
+		size_t aligned = (pos + 63) & ~size_t(63);
+		out.write(zeros, aligned - pos);
+		out.write((const char*)data, count * sizeof(T));
+		Section s = { aligned, count };
+		pos = aligned + count * sizeof(T);
+		return s;
+	}
+
+	template <typename T>
+	Section put(const std::vector<T>& v) { return put(v.data(), v.size()); }
+
+	void rewrite(const void* data, size_t bytes)
+	{
+		out.seekp(0);
+		out.write((const char*)data, bytes);
+	}
+
+	uint64_t size() const { return pos; }
+
+	bool close()
+	{
+		out.close();
+		return (bool)out;
+	}
+
+private:
+	std::ofstream out;
+	size_t pos;
+};
+
+void loadError(const string& filename, const string& msg)
+{
+	throw ParserException(filename + ": " + msg);
+}
+
+} // anonymous namespace
+
+// collects the tables while the scene is walked, sharing equal entries
+class SceneFile::Writer {
+public:
+	std::vector<TransformRecord> transforms;
+	std::vector<MaterialRecord> materials;
+	std::vector<TextureRecord> textures;
+	string text;
+
+	uint32_t transform(const TransformNode* node)
+	{
+		TransformRecord rec;
+		memcpy(rec.m, &node->transform()[0][0], sizeof(rec.m));
+		return intern(transformIds, transforms, rec);
+	}
+
+	uint32_t material(const Material& m)
+	{
+		MaterialRecord rec;
+		memset(&rec, 0, sizeof(rec));
+		param(rec.ke, m._ke);
+		param(rec.ka, m._ka);
+		param(rec.ks, m._ks);
+		param(rec.kd, m._kd);
+		param(rec.kr, m._kr);
+		param(rec.kt, m._kt);
+		param(rec.shininess, m._shininess);
+		param(rec.index, m._index);
+		param(rec.normal, m._normal);
+		rec.refl = m._refl;
+		rec.trans = m._trans;
+		rec.recur = m._recur;
+		rec.spec = m._spec;
+		rec.both = m._both;
+		rec.uses_normal_map = m._usesNormalMap;
+		return intern(materialIds, materials, rec);
+	}
+
+private:
+	std::map<string, uint32_t> transformIds, materialIds, textureIds;
+
+	// equal records (byte for byte) get the same index
+	template <typename T>
+	uint32_t intern(std::map<string, uint32_t>& ids, std::vector<T>& table, const T& rec)
+	{
+		string key((const char*)&rec, sizeof(rec));
+		auto it = ids.find(key);
+		if (it != ids.end())
+			return it->second;
+		uint32_t id = (uint32_t)table.size();
+		table.push_back(rec);
+		ids[key] = id;
+		return id;
+	}
+
+	void param(ParamRecord& rec, const MaterialParameter& p)
+	{
+		copy3(rec.value, p._value);
+		rec.texture = p._textureMap ? (int32_t)texture(p._textureMap->getFilename()) : -1;
+	}
+
+	uint32_t texture(const string& name)
+	{
+		string path = absolutePath(name);
+		auto it = textureIds.find(path);
+		if (it != textureIds.end())
+			return it->second;
+		uint32_t id = (uint32_t)textures.size();
+		textures.push_back(TextureRecord{ text.size(), path.size() });
+		text += path;
+		textureIds[path] = id;
+		return id;
+	}
+};
+
+bool SceneFile::isCompiled(const string& filename)
+{
+	if (filename.size() < 5)
+		return false;
+	string ext = filename.substr(filename.size() - 5);
+	for (auto& c : ext)
+		c = (char)tolower(c);
+	return ext == ".rayb";
+}
+
+void SceneFile::save(const Scene& scene, const string& filename)
+{
+	Writer w;
+	std::vector<LightRecord> lights;
+	std::vector<ObjectRecord> objects;
+	std::vector<const Trimesh*> meshes;
+
+	const Camera& cam = scene.getCamera();
+	CameraRecord camera;
+	memcpy(camera.m, &cam.m[0][0], sizeof(camera.m));
+	camera.normalized_height = cam.normalizedHeight;
+	camera.aspect_ratio = cam.aspectRatio;
+	copy3(camera.eye, cam.eye);
+	copy3(camera.look, cam.look);
+	copy3(camera.u, cam.u);
+	copy3(camera.v, cam.v);
+
+	for (const auto& light : scene.getAllLights())
+	{
+		LightRecord rec;
+		memset(&rec, 0, sizeof(rec));
+		if (auto pl = dynamic_cast<const PointLight*>(light.get()))
+		{
+			rec.type = LIGHT_POINT;
+			rec.constant = pl->constantTerm;
+			rec.linear = pl->linearTerm;
+			rec.quadratic = pl->quadraticTerm;
+			copy3(rec.color, pl->color);
+			copy3(rec.vec, pl->position);
+		}
+		else if (auto dl = dynamic_cast<const DirectionalLight*>(light.get()))
+		{
+			rec.type = LIGHT_DIRECTIONAL;
+			copy3(rec.color, dl->color);
+			copy3(rec.vec, dl->orientation);
+		}
+		else
+			loadError(filename, "can't compile this kind of light");
+		lights.push_back(rec);
+	}
+
+	for (auto it = scene.beginObjects(); it != scene.endObjects(); ++it)
+	{
+		const Geometry* g = it->get();
+		const SceneObject* obj = dynamic_cast<const SceneObject*>(g);
+		if (!obj)
+			loadError(filename, "can't compile this kind of object");
+
+		ObjectRecord rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.material = w.material(obj->getMaterial());
+		rec.transform = w.transform(obj->getTransform());
+		if (dynamic_cast<const Sphere*>(g))
+			rec.type = OBJECT_SPHERE;
+		else if (dynamic_cast<const Box*>(g))
+			rec.type = OBJECT_BOX;
+		else if (dynamic_cast<const Square*>(g))
+			rec.type = OBJECT_SQUARE;
+		else if (auto cyl = dynamic_cast<const Cylinder*>(g))
+		{
+			rec.type = OBJECT_CYLINDER;
+			rec.capped = cyl->capped;
+		}
+		else if (auto cone = dynamic_cast<const Cone*>(g))
+		{
+			rec.type = OBJECT_CONE;
+			rec.height = cone->height;
+			rec.bottom_radius = cone->b_radius;
+			rec.top_radius = cone->t_radius;
+			rec.capped = cone->capped;
+		}
+		else if (auto mesh = dynamic_cast<const Trimesh*>(g))
+		{
+			rec.type = OBJECT_TRIMESH;
+			rec.mesh = (uint32_t)meshes.size();
+			meshes.push_back(mesh);
+		}
+		else
+			loadError(filename, "can't compile this kind of object");
+		objects.push_back(rec);
+	}
+
+	// per vertex materials go into the material table too
+	std::vector<std::vector<uint32_t>> meshMaterials(meshes.size());
+	for (size_t k = 0; k < meshes.size(); k++)
+	{
+		for (uint32_t id : meshes[k]->materials)
+			meshMaterials[k].push_back(w.material(scene.materials()[id]));
+	}
+
+	string tmp = filename + ".tmp";
+	Output out(tmp);
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+	out.put(&header, 1);
+
+	std::vector<MeshRecord> meshRecords;
+	for (size_t k = 0; k < meshes.size(); k++)
+	{
+		const Trimesh* mesh = meshes[k];
+		std::vector<uint32_t> faces;
+		faces.reserve(mesh->faces.size() * 3);
+		for (const TrimeshFace* face : mesh->faces)
+		{
+			for (int c = 0; c < 3; c++)
+				faces.push_back((uint32_t)(*face)[c]);
+		}
+
+		MeshRecord rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.vertices = out.put(mesh->vertices.data(), mesh->vertices.size());
+		rec.normals = out.put(mesh->normals.data(), mesh->normals.size());
+		rec.faces = out.put(faces);
+		rec.faces.count /= 3;
+		rec.materials = out.put(meshMaterials[k]);
+		rec.vert_norms = mesh->vertNorms;
+		meshRecords.push_back(rec);
+	}
+
+	memcpy(header.magic, SCENE_MAGIC, sizeof(header.magic));
+	header.version = SCENE_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.camera = out.put(&camera, 1);
+	header.transforms = out.put(w.transforms);
+	header.materials = out.put(w.materials);
+	header.textures = out.put(w.textures);
+	header.text = out.put(w.text.data(), w.text.size());
+	header.lights = out.put(lights);
+	header.objects = out.put(objects);
+	header.meshes = out.put(meshRecords);
+	copy3(header.ambient, scene.ambient());
+	header.file_size = out.size();
+	out.rewrite(&header, sizeof(header));
+
+	if (!out.close())
+	{
+		remove(tmp.c_str());
+		loadError(filename, "couldn't write the compiled scene");
+	}
+#ifdef _WIN32
+	remove(filename.c_str());
+#endif
+	if (rename(tmp.c_str(), filename.c_str()) != 0)
+	{
+		remove(tmp.c_str());
+		loadError(filename, "couldn't write the compiled scene");
+	}
+}
+
+Scene* SceneFile::load(const string& filename)
+{
+	auto file = std::make_shared<MappedFile>();
+	if (!file->open(filename))
+		loadError(filename, "couldn't read the compiled scene");
+	const char* base = file->data();
+	size_t size = file->size();
+
+	FileHeader header;
+	if (size < sizeof(header))
+		loadError(filename, "not a compiled scene");
+	memcpy(&header, base, sizeof(header));
+	if (memcmp(header.magic, SCENE_MAGIC, sizeof(header.magic)) != 0)
+		loadError(filename, "not a compiled scene");
+	if (header.version != SCENE_VERSION || header.byte_order != BYTE_ORDER_MARK)
+		loadError(filename, "compiled by an incompatible version, compile it again");
+	if (header.file_size != size)
+		loadError(filename, "compiled scene is truncated");
+
+	// a table in the file, after checking it is inside it
+	auto table = [&](const Section& s, size_t elemSize, size_t elems) -> const char* {
+		if (s.offset % 8 != 0 || s.offset > size || s.count > (size - s.offset) / (elemSize * elems))
+			loadError(filename, "compiled scene is corrupt");
+		return base + s.offset;
+	};
+
+	const CameraRecord* camera = (const CameraRecord*)table(header.camera, sizeof(CameraRecord), 1);
+	const TransformRecord* transforms = (const TransformRecord*)table(header.transforms, sizeof(TransformRecord), 1);
+	const MaterialRecord* materials = (const MaterialRecord*)table(header.materials, sizeof(MaterialRecord), 1);
+	const TextureRecord* textures = (const TextureRecord*)table(header.textures, sizeof(TextureRecord), 1);
+	const char* text = table(header.text, 1, 1);
+	const LightRecord* lights = (const LightRecord*)table(header.lights, sizeof(LightRecord), 1);
+	const ObjectRecord* objects = (const ObjectRecord*)table(header.objects, sizeof(ObjectRecord), 1);
+	const MeshRecord* meshes = (const MeshRecord*)table(header.meshes, sizeof(MeshRecord), 1);
+	if (header.camera.count != 1)
+		loadError(filename, "compiled scene is corrupt");
+
+	std::unique_ptr<Scene> scene(new Scene);
+
+	Camera& cam = scene->getCamera();
+	memcpy(&cam.m[0][0], camera->m, sizeof(camera->m));
+	cam.normalizedHeight = camera->normalized_height;
+	cam.aspectRatio = camera->aspect_ratio;
+	cam.eye = vec3(camera->eye);
+	cam.look = vec3(camera->look);
+	cam.u = vec3(camera->u);
+	cam.v = vec3(camera->v);
+	scene->addAmbient(vec3(header.ambient));
+
+	// textures were stored with absolute paths; if the scene moved, look
+	// for them next to the compiled file
+	string dir = filename.find_last_of("\\/") == string::npos ? string(".") : filename.substr(0, filename.find_last_of("\\/"));
+	std::vector<string> textureNames;
+	for (uint64_t k = 0; k < header.textures.count; k++)
+	{
+		if (textures[k].offset > header.text.count || textures[k].length > header.text.count - textures[k].offset)
+			loadError(filename, "compiled scene is corrupt");
+		string name(text + textures[k].offset, textures[k].length);
+		if (!fileExists(name))
+		{
+			string moved = dir + "/" + name.substr(name.find_last_of("\\/") + 1);
+			if (fileExists(moved))
+				name = moved;
+		}
+		textureNames.push_back(name);
+	}
+
+	auto param = [&](const ParamRecord& rec) {
+		MaterialParameter p;
+		p._value = vec3(rec.value);
+		if (rec.texture >= 0)
+		{
+			if ((uint64_t)rec.texture >= textureNames.size())
+				loadError(filename, "compiled scene is corrupt");
+			p._textureMap = scene->getTexture(textureNames[rec.texture]);
+		}
+		return p;
+	};
+	std::vector<Material> mats(header.materials.count);
+	for (uint64_t k = 0; k < header.materials.count; k++)
+	{
+		const MaterialRecord& rec = materials[k];
+		Material& m = mats[k];
+		m._ke = param(rec.ke);
+		m._ka = param(rec.ka);
+		m._ks = param(rec.ks);
+		m._kd = param(rec.kd);
+		m._kr = param(rec.kr);
+		m._kt = param(rec.kt);
+		m._shininess = param(rec.shininess);
+		m._index = param(rec.index);
+		m._normal = param(rec.normal);
+		m._refl = rec.refl != 0;
+		m._trans = rec.trans != 0;
+		m._recur = rec.recur != 0;
+		m._spec = rec.spec != 0;
+		m._both = rec.both != 0;
+		m._usesNormalMap = rec.uses_normal_map != 0;
+	}
+	auto material = [&](uint32_t id) -> const Material& {
+		if (id >= mats.size())
+			loadError(filename, "compiled scene is corrupt");
+		return mats[id];
+	};
+	// the file's table is already deduplicated, so this is one entry each
+	std::vector<uint32_t> materialIds(mats.size());
+	for (size_t k = 0; k < mats.size(); k++)
+		materialIds[k] = scene->materials().intern(mats[k]);
+
+	std::vector<TransformNode*> nodes;
+	for (uint64_t k = 0; k < header.transforms.count; k++)
+	{
+		glm::dmat4x4 xform;
+		memcpy(&xform[0][0], transforms[k].m, sizeof(transforms[k].m));
+		nodes.push_back(scene->transformRoot.createChild(xform));
+	}
+
+	for (uint64_t k = 0; k < header.lights.count; k++)
+	{
+		const LightRecord& rec = lights[k];
+		if (rec.type == LIGHT_POINT)
+		{
+			scene->add(new PointLight(scene.get(), vec3(rec.vec), vec3(rec.color),
+			                          rec.constant, rec.linear, rec.quadratic));
+		}
+		else if (rec.type == LIGHT_DIRECTIONAL)
+		{
+			DirectionalLight* light = new DirectionalLight(scene.get(), vec3(rec.vec), vec3(rec.color));
+			light->orientation = vec3(rec.vec);	// stored normalized already
+			scene->add(light);
+		}
+		else
+			loadError(filename, "compiled scene is corrupt");
+	}
+
+	for (uint64_t k = 0; k < header.objects.count; k++)
+	{
+		const ObjectRecord& rec = objects[k];
+		if (rec.transform >= nodes.size())
+			loadError(filename, "compiled scene is corrupt");
+		TransformNode* node = nodes[rec.transform];
+		Material* mat = new Material(material(rec.material));
+
+		MaterialSceneObject* obj = nullptr;
+		const char* type = nullptr;
+		switch (rec.type)
+		{
+		case OBJECT_SPHERE:
+			obj = new Sphere(scene.get(), mat);
+			type = "sphere";
+			break;
+		case OBJECT_BOX:
+			obj = new Box(scene.get(), mat);
+			type = "box";
+			break;
+		case OBJECT_SQUARE:
+			obj = new Square(scene.get(), mat);
+			type = "square";
+			break;
+		case OBJECT_CYLINDER:
+		{
+			Cylinder* cyl = new Cylinder(scene.get(), mat);
+			cyl->capped = rec.capped != 0;
+			obj = cyl;
+			type = "cylinder";
+			break;
+		}
+		case OBJECT_CONE:
+			obj = new Cone(scene.get(), mat, rec.height, rec.bottom_radius, rec.top_radius, rec.capped != 0);
+			type = "cone";
+			break;
+		case OBJECT_TRIMESH:
+		{
+			if (rec.mesh >= header.meshes.count)
+			{
+				delete mat;
+				loadError(filename, "compiled scene is corrupt");
+			}
+			const MeshRecord& mr = meshes[rec.mesh];
+			std::unique_ptr<Trimesh> mesh(new Trimesh(scene.get(), mat, node));
+
+			const glm::dvec3* verts = (const glm::dvec3*)table(mr.vertices, sizeof(glm::dvec3), 1);
+			const glm::dvec3* norms = (const glm::dvec3*)table(mr.normals, sizeof(glm::dvec3), 1);
+			const uint32_t* faces = (const uint32_t*)table(mr.faces, sizeof(uint32_t), 3);
+			const uint32_t* vmats = (const uint32_t*)table(mr.materials, sizeof(uint32_t), 1);
+			if ((mr.normals.count && mr.normals.count != mr.vertices.count) ||
+			    (mr.materials.count && mr.materials.count != mr.vertices.count))
+				loadError(filename, "compiled scene is corrupt");
+
+			// the vertex data stays in the mapping
+			mesh->setVertexArrays(MeshArray<glm::dvec3>(verts, mr.vertices.count),
+			                      MeshArray<glm::dvec3>(norms, mr.normals.count), file);
+			for (uint64_t v = 0; v < mr.materials.count; v++)
+			{
+				if (vmats[v] >= materialIds.size())
+					loadError(filename, "compiled scene is corrupt");
+				mesh->addMaterialId(materialIds[vmats[v]]);
+			}
+			mesh->vertNorms = mr.vert_norms != 0;
+			for (uint64_t f = 0; f < 3 * mr.faces.count; f++)
+			{
+				if (faces[f] >= mr.vertices.count)
+					loadError(filename, "compiled scene is corrupt");
+			}
+
+			// the faces are made in the background, like parsed meshes
+			Trimesh* m = mesh.release();
+			uint64_t count = mr.faces.count;
+			scene->add(m);
+			scene->add_mesh(m, [m, faces, count] {
+				for (uint64_t f = 0; f < count; f++)
+					m->addFace((int)faces[3 * f], (int)faces[3 * f + 1], (int)faces[3 * f + 2]);
+			});
+			continue;
+		}
+		default:
+			delete mat;
+			loadError(filename, "compiled scene is corrupt");
+		}
+		obj->setTransform(node);
+		scene->add(obj);
+		scene->add_bvh(obj, type);
+	}
+
+	return scene.release();
+}
@@ -0,0 +1,34 @@
+#ifndef __SCENEFILE_H__
+#define __SCENEFILE_H__
+
+// Compiled scenes (.rayb).
+//
+// A parsed scene written out as flat binary tables: the camera, the
+// lights, every distinct transform (already multiplied out to world
+// space), every distinct material, the texture file names, one record
+// per object, and the vertex, normal and face arrays of the meshes.
+// Loading one skips the tokenizer and parser entirely.  The file is
+// mapped read-only and mesh vertices and normals are used straight
+// from the mapping, so they are only paged in as they are touched.
+//
+// ray --compile scene.ray scene.rayb writes one; RayTracer::loadScene
+// reads any file ending in .rayb this way.
+
+#include <string>
+
+class Scene;
+
+class SceneFile {
+public:
+	// both throw ParserException
+	static Scene* load(const std::string& filename);
+	static void save(const Scene& scene, const std::string& filename);
+
+	// does the file name end in .rayb?
+	static bool isCompiled(const std::string& filename);
+
+private:
+	class Writer;
+};
+
+#endif // __SCENEFILE_H__
@@ -0,0 +1,366 @@
+#include "textureCache.h"
+#include "material.h"
+#include "../fileio/images.h"
+#include "../ui/TraceUI.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+extern TraceUI* traceUI;
+
+using std::string;
+
+namespace {
+
+// layout of a cache file: the header, one FileLevel per mip level, then the
+// texels of every level (each level starts on a 64 byte boundary)
+struct FileHeader {
+	char magic[8];
+	uint32_t tile;
+	uint32_t levels;
+	uint32_t width, height;
+	uint64_t hash;			// of the image file the texels came from
+	uint64_t texel_bytes;
+};
+
+struct FileLevel {
+	uint32_t width, height;
+	uint32_t tilesX, pad;
+	uint64_t offset;		// in floats from the start of the texels
+};
+
+const char CACHE_MAGIC[8] = { 'R', 'A', 'Y', 'T', 'E', 'X', '1', 0 };
+
+size_t texelsStart(size_t levels)
+{
+	size_t bytes = sizeof(FileHeader) + levels * sizeof(FileLevel);
+	return (bytes + 63) & ~size_t(63);
+}
+
+size_t levelFloats(int w, int h)
+{
+	size_t tiles = (size_t)((w + TEXTURE_TILE - 1) / TEXTURE_TILE) * ((h + TEXTURE_TILE - 1) / TEXTURE_TILE);
+	return tiles * TEXTURE_TILE * TEXTURE_TILE * 3;
+}
+
+// sizes and offsets of every level of a w x h image down to 1x1
+void layoutLevels(int w, int h, std::vector<FileLevel>& out, size_t& total)
+{
+	out.clear();
+	total = 0;
+	while (true)
+	{
+		FileLevel level = {};
+		level.width = w;
+		level.height = h;
+		level.tilesX = (w + TEXTURE_TILE - 1) / TEXTURE_TILE;
+		level.offset = total;
+		out.push_back(level);
+		total += levelFloats(w, h);
+		if (w == 1 && h == 1)
+			break;
+		w = std::max(w / 2, 1);
+		h = std::max(h / 2, 1);
+	}
+}
+
+void pointLevels(TextureData& tex, const std::vector<FileLevel>& layout, const float* texels)
+{
+	tex.levels.clear();
+	for (const FileLevel& l : layout)
+		tex.levels.push_back(TextureLevel{ (int)l.width, (int)l.height, (int)l.tilesX, texels + l.offset });
+}
+
+// FNV-1a over the file's bytes
+bool hashFile(const string& filename, uint64_t& hash)
+{
+	std::ifstream in(filename, std::ios::binary);
+	if (!in)
+		return false;
+	hash = 14695981039346656037ULL;
+	char buf[1 << 16];
+	while (in)
+	{
+		in.read(buf, sizeof(buf));
+		std::streamsize got = in.gcount();
+		for (std::streamsize k = 0; k < got; k++)
+		{
+			hash ^= (unsigned char)buf[k];
+			hash *= 1099511628211ULL;
+		}
+	}
+	return true;
+}
+
+bool makeDirs(const string& dir)
+{
+	for (size_t pos = 1; pos <= dir.size(); pos++)
+	{
+		if (pos != dir.size() && dir[pos] != '/' && dir[pos] != '\\')
+			continue;
+		string part = dir.substr(0, pos);
+#ifdef _WIN32
+		_mkdir(part.c_str());
+#else
+		mkdir(part.c_str(), 0755);
+#endif
+	}
+	struct stat st;
+	return stat(dir.c_str(), &st) == 0;
+}
+
+void loadError(const string& filename)
+{
+	string error("Unable to load texture map '");
+	error.append(filename);
+	error.append("'.");
+	throw TextureMapException(error);
+}
+
+// textures alive in this process, by file name and modification time
+std::mutex registryMutex;
+std::map<string, std::weak_ptr<const TextureData>> registry;
+
+} // anonymous namespace
+
+TextureData::TextureData()
+	: width(0), height(0), map_addr(nullptr), map_size(0)
+{
+}
+
+TextureData::~TextureData()
+{
+#ifndef _WIN32
+	if (map_addr)
+		munmap(map_addr, map_size);
+#endif
+}
+
+string TextureCache::directory()
+{
+	string dir = traceUI ? traceUI->getTextureCache() : string();
+	const char* env = getenv("RAY_TEXTURE_CACHE");
+	if ((dir.empty() || dir == "default") && env && *env)
+		return env;
+	if (dir == "default")
+	{
+		const char* xdg = getenv("XDG_CACHE_HOME");
+		const char* home = getenv("HOME");
+		if (xdg && *xdg)
+			return string(xdg) + "/ray/textures";
+		if (home && *home)
+			return string(home) + "/.cache/ray/textures";
+		return string();
+	}
+	return dir == "off" ? string() : dir;
+}
+
+std::shared_ptr<const TextureData> TextureCache::load(const string& filename)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		loadError(filename);
+	string key = filename + ":" + std::to_string((long long)st.st_mtime) + ":" + std::to_string((long long)st.st_size);
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		auto it = registry.find(key);
+		if (it != registry.end())
+		{
+			if (auto tex = it->second.lock())
+				return tex;
+		}
+	}
+
+	uint64_t hash;
+	if (!hashFile(filename, hash))
+		loadError(filename);
+
+	std::shared_ptr<TextureData> tex;
+	string dir = directory();
+	string path;
+	if (!dir.empty())
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.rtex", (unsigned long long)hash);
+		path = dir + "/" + name;
+		tex = mapFile(path, hash);
+	}
+
+	if (!tex)
+	{
+		tex = decode(filename);
+		// map the file we just wrote so other processes share the pages
+		if (!path.empty() && makeDirs(dir) && writeFile(path, *tex, hash))
+		{
+			if (auto mapped = mapFile(path, hash))
+				tex = mapped;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	registry[key] = tex;
+	return tex;
+}
+
+// decode the image and box filter it down to 1x1
+std::shared_ptr<TextureData> TextureCache::decode(const string& filename)
+{
+	int width, height;
+	std::vector<uint8_t> data = readImage(filename.c_str(), width, height);
+	if (data.empty())
+		loadError(filename);
+
+	auto tex = std::make_shared<TextureData>();
+	tex->width = width;
+	tex->height = height;
+	std::vector<FileLevel> layout;
+	size_t total;
+	layoutLevels(width, height, layout, total);
+	tex->heap.assign(total, 0.0f);
+	pointLevels(*tex, layout, tex->heap.data());
+
+	for (size_t l = 0; l < layout.size(); l++)
+	{
+		const TextureLevel& level = tex->levels[l];
+		float* texels = tex->heap.data() + layout[l].offset;
+		for (int row = 0; row < level.height; row++)
+		{
+			for (int col = 0; col < level.width; col++)
+			{
+				float* dst = texels + level.index(row, col);
+				if (l == 0)
+				{
+					const uint8_t* src = &data[((width * row) + col) * 3];
+					for (int c = 0; c < 3; c++)
+						dst[c] = src[c] / 255.0f;
+					continue;
+				}
+
+				// average the 2x2 block above (odd edges repeat the last texel)
+				const TextureLevel& up = tex->levels[l - 1];
+				int r0 = std::min(row * 2, up.height - 1), r1 = std::min(row * 2 + 1, up.height - 1);
+				int c0 = std::min(col * 2, up.width - 1), c1 = std::min(col * 2 + 1, up.width - 1);
+				const float* a = up.texel(r0, c0);
+				const float* b = up.texel(r0, c1);
+				const float* d = up.texel(r1, c0);
+				const float* e = up.texel(r1, c1);
+				for (int c = 0; c < 3; c++)
+					dst[c] = 0.25f * (a[c] + b[c] + d[c] + e[c]);
+			}
+		}
+	}
+	return tex;
+}
+
+bool TextureCache::writeFile(const string& path, const TextureData& tex, uint64_t hash)
+{
+	std::vector<FileLevel> layout;
+	size_t total;
+	layoutLevels(tex.width, tex.height, layout, total);
+
+	FileHeader header = {};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.tile = TEXTURE_TILE;
+	header.levels = (uint32_t)layout.size();
+	header.width = tex.width;
+	header.height = tex.height;
+	header.hash = hash;
+	header.texel_bytes = total * sizeof(float);
+
+	// write next to the final name and rename, so nobody maps a half
+	// written file
+	string tmp = path + ".tmp" + std::to_string((long long)getpid());
+	{
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		std::vector<char> pad(texelsStart(layout.size()) - sizeof(FileHeader) - layout.size() * sizeof(FileLevel), 0);
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)layout.data(), layout.size() * sizeof(FileLevel));
+		out.write(pad.data(), pad.size());
+		out.write((const char*)tex.levels[0].texels, header.texel_bytes);
+		if (!out)
+		{
+			out.close();
+			remove(tmp.c_str());
+			return false;
+		}
+	}
+#ifdef _WIN32
+	remove(path.c_str());
+#endif
+	if (rename(tmp.c_str(), path.c_str()) != 0)
+	{
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+// a cache file that doesn't look right is ignored (and later overwritten)
+std::shared_ptr<TextureData> TextureCache::mapFile(const string& path, uint64_t hash)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || (size_t)st.st_size < sizeof(FileHeader))
+		return nullptr;
+	size_t size = (size_t)st.st_size;
+
+	auto tex = std::make_shared<TextureData>();
+	const char* base;
+#ifdef _WIN32
+	std::ifstream in(path, std::ios::binary);
+	std::vector<float> bytes((size + sizeof(float) - 1) / sizeof(float));
+	if (!in.read((char*)bytes.data(), size))
+		return nullptr;
+	tex->heap.swap(bytes);
+	base = (const char*)tex->heap.data();
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+	void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return nullptr;
+	tex->map_addr = addr;
+	tex->map_size = size;
+	base = (const char*)addr;
+#endif
+
+	FileHeader header;
+	memcpy(&header, base, sizeof(header));
+	if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 || header.tile != TEXTURE_TILE ||
+	    header.hash != hash || header.width == 0 || header.height == 0)
+		return nullptr;
+
+	std::vector<FileLevel> layout;
+	size_t total;
+	layoutLevels(header.width, header.height, layout, total);
+	if (header.levels != layout.size() || header.texel_bytes != total * sizeof(float) ||
+	    size < texelsStart(layout.size()) + header.texel_bytes ||
+	    memcmp(base + sizeof(FileHeader), layout.data(), layout.size() * sizeof(FileLevel)) != 0)
+		return nullptr;
+
+	tex->width = header.width;
+	tex->height = header.height;
+	pointLevels(*tex, layout, (const float*)(base + texelsStart(layout.size())));
+	return tex;
+}
@@ -0,0 +1,79 @@
+#ifndef __TEXTURECACHE_H__
+#define __TEXTURECACHE_H__
+
+// Decoded textures, shared in memory and cached on disk.
+//
+// Decoding a large PNG and building its mip chain takes a while, so the
+// result is written to a cache directory as a flat binary file named after
+// a hash of the image file's contents.  Later loads, by this process or any
+// other one (several render servers, distributed workers), map that file
+// read-only instead of decoding: the pages are shared through the OS page
+// cache and only fault in when they are sampled.  Within a process a
+// texture that is already loaded is shared by every scene using it.
+//
+// The disk cache is off unless the "texture_cache" setting or
+// $RAY_TEXTURE_CACHE names a directory for it.  The setting "default" means
+// $RAY_TEXTURE_CACHE if it is set and ~/.cache/ray/textures otherwise;
+// --serve uses it when nothing else is set.  Entries are never evicted
+// (an edited texture leaves its old entry behind), so the directory is
+// the user's to clean.
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// texels per side of a storage block
+#define TEXTURE_TILE 4
+
+// One level of a mip chain.  Texels are rgb floats stored in
+// TEXTURE_TILE x TEXTURE_TILE blocks (blocks row-major, texels row-major
+// inside a block), so the four texels of a bilinear lookup almost always
+// sit in the same few cache lines.
+struct TextureLevel {
+	int width, height;
+	int tilesX;
+	const float* texels;
+
+	int index(int row, int col) const
+	{
+		int tile = (row / TEXTURE_TILE) * tilesX + (col / TEXTURE_TILE);
+		return (tile * TEXTURE_TILE * TEXTURE_TILE + (row % TEXTURE_TILE) * TEXTURE_TILE + (col % TEXTURE_TILE)) * 3;
+	}
+	const float* texel(int row, int col) const { return texels + index(row, col); }
+};
+
+// a decoded image and its mip chain, levels[0] is the full image
+class TextureData {
+public:
+	TextureData();
+	~TextureData();
+
+	int width, height;
+	std::vector<TextureLevel> levels;
+
+	bool mapped() const { return map_addr != nullptr; }
+
+private:
+	friend class TextureCache;
+
+	std::vector<float> heap;	// the texels, unless they are mapped
+	void* map_addr;
+	size_t map_size;
+};
+
+class TextureCache {
+public:
+	// the decoded texture of an image file, throws TextureMapException
+	static std::shared_ptr<const TextureData> load(const std::string& filename);
+
+	// where decoded textures are kept, "" if the disk cache is off
+	static std::string directory();
+
+private:
+	static std::shared_ptr<TextureData> decode(const std::string& filename);
+	static std::shared_ptr<TextureData> mapFile(const std::string& path, uint64_t hash);
+	static bool writeFile(const std::string& path, const TextureData& tex, uint64_t hash);
+};
+
+#endif // __TEXTURECACHE_H__
@@ -10,14 +10,94 @@ extern int getopt(int argc, char** argv, const char* optstring);
 #endif
 
 #include <assert.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
 
 #include "../fileio/images.h"
+#include "../fileio/pngimage.h"
 #include "CommandLineUI.h"
 
 #include "../RayTracer.h"
+#include "../DistributedRender.h"
+#include "../Animation.h"
+#include "../RenderServer.h"
+#include "../scene/rayStats.h"
+#include "json.hpp"
+using Json = nlohmann::json;
 
 using namespace std;
 
+namespace {
+
+// what the render did, from the per-thread counters
+void printRenderStats(const RayStats::Totals& s, double seconds)
+{
+	uint64_t rays = s.rays();
+	std::cerr << "rays: " << rays << " (" << s[RayStats::CAMERA_RAYS] << " camera, "
+	          << s[RayStats::REFLECTION_RAYS] << " reflection, "
+	          << s[RayStats::REFRACTION_RAYS] << " refraction, "
+	          << s[RayStats::SHADOW_RAYS] << " shadow)";
+	if (seconds > 0.0)
+		std::cerr << " in " << seconds << " s, " << rays / seconds * 1e-6 << " Mrays/s";
+	std::cerr << std::endl;
+	if (s[RayStats::PRUNED_RAYS] > 0)
+		std::cerr << "pruned " << s[RayStats::PRUNED_RAYS] << " rays" << std::endl;
+	if (rays > 0)
+		std::cerr << "per ray: " << (double)s[RayStats::BVH_NODES] / rays << " BVH nodes, "
+		          << (double)s[RayStats::BBOX_TESTS] / rays << " bounding box tests, "
+		          << (double)s.primitiveTests() / rays << " primitive tests" << std::endl;
+	if (s.primitiveTests() > 0) {
+		std::cerr << "primitive tests: ";
+		const char* sep = "";
+		for (int c = RayStats::SPHERE_TESTS; c <= RayStats::TRIANGLE_TESTS; c++)
+			if (s[RayStats::Counter(c)] > 0) {
+				std::cerr << sep << s[RayStats::Counter(c)] << " " << RayStats::name(RayStats::Counter(c));
+				sep = ", ";
+			}
+		std::cerr << std::endl;
+	}
+	uint64_t cacheTests = s[RayStats::SHADOW_CACHE_TESTS];
+	if (cacheTests > 0)
+		std::cerr << "shadow occluder cache: " << s[RayStats::SHADOW_CACHE_HITS] << " of " << cacheTests
+		          << " hits (" << 100.0 * s[RayStats::SHADOW_CACHE_HITS] / cacheTests << "%)" << std::endl;
+}
+
+// the same for programs (see bench/ray_bench.cpp), plus how long loading took
+void writeRenderStats(const char* file, const RayTracer& raytracer, int width, int height,
+                      const RayStats::Totals& s, double seconds)
+{
+	Json stats;
+	stats["width"] = width;
+	stats["height"] = height;
+	stats["threads"] = TraceUI::m_threads;
+	stats["read_ms"] = raytracer.loadTimes().read_ms;
+	stats["bvh_ms"] = raytracer.loadTimes().bvh_ms;
+	stats["render_ms"] = seconds * 1000.0;
+	stats["rays"] = s.rays();
+	stats["mrays_per_s"] = seconds > 0.0 ? s.rays() / seconds * 1e-6 : 0.0;
+	Json counters;
+	for (int c = 0; c < RayStats::NUM_COUNTERS; c++) {
+		string key = RayStats::name(RayStats::Counter(c));
+		for (char& ch : key)
+			ch = ch == ' ' ? '_' : (char)tolower(ch);
+		counters[key] = s[RayStats::Counter(c)];
+	}
+	stats["counters"] = counters;
+
+	std::ofstream out(file);
+	out << stats.dump(2) << std::endl;
+	if (!out)
+		std::cerr << "couldn't write statistics to " << file << std::endl;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // anonymous namespace
+
 // The command line UI simply parses out all the arguments off
 // the command line and stores them locally.
 CommandLineUI::CommandLineUI(int argc, char** argv) : TraceUI()
@@ -26,7 +106,25 @@ CommandLineUI::CommandLineUI(int argc, char** argv) : TraceUI()
 	progName = argv[0];
 	const char* jsonfile = nullptr;
 	string cubemap_file;
-	while ((i = getopt(argc, argv, "tr:w:hj:c:")) != EOF) {
+
+	// getopt only knows short options, so pull --serve, --compile and --stats out first
+	int args = 1;
+	for (int a = 1; a < argc; a++) {
+		if (strncmp(argv[a], "--serve", 7) == 0 && (argv[a][7] == '\0' || argv[a][7] == '=')) {
+			m_serve = true;
+			if (argv[a][7] == '=')
+				serveAddr = argv[a] + 8;
+		} else if (strcmp(argv[a], "--compile") == 0) {
+			m_compile = true;
+		} else if (strncmp(argv[a], "--stats=", 8) == 0) {
+			statsFile = argv[a] + 8;
+		} else {
+			argv[args++] = argv[a];
+		}
+	}
+	argc = args;
+
+	while ((i = getopt(argc, argv, "tr:w:p:hj:c:W:L:C:a:S:")) != EOF) {
 		switch (i) {
 			case 'r':
 				m_nDepth = atoi(optarg);
@@ -34,12 +132,30 @@ CommandLineUI::CommandLineUI(int argc, char** argv) : TraceUI()
 			case 'w':
 				m_nSize = atoi(optarg);
 				break;
+			case 'p':
+				m_nRayCutoff = atoi(optarg);
+				break;
 			case 'j':
 				jsonfile = optarg;
 				break;
 			case 'c':
 				cubemap_file = optarg;
 				break;
+			case 'W':
+				m_nLocalWorkers = atoi(optarg);
+				break;
+			case 'L':
+				listenAddr = optarg;
+				break;
+			case 'C':
+				workerAddr = optarg;
+				break;
+			case 'a':
+				animFile = optarg;
+				break;
+			case 'S':
+				m_nStripRows = atoi(optarg);
+				break;
 			case 'h':
 				usage();
 				exit(1);
@@ -54,10 +170,28 @@ CommandLineUI::CommandLineUI(int argc, char** argv) : TraceUI()
 	if (jsonfile) {
 		loadFromJson(jsonfile);
 	}
+	// png output is compressed on as many threads as we trace with
+	setPNGCompression(m_nPngLevel, m_threads);
 	if (!cubemap_file.empty()) {
 		smartLoadCubemap(cubemap_file);
 	}
 
+	// the server gets its scenes from the jobs, and keeps decoded textures
+	// on disk for the next server unless told otherwise
+	if (m_serve) {
+		if (m_textureCache.empty())
+			m_textureCache = "default";
+		rayName = imgName = nullptr;
+		return;
+	}
+
+	// workers only need the scene
+	if (workerAddr && optind < argc) {
+		rayName = argv[optind];
+		imgName = nullptr;
+		return;
+	}
+
 	if (optind >= argc - 1) {
 		std::cerr << "no input and/or output name." << std::endl;
 		exit(1);
@@ -65,30 +199,107 @@ CommandLineUI::CommandLineUI(int argc, char** argv) : TraceUI()
 
 	rayName = argv[optind];
 	imgName = argv[optind + 1];
+
+	if (m_compile && (m_serve || workerAddr || animFile || m_nLocalWorkers > 0 || listenAddr || m_nStripRows > 0)) {
+		std::cerr << "--compile only writes the compiled scene, it can't be combined with rendering options." << std::endl;
+		exit(1);
+	}
+	if (statsFile && (m_compile || animFile || m_nLocalWorkers > 0 || listenAddr)) {
+		std::cerr << "--stats is for rendering one image here, it can't be combined with --compile, -a, -W or -L." << std::endl;
+		exit(1);
+	}
+	if (animFile && (m_nLocalWorkers > 0 || listenAddr)) {
+		std::cerr << "-a renders locally, it can't be combined with -W or -L." << std::endl;
+		exit(1);
+	}
+	if (m_nStripRows > 0 && (animFile || m_nLocalWorkers > 0 || listenAddr)) {
+		std::cerr << "-S renders one image locally, it can't be combined with -a, -W or -L." << std::endl;
+		exit(1);
+	}
+	// raw frames go to stdout, so keep the chatter off it
+	if (animFile && string(imgName) == "-")
+		std::cout.rdbuf(std::cerr.rdbuf());
 }
 
 int CommandLineUI::run()
 {
 	assert(raytracer != 0);
+	if (m_serve) {
+		RenderServer server(this, raytracer);
+		return server.run(serveAddr);
+	}
+
+	if (m_compile)
+		return raytracer->compileScene(rayName, imgName) ? 0 : 1;
+
 	raytracer->loadScene(rayName);
 
-	if (raytracer->sceneLoaded()) {
+	if (raytracer->sceneLoaded() && workerAddr) {
+		return DistributedRender::work(raytracer, workerAddr);
+	}
+
+	if (raytracer->sceneLoaded() && animFile) {
+		Animation anim(raytracer);
+		if (!anim.load(animFile))
+			return 1;
 		int width = m_nSize;
 		int height = (int)(width / raytracer->aspectRatio() + 0.5);
+		return anim.render(width, height, imgName);
+	}
 
-		raytracer->traceSetup(width, height);
+	if (raytracer->sceneLoaded() && m_nStripRows > 0) {
+		int width = m_nSize;
+		int height = (int)(width / raytracer->aspectRatio() + 0.5);
 
-		clock_t start, end;
-		start = clock();
+		// every band is written as soon as it is done, there is no frame buffer
+		auto start = std::chrono::steady_clock::now();
+		RayStats::reset();
+		StripImageWriter writer(imgName, width, height);
+		int aaPixels = raytracer->traceStrips(width, height, m_nStripRows,
+			[&writer](const unsigned char* rows, int y0, int count) { writer.writeRows(rows, y0, count); });
+		writer.finish();
+		if (aaSwitch())
+			std::cerr << "anti-aliased " << aaPixels << " of "
+			          << width * height << " pixels" << std::endl;
+		double seconds = secondsSince(start);
+		RayStats::Totals stats = RayStats::reset();
+		printRenderStats(stats, seconds);
+		if (statsFile)
+			writeRenderStats(statsFile, *raytracer, width, height, stats, seconds);
+		return 0;
+	}
 
-		raytracer->traceImage(width, height);
-		raytracer->waitRender();
+	if (raytracer->sceneLoaded()) {
+		int width = m_nSize;
+		int height = (int)(width / raytracer->aspectRatio() + 0.5);
+
+		auto start = std::chrono::steady_clock::now();
+		RayStats::reset();
+		RayStats::Totals workerStats;
+
+		if (m_nLocalWorkers > 0 || listenAddr) {
+			// the coordinator forks before any render threads exist
+			DistributedRender dist(raytracer, width, height);
+			if (!dist.coordinate(m_nLocalWorkers, listenAddr))
+				return 1;
+			workerStats = dist.workerStats();
+		} else {
+			raytracer->traceImage(width, height);
+			raytracer->waitRender();
+		}
 		if (aaSwitch()) {
-			raytracer->aaImage();
+			int aaPixels = raytracer->aaImage();
 			raytracer->waitRender();
+			std::cerr << "anti-aliased " << aaPixels << " of "
+			          << width * height << " pixels" << std::endl;
 		}
 
-		end = clock();
+		double seconds = secondsSince(start);
+		RayStats::Totals stats = RayStats::reset();
+		stats += workerStats;
+		printRenderStats(stats, seconds);
+		if (statsFile)
+			writeRenderStats(statsFile, *raytracer, width, height, stats, seconds);
 
 		// save image
 		unsigned char* buf;
@@ -98,10 +309,6 @@ int CommandLineUI::run()
 		if (buf)
 			writeImage(imgName, width, height, buf);
 
-		double t = (double)(end - start) / CLOCKS_PER_SEC;
-		//		int totalRays = TraceUI::resetCount();
-		//		std::cout << "total time = " << t << " seconds,
-		// rays traced = " << totalRays << std::endl;
 		return 0;
 	} else {
 		std::cerr << "Unable to load ray file '" << rayName << "'"
@@ -112,6 +319,7 @@ int CommandLineUI::run()
 
 void CommandLineUI::alert(const string& msg)
 {
+	lastAlert = msg;
 	std::cerr << msg << std::endl;
 }
 
@@ -122,6 +330,21 @@ void CommandLineUI::usage()
 	     << " [options] [input.ray output.png]" << endl
 	     << "  -r <#>      set recursion level (default " << m_nDepth << ")" << endl
 	     << "  -w <#>      set output image width (default " << m_nSize << ")" << endl
+	     << "  -p <#>      don't trace reflected or refracted rays whose weight is at" << endl
+	     << "              most # x 0.001 in every channel (default 0, trace them all)" << endl
 	     << "  -j <FILE>   set parameters from JSON file" << endl
-	     << "  -c <FILE>   one Cubemap file, the remainings will be detected automatically" << endl;
+	     << "  -c <FILE>   one Cubemap file, the remainings will be detected automatically" << endl
+	     << "  -W <#>      render with # forked local worker processes" << endl
+	     << "  -L <ADDR>   accept remote workers on a tcp port or unix socket path" << endl
+	     << "  -C <ADDR>   run as a worker for the coordinator at host:port or a socket path" << endl
+	     << "              (usage: " << progName << " -C <ADDR> [options] input.ray)" << endl
+	     << "  -a <FILE>   render the camera/object keyframes in FILE as numbered images" << endl
+	     << "              named after output.png, or as raw RGB on stdout if output is -" << endl
+	     << "  -S <#>      render # rows at a time and write each band as it finishes," << endl
+	     << "              memory stays bounded by the band instead of the image" << endl
+	     << "  --serve[=PATH]  keep running and render json jobs read from stdin" << endl
+	     << "              (or a unix socket at PATH), one reply line per job" << endl
+	     << "  --compile   write input.ray as a compiled scene to output.rayb instead of" << endl
+	     << "              rendering it; any input ending in .rayb is loaded as one" << endl
+	     << "  --stats=FILE  write load and render times and ray counts to FILE as json" << endl;
 }
@@ -23,6 +23,23 @@ private:
 	char*	rayName;
 	char*	imgName;
 	char*	progName;
+
+	// distributed rendering (see DistributedRender.h)
+	int		m_nLocalWorkers = 0;	// -W: forked workers
+	const char*	listenAddr = nullptr;	// -L: accept remote workers here
+	const char*	workerAddr = nullptr;	// -C: run as a worker for this coordinator
+
+	const char*	animFile = nullptr;		// -a: render the keyframes in this file
+	int		m_nStripRows = 0;		// -S: render and write this many rows at a time
+
+	// --serve[=path]: render server (see RenderServer.h)
+	bool		m_serve = false;
+	const char*	serveAddr = nullptr;
+	bool		m_compile = false;		// --compile: write input as a compiled scene
+	const char*	statsFile = nullptr;	// --stats=FILE: write render statistics as json
+	string		lastAlert;
+
+	friend class RenderServer;
 };
 
 #endif
@@ -17,8 +17,11 @@
 
 #include "GraphicalUI.h"
 #include "../RayTracer.h"
+#include "../scene/rayStats.h"
 
-#define MAX_INTERVAL 500
+// how often cb_render looks for input and for the render to end; the
+// window itself is only redrawn every refreshInterval
+#define POLL_INTERVAL 20
 
 #ifdef _WIN32
 #define print sprintf_s
@@ -27,6 +30,8 @@
 #endif
 
 bool GraphicalUI::stopTrace = false;
+bool GraphicalUI::rendering = false;
+bool GraphicalUI::restartTrace = false;
 GraphicalUI* GraphicalUI::pUI = NULL;
 const char* GraphicalUI::traceWindowLabel = "Raytraced Image";
 bool TraceUI::m_debug = false;
@@ -124,8 +129,9 @@ void GraphicalUI::cb_sizeSlides(Fl_Widget* o, void* v)
 {
 	pUI=(GraphicalUI*)(o->user_data());
 
-	// terminate the rendering so we don't get crashes
-	stopTracing();
+	// terminate the rendering so we don't get crashes (cb_render restarts
+	// it at the new size)
+	restartTracing();
 
 	pUI->m_nSize=int(((Fl_Slider *)o)->value());
 	int width = (int)(pUI->getSize());
@@ -137,17 +143,30 @@ void GraphicalUI::cb_sizeSlides(Fl_Widget* o, void* v)
 
 void GraphicalUI::cb_depthSlides(Fl_Widget* o, void* v)
 {
-	((GraphicalUI*)(o->user_data()))->m_nDepth=int( ((Fl_Slider *)o)->value() ) ;
+	pUI=(GraphicalUI*)(o->user_data());
+	pUI->m_nDepth=int( ((Fl_Slider *)o)->value() ) ;
+	restartTracing();
 }
 
 void GraphicalUI::cb_thresholdSlides(Fl_Widget* o, void* v)
 {
-	((GraphicalUI*)(o->user_data()))->m_nThreshold=int( ((Fl_Slider *)o)->value() ) ;
+	pUI=(GraphicalUI*)(o->user_data());
+	pUI->m_nThreshold=int( ((Fl_Slider *)o)->value() ) ;
+	restartTracing();
+}
+
+void GraphicalUI::cb_rayCutoffSlides(Fl_Widget* o, void* v)
+{
+	pUI=(GraphicalUI*)(o->user_data());
+	pUI->m_nRayCutoff=int( ((Fl_Slider *)o)->value() ) ;
+	restartTracing();
 }
 
 void GraphicalUI::cb_blockSlides(Fl_Widget* o, void* v)
 {
-	((GraphicalUI*)(o->user_data()))->m_nBlockSize=int( ((Fl_Slider *)o)->value() ) ;
+	pUI=(GraphicalUI*)(o->user_data());
+	pUI->m_nBlockSize=int( ((Fl_Slider *)o)->value() ) ;
+	restartTracing();
 }
 
 void GraphicalUI::cb_refreshSlides(Fl_Widget* o, void* v)
@@ -159,16 +178,21 @@ void GraphicalUI::cb_threadSlides(Fl_Widget* o, void* v)
 {
 	pUI=(GraphicalUI*)(o->user_data());
 	pUI->m_threads = (int)(((Fl_Slider*)o)->value());
+	restartTracing();
 }
 
 void GraphicalUI::cb_aaSamplesSlides(Fl_Widget* o, void* v)
 {
-	((GraphicalUI*)(o->user_data()))->m_nSuperSamples=int( ((Fl_Slider *)o)->value() ) ;
+	pUI=(GraphicalUI*)(o->user_data());
+	pUI->m_nSuperSamples=int( ((Fl_Slider *)o)->value() ) ;
+	restartTracing();
 }
 
 void GraphicalUI::cb_aaThresholdSlides(Fl_Widget* o, void* v)
 {
-	((GraphicalUI*)(o->user_data()))->m_nAaThreshold=int( ((Fl_Slider *)o)->value() ) ;
+	pUI=(GraphicalUI*)(o->user_data());
+	pUI->m_nAaThreshold=int( ((Fl_Slider *)o)->value() ) ;
+	restartTracing();
 }
 
 void GraphicalUI::cb_kdTreeDepthSlides(Fl_Widget* o, void* v)
@@ -185,6 +209,7 @@ void GraphicalUI::cb_filterSlides(Fl_Widget* o, void* v)
 {
 	pUI=(GraphicalUI*)(o->user_data());
 	pUI->m_nFilterWidth=int( ((Fl_Slider *)o)->value() ) ;
+	restartTracing();
 }
 
 void GraphicalUI::cb_debuggingDisplayCheckButton(Fl_Widget* o, void* v)
@@ -213,6 +238,7 @@ void GraphicalUI::cb_shCheckButton(Fl_Widget* o, void* v)
 {
 	pUI=(GraphicalUI*)(o->user_data());
 	pUI->m_shadows = (((Fl_Check_Button*)o)->value() == 1);
+	restartTracing();
 }
 
 void GraphicalUI::cb_bfCheckButton(Fl_Widget* o, void* v)
@@ -221,6 +247,13 @@ void GraphicalUI::cb_bfCheckButton(Fl_Widget* o, void* v)
 	pUI->m_backface = (((Fl_Check_Button*)o)->value() == 1);
 }
 
+void GraphicalUI::cb_progCheckButton(Fl_Widget* o, void* v)
+{
+	pUI=(GraphicalUI*)(o->user_data());
+	pUI->m_progressive = (((Fl_Check_Button*)o)->value() == 1);
+	restartTracing();
+}
+
 void GraphicalUI::cb_aaCheckButton(Fl_Widget* o, void* v)
 {
 	pUI = (GraphicalUI*)(o->user_data());
@@ -235,6 +268,7 @@ void GraphicalUI::cb_aaCheckButton(Fl_Widget* o, void* v)
 		pUI->m_aaSamplesSlider->deactivate();
 		pUI->m_aaThreshSlider->deactivate();
 	}
+	restartTracing();
 }
 
 void GraphicalUI::cb_kdCheckButton(Fl_Widget* o, void* v)
@@ -270,67 +304,39 @@ void GraphicalUI::cb_render(Fl_Widget* o, void* v) {
 	char buffer[256];
 
 	pUI = (GraphicalUI*)(o->user_data());
-	stopTrace = false;
-	if (pUI->raytracer->sceneLoaded())
+	rendering = true;
+	// a setting touched while tracing (see restartTracing) starts the
+	// render over with the new one
+	do
 	{
-		int width = pUI->getSize();
-		int	height = (int)(width / pUI->raytracer->aspectRatio() + 0.5);
-		int origPixels = width * height;
-		pUI->m_traceGlWindow->resizeWindow(width, height);
-		pUI->m_traceGlWindow->show();
-		clock_t startTime, now, prev, traceTime;
-		startTime = now = prev = clock();
-		auto t_start = std::chrono::high_resolution_clock::now();
-		auto t_now = t_start;
-		auto t_elapsed = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
-		pUI->raytracer->traceImage(width, height);
-		clock_t intervalMS = pUI->refreshInterval * 100;
-		while (!pUI->raytracer->checkRender())
-		{
-			// check for input and refresh view every so often while tracing
-			std::this_thread::sleep_for(std::chrono::milliseconds(std::min(intervalMS, (clock_t)MAX_INTERVAL)));
-			now = clock();
-			traceTime = now - startTime;
-			t_now = std::chrono::high_resolution_clock::now();
-			t_elapsed = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
-			if ((now - prev)/CLOCKS_PER_SEC * 1000 >= intervalMS)
-			{
-				print(buffer, "Time: %.2f sec, Rays: %u", t_elapsed, TraceUI::getCount());
-				pUI->m_traceGlWindow->label(buffer);
-				pUI->m_traceGlWindow->refresh();
-				prev = now;
-			}
-			// look for input and refresh window
-			Fl::wait(0);			
-			if (Fl::damage()) { Fl::flush(); }
-		}
-		traceTime = clock() - startTime;
-		t_now = std::chrono::high_resolution_clock::now();
-		auto t_trace = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
-		int imageRays = TraceUI::resetCount();
-		print(buffer, "Time: %.2f sec, Rays: %u, Aa: none", t_trace, imageRays);
-		pUI->m_traceGlWindow->label(buffer);
-		pUI->m_traceGlWindow->refresh();
-		if (pUI->aaSwitch() && !stopTrace)
+		restartTrace = false;
+		stopTrace = false;
+		if (pUI->raytracer->sceneLoaded())
 		{
-			clock_t aaStart, aaTime;
-			auto t_aaStart = std::chrono::high_resolution_clock::now();
-			auto t_total = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
-			aaStart = now = prev = clock();
-			int aaPixels = pUI->raytracer->aaImage();
+			int width = pUI->getSize();
+			int	height = (int)(width / pUI->raytracer->aspectRatio() + 0.5);
+			int origPixels = width * height;
+			pUI->m_traceGlWindow->resizeWindow(width, height);
+			pUI->m_traceGlWindow->show();
+			clock_t startTime, now, prev, traceTime;
+			startTime = now = prev = clock();
+			auto t_start = std::chrono::high_resolution_clock::now();
+			auto t_now = t_start;
+			auto t_elapsed = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
+			RayStats::reset();
+			pUI->raytracer->restartRender(width, height);
+			clock_t intervalMS = pUI->refreshInterval * 100;
 			while (!pUI->raytracer->checkRender())
 			{
 				// check for input and refresh view every so often while tracing
-				std::this_thread::sleep_for(std::chrono::milliseconds(std::min(intervalMS, (clock_t)MAX_INTERVAL)));
+				std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL));
 				now = clock();
-				aaTime = now - aaStart;
+				traceTime = now - startTime;
 				t_now = std::chrono::high_resolution_clock::now();
-				t_elapsed = std::chrono::duration<double, std::ratio<1>>(t_now - t_aaStart).count();
-				t_total = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
+				t_elapsed = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
 				if ((now - prev)/CLOCKS_PER_SEC * 1000 >= intervalMS)
 				{
-					print(buffer, "Trace: %.2f, Aa: %.2f, Total: %.2f, aaRays: %d",
-					      t_trace, t_elapsed, t_total, TraceUI::getCount()); 
+					print(buffer, "Time: %.2f sec, Rays: %llu", t_elapsed, (unsigned long long)RayStats::total().rays());
 					pUI->m_traceGlWindow->label(buffer);
 					pUI->m_traceGlWindow->refresh();
 					prev = now;
@@ -339,60 +345,101 @@ void GraphicalUI::cb_render(Fl_Widget* o, void* v) {
 				Fl::wait(0);			
 				if (Fl::damage()) { Fl::flush(); }
 			}
-			aaTime = clock() - aaStart;
+			traceTime = clock() - startTime;
 			t_now = std::chrono::high_resolution_clock::now();
-			t_elapsed = std::chrono::duration<double, std::ratio<1>>(t_now - t_aaStart).count();
-			t_total = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
-			int aaRays = TraceUI::resetCount();
-			print(buffer, "Trace: %.2f, Aa: %.2f, Total: %.2f, Rays: %u, %u, %u",
-			      t_trace, t_elapsed, t_total, imageRays, aaRays, imageRays + aaRays);
+			auto t_trace = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
+			RayStats::Totals stats = RayStats::reset();
+			unsigned long long imageRays = stats.rays();
+			unsigned long long prunedRays = stats[RayStats::PRUNED_RAYS];
+			uint64_t cacheHits = stats[RayStats::SHADOW_CACHE_HITS], cacheTests = stats[RayStats::SHADOW_CACHE_TESTS];
+			print(buffer, "Time: %.2f sec, Rays: %llu, Pruned: %llu, Shadow cache: %d%%, Aa: none", t_trace, imageRays, prunedRays,
+			      cacheTests ? (int)(100 * cacheHits / cacheTests) : 0);
 			pUI->m_traceGlWindow->label(buffer);
 			pUI->m_traceGlWindow->refresh();
-		}
-/*
-		pUI->raytracer->setThreshold(pUI->getThreshold());
-
-		bool zOrder = false;
-		if (zOrder) {
-			int th = height;
-			int tw = width;
-			while (th != 0) {
-				bits++;
-				th = th >> 1;
-			}      
-			while (tw != 0) {
-				bits++;
-				tw = tw >> 1;
-			}      
-		}
-					int frac = min(100,(int)((double)(b_width*b_height*num_blocks)/(double)(width*height)*100.0));
-					// update the window label
-					print(buffer, "%d%% of %s", frac, traceWindowLabel);
-					pUI->m_traceGlWindow->label(buffer);
+			if (pUI->aaSwitch() && !stopTrace)
+			{
+				clock_t aaStart, aaTime;
+				auto t_aaStart = std::chrono::high_resolution_clock::now();
+				auto t_total = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
+				aaStart = now = prev = clock();
+				int aaPixels = pUI->raytracer->aaImage();
+				while (!pUI->raytracer->checkRender())
+				{
+					// check for input and refresh view every so often while tracing
+					std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL));
+					now = clock();
+					aaTime = now - aaStart;
+					t_now = std::chrono::high_resolution_clock::now();
+					t_elapsed = std::chrono::duration<double, std::ratio<1>>(t_now - t_aaStart).count();
+					t_total = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
+					if ((now - prev)/CLOCKS_PER_SEC * 1000 >= intervalMS)
+					{
+						print(buffer, "Trace: %.2f, Aa: %.2f, Total: %.2f, aaRays: %llu",
+						      t_trace, t_elapsed, t_total, (unsigned long long)RayStats::total().rays()); 
+						pUI->m_traceGlWindow->label(buffer);
+						pUI->m_traceGlWindow->refresh();
+						prev = now;
+					}
+					// look for input and refresh window
+					Fl::wait(0);			
+					if (Fl::damage()) { Fl::flush(); }
 				}
+				aaTime = clock() - aaStart;
+				t_now = std::chrono::high_resolution_clock::now();
+				t_elapsed = std::chrono::duration<double, std::ratio<1>>(t_now - t_aaStart).count();
+				t_total = std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
+				unsigned long long aaRays = RayStats::reset().rays();
+				print(buffer, "Trace: %.2f, Aa: %.2f, Total: %.2f, Rays: %llu, %llu, %llu, AA pixels: %d",
+				      t_trace, t_elapsed, t_total, imageRays, aaRays, imageRays + aaRays, aaPixels);
+				pUI->m_traceGlWindow->label(buffer);
+				pUI->m_traceGlWindow->refresh();
+			}
+	/*
+			pUI->raytracer->setThreshold(pUI->getThreshold());
+
+			bool zOrder = false;
+			if (zOrder) {
+				int th = height;
+				int tw = width;
+				while (th != 0) {
+					bits++;
+					th = th >> 1;
+				}      
+				while (tw != 0) {
+					bits++;
+					tw = tw >> 1;
+				}      
+			}
+						int frac = min(100,(int)((double)(b_width*b_height*num_blocks)/(double)(width*height)*100.0));
+						// update the window label
+						print(buffer, "%d%% of %s", frac, traceWindowLabel);
+						pUI->m_traceGlWindow->label(buffer);
+					}
 
-				int ix = 0;
-				int iy = 0;
-				if (zOrder) {
-					int mask = 1;
-					for (int nn = 0; nn < bits; nn++) {
-						ix += ((nextBlock & mask) >> nn);
-						mask = mask << 1;
-						iy += ((nextBlock & mask) >> (nn + 1));
-						mask = mask << 1;
+					int ix = 0;
+					int iy = 0;
+					if (zOrder) {
+						int mask = 1;
+						for (int nn = 0; nn < bits; nn++) {
+							ix += ((nextBlock & mask) >> nn);
+							mask = mask << 1;
+							iy += ((nextBlock & mask) >> (nn + 1));
+							mask = mask << 1;
+						}
+						ix *= b_width;
+						iy *= b_height;
+						nextBlock++;
 					}
-					ix *= b_width;
-					iy *= b_height;
-					nextBlock++;
-				}
-				else {
-					ix = ii;
-					iy = jj;
-				}
-				// data has changed, update on next refresh
-				pUI->m_debuggingWindow->m_debuggingView->setDirty();
-*/
-	}
+					else {
+						ix = ii;
+						iy = jj;
+					}
+					// data has changed, update on next refresh
+					pUI->m_debuggingWindow->m_debuggingView->setDirty();
+	*/
+		}
+	} while (restartTrace);
+	rendering = false;
 }
 
 void GraphicalUI::cb_stop(Fl_Widget* o, void* v)
@@ -440,19 +487,32 @@ Fl_Menu_Item GraphicalUI::menuitems[] = {
 
 void GraphicalUI::stopTracing()
 {
+	restartTrace = false;
 	stopTrace = true;
-	pUI->raytracer->stopTrace = true;
+	pUI->raytracer->cancelRender();
 
 	// Wait for the trace to finish (simple synchronization)
 	while(!pUI->raytracer->checkRender()) Fl::wait();
 //	while(!doneTrace)	Fl::wait();
 }
 
+// Called when a setting that changes the image is touched.  Stops the render
+// in flight (workers notice at their next tile) and lets cb_render start
+// again with the new settings once it sees the old one end.
+void GraphicalUI::restartTracing()
+{
+	if (!rendering)
+		return;
+	restartTrace = true;
+	stopTrace = true;
+	pUI->raytracer->cancelRender();
+}
+
 GraphicalUI::GraphicalUI() : refreshInterval(10) {
 	// init.
 	m_threads = std::max(std::thread::hardware_concurrency(), (unsigned) 1);
 
-	m_mainWindow = new Fl_Window(100, 40, 450, 459, "Ray <Not Loaded>");
+	m_mainWindow = new Fl_Window(100, 40, 450, 484, "Ray <Not Loaded>");
 	m_mainWindow->user_data((void*)(this));	// record self to be used by static callback functions
 	// install menu bar
 	m_menubar = new Fl_Menu_Bar(0, 0, 440, 25);
@@ -661,6 +721,25 @@ GraphicalUI::GraphicalUI() : refreshInterval(10) {
 	m_debuggingDisplayCheckButton->callback(cb_debuggingDisplayCheckButton);
 	m_debuggingDisplayCheckButton->value(m_displayDebuggingInfo);
 
+	// set up progressive rendering checkbox
+	m_progCheckButton = new Fl_Check_Button(170, 419, 110, 20, "Progressive");
+	m_progCheckButton->user_data((void*)(this));
+	m_progCheckButton->callback(cb_progCheckButton);
+	m_progCheckButton->value(m_progressive);
+
+	// install ray cutoff slider
+	m_rayCutoffSlider = new Fl_Value_Slider(10, 449, 180, 20, "Ray Cutoff (x 0.001)");
+	m_rayCutoffSlider->user_data((void*)(this));	// record self to be used by static callback functions
+	m_rayCutoffSlider->type(FL_HOR_NICE_SLIDER);
+	m_rayCutoffSlider->labelfont(FL_COURIER);
+	m_rayCutoffSlider->labelsize(12);
+	m_rayCutoffSlider->minimum(0);
+	m_rayCutoffSlider->maximum(1000);
+	m_rayCutoffSlider->step(1);
+	m_rayCutoffSlider->value(m_nRayCutoff);
+	m_rayCutoffSlider->align(FL_ALIGN_RIGHT);
+	m_rayCutoffSlider->callback(cb_rayCutoffSlides);
+
 	m_mainWindow->callback(cb_exit2);
 	m_mainWindow->when(FL_HIDE);
 	m_mainWindow->end();
@@ -44,6 +44,7 @@ public:
 	Fl_Slider*			m_treeDepthSlider;
 	Fl_Slider*			m_leafSizeSlider;
 	Fl_Slider*			m_filterSlider;
+	Fl_Slider*			m_rayCutoffSlider;
 
 	Fl_Check_Button*	m_debuggingDisplayCheckButton;
 	Fl_Check_Button*	m_aaCheckButton;
@@ -52,6 +53,7 @@ public:
 	Fl_Check_Button*	m_ssCheckButton;
 	Fl_Check_Button*	m_shCheckButton;
 	Fl_Check_Button*	m_bfCheckButton;
+	Fl_Check_Button*	m_progCheckButton;
 
 	Fl_Button*			m_renderButton;
 	Fl_Button*			m_stopButton;
@@ -67,6 +69,7 @@ public:
 	RayTracer* getRayTracer() { return raytracer; }
 
 	static void stopTracing();
+	static void restartTracing();
 
 	// static vars
 	static const char *traceWindowLabel;
@@ -100,6 +103,7 @@ private:
 	static void cb_kdTreeDepthSlides(Fl_Widget* o, void* v);
 	static void cb_kdLeafSizeSlides(Fl_Widget* o, void* v);
 	static void cb_filterSlides(Fl_Widget* o, void* v);
+	static void cb_rayCutoffSlides(Fl_Widget* o, void* v);
 
 	static void cb_render(Fl_Widget* o, void* v);
 	static void cb_stop(Fl_Widget* o, void* v);
@@ -110,8 +114,11 @@ private:
 	static void cb_ssCheckButton(Fl_Widget* o, void* v);
 	static void cb_shCheckButton(Fl_Widget* o, void* v);
 	static void cb_bfCheckButton(Fl_Widget* o, void* v);
+	static void cb_progCheckButton(Fl_Widget* o, void* v);
 
 	static bool stopTrace;
+	static bool rendering;		// cb_render is waiting on a render
+	static bool restartTrace;	// a setting changed, render again once stopped
 	static GraphicalUI* pUI;
 };
 
@@ -30,8 +30,6 @@ void load(Json& j, const string& field, T& target)
 
 TraceUI::TraceUI()
 {
-	for (unsigned int i = 0; i < MAX_THREADS; i++)
-		rayCount[i] = 0;
 }
 
 TraceUI::~TraceUI()
@@ -59,11 +57,19 @@ void TraceUI::loadFromJson(const char* file)
 	load(json, "tree_depth", m_nTreeDepth);
 	load(json, "leaf_size", m_nLeafSize);
 	load(json, "filter_width", m_nFilterWidth);
+	load(json, "thread_func", m_nThreadFunc);
+	load(json, "shadow_depth", m_nShadowDepth);
+	load(json, "specular_depth", m_nSpecularDepth);
+	load(json, "light_cutoff", m_nLightCutoff);
+	load(json, "ray_cutoff", m_nRayCutoff);
+	load(json, "texture_cache", m_textureCache);
+	load(json, "png_level", m_nPngLevel);
 	load(json, "anti_alias", m_antiAlias);
 	load(json, "kdtree", m_kdTree);
 	load(json, "shadows", m_shadows);
 	load(json, "smoothshade", m_smoothshade);
 	load(json, "backface_culling", m_backface);
+	load(json, "progressive", m_progressive);
 	/*
 	 * Note for Students:
 	 * The following options are legacy from previous semesters.
@@ -9,7 +9,6 @@
 
 #include <string>
 #include <memory>
-#define MAX_THREADS 32
 
 using std::string;
 
@@ -41,54 +40,25 @@ public:
 	int getLeafSize() const { return m_nLeafSize; }
 	int getFilterWidth() const { return m_nFilterWidth; }
 	int getThreads() const { return m_threads; }
+	int getThreadFunc() const { return m_nThreadFunc; }
+	int getShadowDepth() const { return m_nShadowDepth; }
+	int getSpecularDepth() const { return m_nSpecularDepth; }
+	double getLightCutoff() const { return (double)m_nLightCutoff * 0.001; }
+	double getRayCutoff() const { return (double)m_nRayCutoff * 0.001; }
+	const string& getTextureCache() const { return m_textureCache; }
+	int getPngLevel() const { return m_nPngLevel; }
 	bool aaSwitch() const { return m_antiAlias; }
 	bool kdSwitch() const { return m_kdTree; }
 	bool shadowSw() const { return m_shadows; }
 	bool smShadSw() const { return m_smoothshade; }
 	bool bkFaceSw() const { return m_backface; }
+	bool progressiveSw() const { return m_progressive; }
 	bool cubeMap() const { return m_usingCubeMap && cubemap; }
 	CubeMap* getCubeMap() const { return cubemap.get(); }
 	void setCubeMap(CubeMap* cm);
 	bool internalReflection() const { return m_internalReflection; }
 	bool backfaceSpecular() const { return m_backfaceSpecular; }
 
-	// ray counter
-	static void addRays(int number, int ctr)
-	{
-		if (ctr >= 0)
-			rayCount[ctr] += number;
-	}
-	static void addRay(int ctr)
-	{
-		if (ctr >= 0)
-			rayCount[ctr]++;
-	}
-	static int getCount(int ctr) { return ctr < 0 ? -1 : rayCount[ctr]; }
-	static int getCount()
-	{
-		int total = 0;
-		for (int i = 0; i < m_threads; i++)
-			total += rayCount[i];
-		return total;
-	}
-	static int resetCount(int ctr)
-	{
-		if (ctr < 0)
-			return -1;
-		int temp = rayCount[ctr];
-		rayCount[ctr] = 0;
-		return temp;
-	}
-	static int resetCount()
-	{
-		int total = 0;
-		for (int i = 0; i < m_threads; i++) {
-			total += rayCount[i];
-			rayCount[i] = 0;
-		}
-		return total;
-	}
-
 	static int m_threads; // number of threads to run
 	static bool m_debug;
 
@@ -107,8 +77,13 @@ protected:
 	int m_nTreeDepth = 15;    // maximum kdTree depth
 	int m_nLeafSize = 10;     // target number of objects per leaf
 	int m_nFilterWidth = 1;   // width of cubemap filter
-
-	static int rayCount[MAX_THREADS]; // Ray counter
+	int m_nThreadFunc = 4;    // how pixels are assigned to threads (1-3 legacy, 4 tiles)
+	int m_nShadowDepth = -1;  // no shadow rays past this recursion depth (-1 = always)
+	int m_nSpecularDepth = -1; // no specular term past this recursion depth (-1 = always)
+	int m_nLightCutoff = 0;   // skip lights adding less than this (x0.001) at a point (0 = use every light)
+	int m_nRayCutoff = 0;     // skip reflected/refracted rays weighing less than this (x0.001) (0 = trace all)
+	string m_textureCache;    // decoded texture cache directory ("" = $RAY_TEXTURE_CACHE or none, "default", "off")
+	int m_nPngLevel = 6;      // zlib level (0-9) for png output
 
 	// Determines whether or not to show debugging information
 	// for individual rays.  Disabled by default for efficiency
@@ -119,6 +94,7 @@ protected:
 	bool m_shadows = true;       // compute shadows?
 	bool m_smoothshade = true;   // turn on/off smoothshading?
 	bool m_backface = true;      // cull backfaces?
+	bool m_progressive = false;  // render coarse-to-fine (tile scheduler only)
 	bool m_usingCubeMap = false; // render with cubemap
 	bool m_internalReflection = true; // Enable reflection inside a translucent object.
 	bool m_backfaceSpecular = false; // Enable specular component even seeing through the back of a translucent object.
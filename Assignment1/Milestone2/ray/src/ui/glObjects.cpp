@@ -1,9 +1,5 @@
 #pragma warning (disable: 4786)
 
-#include <FL/gl.h>
-#include <FL/glu.h>
-#include <math.h>
-
 #include "../scene/scene.h"
 #include "../scene/ray.h"
 #include "../scene/light.h"
@@ -15,6 +11,29 @@
 #include "../SceneObjects/Square.h"
 #include "../SceneObjects/trimesh.h"
 
+#ifdef RAY_NO_GL
+
+// built without OpenGL (see bench/ray_kernels.cpp): nothing gets drawn
+void Scene::glDraw(int, bool, bool) const {}
+void Geometry::glDraw(int, bool, bool) const {}
+void SceneObject::glDraw(int, bool, bool) const {}
+void Sphere::glDrawLocal(int, bool, bool) const {}
+void Box::glDrawLocal(int, bool, bool) const {}
+void Cone::glDrawLocal(int, bool, bool) const {}
+void Cylinder::glDrawLocal(int, bool, bool) const {}
+void Square::glDrawLocal(int, bool, bool) const {}
+void Trimesh::glDrawLocal(int, bool, bool) const {}
+void PointLight::glDraw(GLenum) const {}
+void PointLight::glDraw() const {}
+void DirectionalLight::glDraw(GLenum) const {}
+void DirectionalLight::glDraw() const {}
+
+#else
+
+#include <FL/gl.h>
+#include <FL/glu.h>
+#include <math.h>
+
 using namespace std;
 
 const double pi = 3.1415926535897932384626433832795028841971693993751058209749445923078164062862;
@@ -375,19 +394,19 @@ void Trimesh::glDrawLocal(int quality, bool actualMaterials, bool actualTextures
 			if( ! normals.empty() )
 				glNormal3dv( &normals[vert1][0] );
 			if( !materials.empty() && actualMaterials )
-				setGLMaterial( *materials[vert1], *itr );
+				setGLMaterial( getVertexMaterial(vert1), *itr );
 			glVertex3dv( &vertices[vert1][0] );
 
 			if( ! normals.empty() )
 				glNormal3dv( &normals[vert2][0] );
 			if( !materials.empty() && actualMaterials )
-				setGLMaterial( *materials[vert2], *itr );
+				setGLMaterial( getVertexMaterial(vert2), *itr );
 			glVertex3dv( &vertices[vert2][0] );
 
 			if( ! normals.empty() )
 				glNormal3dv( &normals[vert3][0] );
 			if( !materials.empty() && actualMaterials )
-				setGLMaterial( *materials[vert3], *itr );
+				setGLMaterial( getVertexMaterial(vert3), *itr );
 			glVertex3dv( &vertices[vert3][0] );
 		}
 		glEnd();
@@ -639,3 +658,4 @@ void DirectionalLight::glDraw() const
 
 }
 
+#endif // RAY_NO_GL